@@ -10,6 +10,7 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = CatProject
 TEMPLATE = app
+CONFIG += c++17
 QMAKE_LFLAGS_RELEASE += -static-libgcc -static-libstdc++
 
 INCLUDEPATH += ./glm/
@@ -21,13 +22,51 @@ SOURCES += main.cpp\
     terrainviewer.cpp \
     heightstileset.cpp \
     heightsgrid.cpp \
-    loaderply.cpp
+    heightspyramid.cpp \
+    localstats.cpp \
+    terrainderivatives.cpp \
+    viewshed.cpp \
+    horizonmaps.cpp \
+    hydrology.cpp \
+    contourwriter.cpp \
+    querycontext.cpp \
+    pagedheightsgrid.cpp \
+    heightsbandreader.cpp \
+    textwriter.cpp \
+    rasterwriter.cpp \
+    geotiffwriter.cpp \
+    deflate.cpp \
+    tilepack.cpp \
+    tileprefetcher.cpp \
+    resample.cpp \
+    loaderply.cpp \
+    mappedfile.cpp
 
 HEADERS  += mainwindow.h \
     terrainviewer.h \
     heightstileset.h \
     heightsgrid.h \
+    heightspyramid.h \
+    localstats.h \
+    terrainderivatives.h \
+    viewshed.h \
+    horizonmaps.h \
+    hydrology.h \
+    contourwriter.h \
+    measurepass.h \
+    querycontext.h \
+    pagedheightsgrid.h \
+    heightsbandreader.h \
+    textwriter.h \
+    rasterwriter.h \
+    geotiffwriter.h \
+    deflate.h \
+    isolationsearch.h \
+    tilepack.h \
+    tileprefetcher.h \
+    resample.h \
     loaderply.h \
+    mappedfile.h \
     utils.h
 
 FORMS    += mainwindow.ui
@@ -0,0 +1,435 @@
+#include "contourwriter.h"
+#include "textwriter.h"
+#include "utils.h"
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include <cctype>
+
+namespace {
+
+const std::uint64_t NO_KEY = ~std::uint64_t(0);
+const int LEVEL_OFFSET = 1 << 23;
+const std::uint32_t BINARY_VERSION = 1;
+
+// Key of the crossing of a level with a cell edge: horizontal edges go from
+// the center of cell (col, row) to (col + 1, row), vertical ones to (col, row + 1)
+inline std::uint64_t edgeKey(int level, std::int64_t row, int col, int width, bool vertical)
+{
+    return (std::uint64_t(level + LEVEL_OFFSET) << 40) | (std::uint64_t(row*width + col) << 1) | (vertical ? 1u : 0u);
+}
+
+inline bool onRow(std::uint64_t key, std::int64_t row, int width)
+{
+    if (key == NO_KEY || (key & 1)) return false;
+    return std::int64_t((key & ((std::uint64_t(1) << 40) - 1)) >> 1)/width == row;
+}
+
+// edges crossed by the segments of each marching squares case, corners
+// above the level as bits SW 1, SE 2, NE 4, NW 8 and edges S 0, E 1, N 2,
+// W 3. The saddles 5 and 10 keep the corners above apart, the other case
+// is used when the center is above.
+const signed char CASE_SEGMENTS[16][4] = {
+    { -1, -1, -1, -1 }, { 3, 0, -1, -1 }, { 0, 1, -1, -1 }, { 3, 1, -1, -1 },
+    { 1, 2, -1, -1 },   { 3, 0, 1, 2 },   { 0, 2, -1, -1 }, { 3, 2, -1, -1 },
+    { 2, 3, -1, -1 },   { 0, 2, -1, -1 }, { 0, 1, 2, 3 },   { 1, 2, -1, -1 },
+    { 3, 1, -1, -1 },   { 0, 1, -1, -1 }, { 3, 0, -1, -1 }, { -1, -1, -1, -1 }
+};
+
+template<typename T>
+void writeValue(std::ofstream& fout, const T& v)
+{
+    fout.write((const char*)(&v), sizeof(T));
+}
+
+}
+
+
+// Open lines indexed by the keys of their ends. A piece whose end shares
+// the key of a line end is joined to it, and a line joined at both ends
+// to itself is closed.
+struct ContourWriter::Chainer
+{
+    explicit Chainer(int width) : width(width) {}
+
+    void addSegment(int level, glm::dvec2 p0, glm::dvec2 p1, std::uint64_t k0, std::uint64_t k1,
+                    std::vector<Polyline>& done);
+    void addPiece(Polyline& piece, std::vector<Polyline>& done);
+
+    // the ends on row can not join any more
+    void closeRow(std::int64_t row, std::vector<Polyline>& done);
+
+    // moves out every line, to pieces when keep(key) holds for an end
+    template<typename Keep>
+    void finish(Keep keep, std::vector<Polyline>& done, std::vector<Polyline>& pieces);
+
+private:
+    int  find(std::uint64_t key) const;
+    int  store(Polyline& line);
+    void release(int slot, std::vector<Polyline>* done);
+    void extend(int slot, int end, const std::deque<glm::dvec2>& points, int from);
+    void connect(int slot, int end, std::uint64_t key, int other, std::vector<Polyline>& done);
+
+    int width;
+    std::vector<Polyline> lines;
+    std::vector<char>     used;
+    std::vector<int>      freeSlots;
+    std::unordered_map<std::uint64_t, int> ends;    // slot*2 + end
+};
+
+int ContourWriter::Chainer::find(std::uint64_t key) const
+{
+    if (key == NO_KEY) return -1;
+    auto it = ends.find(key);
+    return it == ends.end() ? -1 : it->second;
+}
+
+int ContourWriter::Chainer::store(Polyline& line)
+{
+    int slot;
+    if (freeSlots.empty()) {
+        slot = int(lines.size());
+        lines.push_back(Polyline());
+        used.push_back(1);
+    }
+    else {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+        used[slot] = 1;
+    }
+    std::swap(lines[slot], line);
+    for (int e = 0; e < 2; e++) {
+        if (lines[slot].ends[e] != NO_KEY) ends[lines[slot].ends[e]] = 2*slot + e;
+    }
+    return slot;
+}
+
+void ContourWriter::Chainer::release(int slot, std::vector<Polyline>* done)
+{
+    if (done) {
+        done->push_back(Polyline());
+        std::swap(done->back(), lines[slot]);
+    }
+    else {
+        lines[slot].points.clear();
+    }
+    used[slot] = 0;
+    freeSlots.push_back(slot);
+}
+
+// points continue the line outwards from its end, the first point at their
+// end from is the one the line already has
+void ContourWriter::Chainer::extend(int slot, int end, const std::deque<glm::dvec2>& points, int from)
+{
+    std::deque<glm::dvec2>& line = lines[slot].points;
+    std::size_t n = points.size();
+    for (std::size_t k = 1; k < n; k++) {
+        const glm::dvec2& p = from == 0 ? points[k] : points[n - 1 - k];
+        if (end == 1) line.push_back(p);
+        else          line.push_front(p);
+    }
+}
+
+// the end of the line now lies at key, which is end other of a line or -1
+void ContourWriter::Chainer::connect(int slot, int end, std::uint64_t key, int other, std::vector<Polyline>& done)
+{
+    if (other < 0) {
+        lines[slot].ends[end] = key;
+        if (key != NO_KEY) ends[key] = 2*slot + end;
+        return;
+    }
+    ends.erase(key);
+    int oslot = other/2, oend = other%2;
+    if (oslot == slot) {
+        lines[slot].ends[0] = lines[slot].ends[1] = NO_KEY;
+        release(slot, &done);
+        return;
+    }
+
+    // the shorter line goes into the longer one
+    if (lines[oslot].points.size() > lines[slot].points.size()) {
+        std::swap(slot, oslot);
+        std::swap(end, oend);
+    }
+    extend(slot, end, lines[oslot].points, oend);
+    std::uint64_t farKey = lines[oslot].ends[1 - oend];
+    lines[slot].ends[end] = farKey;
+    if (farKey != NO_KEY) ends[farKey] = 2*slot + end;
+    release(oslot, nullptr);
+}
+
+void ContourWriter::Chainer::addSegment(int level, glm::dvec2 p0, glm::dvec2 p1, std::uint64_t k0, std::uint64_t k1,
+                                        std::vector<Polyline>& done)
+{
+    int f = find(k0), b = find(k1);
+    if (f < 0 && b < 0) {
+        Polyline line;
+        line.level = level;
+        line.points.push_back(p0);
+        line.points.push_back(p1);
+        line.ends[0] = k0;
+        line.ends[1] = k1;
+        store(line);
+        return;
+    }
+    if (f < 0) {
+        std::swap(p0, p1);
+        std::swap(k0, k1);
+        std::swap(f, b);
+    }
+    int slot = f/2, end = f%2;
+    ends.erase(k0);
+    if (end == 1) lines[slot].points.push_back(p1);
+    else          lines[slot].points.push_front(p1);
+    connect(slot, end, k1, b, done);
+}
+
+void ContourWriter::Chainer::addPiece(Polyline& piece, std::vector<Polyline>& done)
+{
+    int f = find(piece.ends[0]), b = find(piece.ends[1]);
+    if (f < 0 && b < 0) {
+        store(piece);
+        return;
+    }
+    if (f < 0) {
+        std::reverse(piece.points.begin(), piece.points.end());
+        std::swap(piece.ends[0], piece.ends[1]);
+        std::swap(f, b);
+    }
+    int slot = f/2, end = f%2;
+    ends.erase(piece.ends[0]);
+    extend(slot, end, piece.points, 0);
+    connect(slot, end, piece.ends[1], b, done);
+}
+
+void ContourWriter::Chainer::closeRow(std::int64_t row, std::vector<Polyline>& done)
+{
+    std::vector<std::uint64_t> keys;
+    for (const auto& e : ends) {
+        if (onRow(e.first, row, width)) keys.push_back(e.first);
+    }
+    for (std::uint64_t key : keys) {
+        int v = ends[key];
+        ends.erase(key);
+        Polyline& line = lines[v/2];
+        line.ends[v%2] = NO_KEY;
+        if (line.ends[0] == NO_KEY && line.ends[1] == NO_KEY) release(v/2, &done);
+    }
+}
+
+template<typename Keep>
+void ContourWriter::Chainer::finish(Keep keep, std::vector<Polyline>& done, std::vector<Polyline>& pieces)
+{
+    for (int slot = 0; slot < int(lines.size()); slot++) {
+        if (!used[slot]) continue;
+        Polyline& line = lines[slot];
+        for (int e = 0; e < 2; e++) {
+            if (line.ends[e] != NO_KEY && !keep(line.ends[e])) line.ends[e] = NO_KEY;
+        }
+        bool open = line.ends[0] != NO_KEY || line.ends[1] != NO_KEY;
+        release(slot, open ? &pieces : &done);
+    }
+    lines.clear();
+    used.clear();
+    freeSlots.clear();
+    ends.clear();
+}
+
+
+ContourWriter::ContourWriter(const std::string& path, Format format, int gridWidth, const glm::vec2& gridMin,
+                             const glm::vec2& gridRes, int epsg, float noValue, float interval)
+    : format(format), gridWidth(gridWidth), gridMin(gridMin), gridRes(gridRes), noValue(noValue),
+      interval(interval), nextRow(0), numLines(0), numPoints(0), open(new Chainer(gridWidth))
+{
+    if (format == GEOJSON) {
+        text.reset(new TextWriter(path));
+        *text << "{\"type\": \"FeatureCollection\", ";
+        *text << "\"crs\": {\"type\": \"name\", \"properties\": {\"name\": \"urn:ogc:def:crs:EPSG::";
+        *text << epsg << "\"}},\n";
+        *text << "\"features\": [\n";
+        text->setFixed(true);
+        text->precision(2);
+    }
+    else {
+        binary.open(path, std::fstream::out | std::fstream::trunc | std::fstream::binary);
+        binary.write("CNTR", 4);
+        writeValue(binary, BINARY_VERSION);
+        writeValue(binary, std::uint32_t(epsg));
+        writeValue(binary, interval);
+        writeValue(binary, double(gridMin.x));
+        writeValue(binary, double(gridMin.y));
+    }
+}
+
+ContourWriter::~ContourWriter()
+{
+}
+
+bool ContourWriter::formatFromPath(const std::string& path, Format& format)
+{
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    if (ext == "geojson" || ext == "json") format = GEOJSON;
+    else if (ext == "cnt") format = BINARY;
+    else return false;
+    return true;
+}
+
+void ContourWriter::addBand(const HeightsGrid& band)
+{
+    band.visit([&](const auto& view) { traceBand(view); });
+}
+
+template<typename View>
+void ContourWriter::traceBand(const View& view)
+{
+    int width = std::min(gridWidth, view.getGridSize().x);
+    int numRows = view.getGridSize().y;
+    if (numRows <= 0) return;
+
+    // squares of rows r and r + 1 of the band, the row below the band is
+    // the top row of the previous one
+    int rowBase = nextRow;
+    int rFirst = rowBase > 0 ? -1 : 0;
+    int numSlices = (numRows - 1 - rFirst + SLICE_ROWS - 1)/SLICE_ROWS;
+    auto height = [&](int i, int r) {
+        return r < 0 ? lastRow[i] : view.at(i, r);
+    };
+
+    std::vector<std::vector<Polyline> > sliceDone(std::max(numSlices, 0)), slicePieces(std::max(numSlices, 0));
+    runTasks(numSlices, [&](int s) {
+        int r0 = rFirst + s*SLICE_ROWS;
+        int r1 = std::min(r0 + int(SLICE_ROWS), numRows - 1);
+        Chainer chainer(gridWidth);
+        std::vector<Polyline>& done = sliceDone[s];
+
+        // along the columns of the slice, the band is stored by columns
+        for (int i = 0; i + 1 < width; i++) {
+            for (int r = r0; r < r1; r++) {
+                float sw = height(i, r), se = height(i + 1, r);
+                float ne = height(i + 1, r + 1), nw = height(i, r + 1);
+                if (sw <= noValue || se <= noValue || ne <= noValue || nw <= noValue) continue;
+                float lo = std::min(std::min(sw, se), std::min(ne, nw));
+                float hi = std::max(std::max(sw, se), std::max(ne, nw));
+                std::int64_t row = std::int64_t(rowBase) + r;
+                for (int level = int(std::floor(lo/interval)); level*interval <= hi; level++) {
+                    float h = level*interval;
+                    int c = (sw >= h ? 1 : 0) | (se >= h ? 2 : 0) | (ne >= h ? 4 : 0) | (nw >= h ? 8 : 0);
+                    if (c == 0 || c == 15) continue;
+                    if ((c == 5 || c == 10) && 0.25f*(sw + se + ne + nw) >= h) c ^= 15;
+
+                    glm::dvec2 points[4];
+                    std::uint64_t keys[4];
+                    for (int k = 0; k < 4; k++) {
+                        int edge = CASE_SEGMENTS[c][k];
+                        if (edge < 0) break;
+                        switch (edge) {
+                        case 0:
+                            points[k] = glm::dvec2(i + (h - sw)/(se - sw), row);
+                            keys[k] = edgeKey(level, row, i, gridWidth, false);
+                            break;
+                        case 1:
+                            points[k] = glm::dvec2(i + 1, row + (h - se)/(ne - se));
+                            keys[k] = edgeKey(level, row, i + 1, gridWidth, true);
+                            break;
+                        case 2:
+                            points[k] = glm::dvec2(i + (h - nw)/(ne - nw), row + 1);
+                            keys[k] = edgeKey(level, row + 1, i, gridWidth, false);
+                            break;
+                        default:
+                            points[k] = glm::dvec2(i, row + (h - sw)/(nw - sw));
+                            keys[k] = edgeKey(level, row, i, gridWidth, true);
+                            break;
+                        }
+                    }
+                    for (int k = 0; k < 4 && CASE_SEGMENTS[c][k] >= 0; k += 2) {
+                        chainer.addSegment(level, points[k], points[k + 1], keys[k], keys[k + 1], done);
+                    }
+                }
+            }
+        }
+
+        // only the ends on the rows shared with other slices can still join
+        std::int64_t bottom = std::int64_t(rowBase) + r0, top = std::int64_t(rowBase) + r1;
+        chainer.finish([&](std::uint64_t key) {
+            return (bottom > 0 && onRow(key, bottom, gridWidth)) || onRow(key, top, gridWidth);
+        }, done, slicePieces[s]);
+    });
+
+    // slices in order, each one meets the lines of the previous ones at its
+    // bottom row
+    std::vector<Polyline> done;
+    for (int s = 0; s < numSlices; s++) {
+        writeLines(sliceDone[s]);
+        std::vector<Polyline>().swap(sliceDone[s]);
+        for (Polyline& piece : slicePieces[s]) open->addPiece(piece, done);
+        std::vector<Polyline>().swap(slicePieces[s]);
+        open->closeRow(std::int64_t(rowBase) + rFirst + s*SLICE_ROWS, done);
+        writeLines(done);
+        done.clear();
+    }
+
+    lastRow.resize(gridWidth);
+    for (int i = 0; i < width; i++) lastRow[i] = view.at(i, numRows - 1);
+    nextRow += numRows;
+}
+
+void ContourWriter::writeLines(std::vector<Polyline>& lines)
+{
+    if (lines.empty()) return;
+
+    if (format == GEOJSON) {
+        std::size_t first = numLines;
+        text->writeRows(int(lines.size()), [&](int r, TextBuffer& buf) {
+            const Polyline& line = lines[r];
+            if (first + r > 0) buf << ",\n";
+            buf << "{\"type\": \"Feature\", \"properties\": {\"elevation\": " << line.level*interval << "}, ";
+            buf << "\"geometry\": {\"type\": \"LineString\", \"coordinates\": [";
+            for (std::size_t k = 0; k < line.points.size(); k++) {
+                const glm::dvec2& p = line.points[k];
+                if (k > 0) buf << ", ";
+                buf << "[" << gridMin.x + (p.x + 0.5)*gridRes.x << ", " << gridMin.y + (p.y + 0.5)*gridRes.y << "]";
+            }
+            buf << "]}}";
+        });
+    }
+    else {
+        std::vector<float> coords;
+        for (const Polyline& line : lines) {
+            writeValue(binary, float(line.level*interval));
+            writeValue(binary, std::uint32_t(line.points.size()));
+            coords.resize(2*line.points.size());
+            for (std::size_t k = 0; k < line.points.size(); k++) {
+                coords[2*k] = float((line.points[k].x + 0.5)*gridRes.x);
+                coords[2*k + 1] = float((line.points[k].y + 0.5)*gridRes.y);
+            }
+            binary.write((const char*)(coords.data()), std::streamsize(coords.size()*sizeof(float)));
+        }
+    }
+
+    numLines += lines.size();
+    for (const Polyline& line : lines) numPoints += line.points.size();
+}
+
+bool ContourWriter::good() const
+{
+    return format == GEOJSON ? text->good() : binary.good();
+}
+
+bool ContourWriter::close()
+{
+    std::vector<Polyline> done, pieces;
+    open->finish([](std::uint64_t) { return false; }, done, pieces);
+    writeLines(done);
+
+    if (format == GEOJSON) {
+        *text << "\n]}\n";
+        text->close();
+    }
+    else {
+        binary.close();
+    }
+    return good();
+}
@@ -0,0 +1,92 @@
+#ifndef CONTOURWRITER_H
+#define CONTOURWRITER_H
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+class TextWriter;
+
+// Contour lines of a region given band by band from south to north, traced
+// with marching squares over the squares between cell centers, saddles
+// split by the mean of the four corners. The rows of a band are traced in
+// slices on all the cores and the pieces that reach a slice edge are joined
+// in order, so only the band and the lines still open across its top row
+// are kept in memory. Lines stop at cells without value.
+//   GEOJSON  FeatureCollection of LineStrings, one feature per line, with
+//            an "elevation" property and the EPSG code as "crs"
+//   BINARY   "CNTR", uint32 version 1, uint32 EPSG code, float32 interval,
+//            float64 origin x, y, then per line float32 elevation, uint32
+//            number of points and float32 x, y offsets to the origin, all
+//            little endian
+// Closed lines repeat their first point at the end.
+class ContourWriter
+{
+public:
+    enum Format { GEOJSON, BINARY };
+
+    // contours at every multiple of interval of the heights of a region of
+    // gridWidth cells per row, in the projected system of the EPSG code
+    ContourWriter(const std::string& path, Format format, int gridWidth, const glm::vec2& gridMin,
+                  const glm::vec2& gridRes, int epsg, float noValue, float interval);
+    ~ContourWriter();
+
+    // format from the extension of the path (.geojson, .json or .cnt)
+    static bool formatFromPath(const std::string& path, Format& format);
+
+    // the next rows of the region, row y of the band at (x, y)
+    void addBand(const HeightsGrid& band);
+
+    // writes the lines still open
+    bool good() const;
+    bool close();
+
+    std::size_t getNumLines() const;
+    std::size_t getNumPoints() const;
+
+private:
+    enum { SLICE_ROWS = 64 };
+
+    // points in cells from the center of cell (0, 0), with the keys of the
+    // crossed cell edges at its ends, which another piece of the same
+    // contour must share to join it
+    struct Polyline {
+        int level;
+        std::deque<glm::dvec2> points;
+        std::uint64_t ends[2];
+    };
+    struct Chainer;
+
+    template<typename View>
+    void traceBand(const View& view);
+
+    void writeLines(std::vector<Polyline>& lines);
+
+    Format    format;
+    int       gridWidth;
+    glm::vec2 gridMin, gridRes;
+    float     noValue, interval;
+    int       nextRow;
+    std::vector<float> lastRow;
+
+    std::unique_ptr<TextWriter> text;
+    std::ofstream binary;
+    std::size_t   numLines, numPoints;
+
+    // lines open across the top row of the last band
+    std::unique_ptr<Chainer> open;
+};
+
+inline std::size_t ContourWriter::getNumLines() const {
+    return numLines;
+}
+
+inline std::size_t ContourWriter::getNumPoints() const {
+    return numPoints;
+}
+
+#endif // CONTOURWRITER_H
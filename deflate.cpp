@@ -0,0 +1,417 @@
+#include "deflate.h"
+#include <algorithm>
+#include <queue>
+#include <functional>
+
+
+namespace {
+
+const int WINDOW_SIZE   = 1 << 15;
+const int MIN_MATCH     = 3;
+const int MAX_MATCH     = 258;
+const int HASH_BITS     = 15;
+const int MAX_CHAIN     = 32;
+const int BLOCK_SYMBOLS = 1 << 15;
+const int MAX_STORED    = 65535;
+
+const int NUM_LITLEN  = 286;
+const int NUM_DIST    = 30;
+const int NUM_CODELEN = 19;
+
+const int LENGTH_BASE[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const int LENGTH_EXTRA[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const int DIST_BASE[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const int DIST_EXTRA[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+const int CODELEN_ORDER[NUM_CODELEN] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// literal byte, or match length when dist > 0
+struct Symbol {
+    uint16_t litlen;
+    uint16_t dist;
+};
+
+// code length alphabet symbol with its repeat count in the extra bits
+struct CodeLenToken {
+    uint8_t sym;
+    uint8_t extra;
+};
+
+int lengthCode(int len) {
+    return int(std::upper_bound(LENGTH_BASE, LENGTH_BASE + 29, len) - LENGTH_BASE) - 1;
+}
+
+int distCode(int dist) {
+    return int(std::upper_bound(DIST_BASE, DIST_BASE + 30, dist) - DIST_BASE) - 1;
+}
+
+int codeLenExtraBits(int sym) {
+    return sym == 16 ? 2 : sym == 17 ? 3 : sym == 18 ? 7 : 0;
+}
+
+// bits packed from the least significant one, Huffman codes reversed
+class BitWriter
+{
+public:
+    BitWriter(std::vector<uint8_t>& out) : out(out), bits(0), numBits(0) {}
+
+    void put(uint32_t value, int n) {
+        bits |= uint64_t(value) << numBits;
+        numBits += n;
+        while (numBits >= 8) {
+            out.push_back(uint8_t(bits));
+            bits >>= 8;
+            numBits -= 8;
+        }
+    }
+
+    void putCode(uint32_t code, int len) {
+        uint32_t rev = 0;
+        for (int b = 0; b < len; b++) rev |= ((code >> b) & 1) << (len - 1 - b);
+        put(rev, len);
+    }
+
+    void align() {
+        if (numBits > 0) put(0, 8 - numBits);
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint64_t bits;
+    int      numBits;
+};
+
+// code lengths of a Huffman code for the frequencies, limited to maxLen bits
+// by flattening the frequencies. At least two symbols get a code so every
+// inflater takes the code as complete.
+void buildLengths(std::vector<uint32_t> freqs, int maxLen, std::vector<uint8_t>& lengths)
+{
+    int n = int(freqs.size());
+    int used = int(std::count_if(freqs.begin(), freqs.end(), [](uint32_t f) { return f > 0; }));
+    for (int s = 0; s < n && used < 2; s++) {
+        if (freqs[s] == 0) {
+            freqs[s] = 1;
+            used++;
+        }
+    }
+
+    lengths.assign(n, 0);
+    while (true) {
+        // parents always get a larger index than their children
+        typedef std::pair<uint64_t, int> Node;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node> > heap;
+        for (int s = 0; s < n; s++) {
+            if (freqs[s] > 0) heap.push(Node(freqs[s], s));
+        }
+        std::vector<int> parent(2*n, -1);
+        int next = n;
+        while (heap.size() > 1) {
+            Node a = heap.top(); heap.pop();
+            Node b = heap.top(); heap.pop();
+            parent[a.second] = parent[b.second] = next;
+            heap.push(Node(a.first + b.first, next++));
+        }
+
+        std::vector<int> depth(next, 0);
+        for (int k = next - 1; k >= 0; k--) {
+            if (parent[k] >= 0) depth[k] = depth[parent[k]] + 1;
+        }
+        int longest = 0;
+        for (int s = 0; s < n; s++) {
+            lengths[s] = uint8_t(freqs[s] > 0 ? depth[s] : 0);
+            longest = std::max(longest, int(lengths[s]));
+        }
+        if (longest <= maxLen) return;
+
+        for (uint32_t& f : freqs) {
+            if (f > 0) f = (f + 1)/2;
+        }
+    }
+}
+
+// canonical codes of the lengths, RFC 1951 3.2.2
+void buildCodes(const std::vector<uint8_t>& lengths, std::vector<uint16_t>& codes)
+{
+    int count[16] = { 0 };
+    for (uint8_t l : lengths) count[l]++;
+    count[0] = 0;
+    int nextCode[16] = { 0 };
+    int code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + count[bits - 1]) << 1;
+        nextCode[bits] = code;
+    }
+    codes.assign(lengths.size(), 0);
+    for (size_t s = 0; s < lengths.size(); s++) {
+        if (lengths[s] > 0) codes[s] = uint16_t(nextCode[lengths[s]]++);
+    }
+}
+
+// run length coding of the literal/length and distance code lengths
+void encodeCodeLengths(const std::vector<uint8_t>& lens, std::vector<CodeLenToken>& tokens)
+{
+    tokens.clear();
+    size_t i = 0;
+    while (i < lens.size()) {
+        uint8_t l = lens[i];
+        int run = 1;
+        while (i + run < lens.size() && lens[i + run] == l) run++;
+        i += run;
+
+        if (l == 0) {
+            while (run >= 11) {
+                int r = std::min(run, 138);
+                tokens.push_back({ 18, uint8_t(r - 11) });
+                run -= r;
+            }
+            if (run >= 3) {
+                tokens.push_back({ 17, uint8_t(run - 3) });
+                run = 0;
+            }
+        }
+        else {
+            tokens.push_back({ l, 0 });
+            run--;
+            while (run >= 3) {
+                int r = std::min(run, 6);
+                tokens.push_back({ 16, uint8_t(r - 3) });
+                run -= r;
+            }
+        }
+        for (; run > 0; run--) tokens.push_back({ l, 0 });
+    }
+}
+
+class Deflater
+{
+public:
+    Deflater(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+        : data(data), size(size), bits(out) {}
+
+    void run();
+
+private:
+    void insert(size_t p);
+    void writeBlock(size_t rawBegin, size_t rawEnd, bool final);
+    void writeSymbols(const std::vector<uint8_t>& litLens, const std::vector<uint8_t>& distLens);
+    void writeStored(size_t rawBegin, size_t rawEnd, bool final);
+
+    const uint8_t* data;
+    size_t    size;
+    BitWriter bits;
+    std::vector<int>    head, prev;
+    std::vector<Symbol> symbols;
+};
+
+void Deflater::insert(size_t p)
+{
+    if (p + MIN_MATCH > size) return;
+    uint32_t h = ((uint32_t(data[p]) << 10) ^ (uint32_t(data[p + 1]) << 5) ^ data[p + 2]) & ((1u << HASH_BITS) - 1);
+    prev[p] = head[h];
+    head[h] = int(p);
+}
+
+void Deflater::run()
+{
+    head.assign(size_t(1) << HASH_BITS, -1);
+    prev.assign(size, -1);
+    symbols.reserve(BLOCK_SYMBOLS);
+
+    size_t p = 0;
+    size_t blockBegin = 0;
+    while (p < size) {
+        // longest match among the last positions with the same 3 bytes
+        int bestLen = 0, bestDist = 0;
+        if (p + MIN_MATCH <= size) {
+            uint32_t h = ((uint32_t(data[p]) << 10) ^ (uint32_t(data[p + 1]) << 5) ^ data[p + 2]) & ((1u << HASH_BITS) - 1);
+            int maxLen = int(std::min(size_t(MAX_MATCH), size - p));
+            int cand = head[h];
+            for (int chain = 0; cand >= 0 && p - size_t(cand) <= size_t(WINDOW_SIZE) && chain < MAX_CHAIN; chain++) {
+                if (data[cand + bestLen] == data[p + bestLen]) {
+                    int len = 0;
+                    while (len < maxLen && data[cand + len] == data[p + len]) len++;
+                    if (len > bestLen) {
+                        bestLen = len;
+                        bestDist = int(p - size_t(cand));
+                        if (len == maxLen) break;
+                    }
+                }
+                cand = prev[cand];
+            }
+        }
+
+        if (bestLen >= MIN_MATCH) {
+            symbols.push_back({ uint16_t(bestLen), uint16_t(bestDist) });
+            for (int k = 0; k < bestLen; k++) insert(p + k);
+            p += bestLen;
+        }
+        else {
+            symbols.push_back({ data[p], 0 });
+            insert(p);
+            p++;
+        }
+
+        if (symbols.size() >= size_t(BLOCK_SYMBOLS)) {
+            writeBlock(blockBegin, p, false);
+            blockBegin = p;
+        }
+    }
+    writeBlock(blockBegin, size, true);
+    bits.align();
+}
+
+void Deflater::writeBlock(size_t rawBegin, size_t rawEnd, bool final)
+{
+    std::vector<uint32_t> litFreq(NUM_LITLEN, 0), distFreq(NUM_DIST, 0);
+    uint64_t extraBits = 0;
+    for (const Symbol& s : symbols) {
+        if (s.dist == 0) {
+            litFreq[s.litlen]++;
+        }
+        else {
+            int lc = lengthCode(s.litlen);
+            int dc = distCode(s.dist);
+            litFreq[257 + lc]++;
+            distFreq[dc]++;
+            extraBits += LENGTH_EXTRA[lc] + DIST_EXTRA[dc];
+        }
+    }
+    litFreq[256] = 1;
+
+    // dynamic codes and their header
+    std::vector<uint8_t> litLens, distLens, codeLenLens;
+    buildLengths(litFreq, 15, litLens);
+    buildLengths(distFreq, 15, distLens);
+    int hlit = NUM_LITLEN;
+    while (hlit > 257 && litLens[hlit - 1] == 0) hlit--;
+    int hdist = NUM_DIST;
+    while (hdist > 1 && distLens[hdist - 1] == 0) hdist--;
+
+    std::vector<uint8_t> lens(litLens.begin(), litLens.begin() + hlit);
+    lens.insert(lens.end(), distLens.begin(), distLens.begin() + hdist);
+    std::vector<CodeLenToken> tokens;
+    encodeCodeLengths(lens, tokens);
+    std::vector<uint32_t> codeLenFreq(NUM_CODELEN, 0);
+    for (const CodeLenToken& t : tokens) codeLenFreq[t.sym]++;
+    buildLengths(codeLenFreq, 7, codeLenLens);
+    int hclen = NUM_CODELEN;
+    while (hclen > 4 && codeLenLens[CODELEN_ORDER[hclen - 1]] == 0) hclen--;
+
+    // sizes in bits of each kind of block
+    std::vector<uint8_t> fixedLitLens(288, 8), fixedDistLens(NUM_DIST, 5);
+    std::fill(fixedLitLens.begin() + 144, fixedLitLens.begin() + 256, 9);
+    std::fill(fixedLitLens.begin() + 256, fixedLitLens.begin() + 280, 7);
+    uint64_t dynamicBits = 3 + 14 + 3*hclen + extraBits;
+    for (const CodeLenToken& t : tokens) dynamicBits += codeLenLens[t.sym] + codeLenExtraBits(t.sym);
+    uint64_t fixedBits = 3 + extraBits;
+    for (int s = 0; s < NUM_LITLEN; s++) {
+        dynamicBits += uint64_t(litFreq[s])*litLens[s];
+        fixedBits   += uint64_t(litFreq[s])*fixedLitLens[s];
+    }
+    for (int s = 0; s < NUM_DIST; s++) {
+        dynamicBits += uint64_t(distFreq[s])*distLens[s];
+        fixedBits   += uint64_t(distFreq[s])*fixedDistLens[s];
+    }
+    uint64_t storedBits = 8*uint64_t(rawEnd - rawBegin) + 48*((rawEnd - rawBegin)/MAX_STORED + 1);
+
+    if (storedBits <= std::min(dynamicBits, fixedBits)) {
+        writeStored(rawBegin, rawEnd, final);
+    }
+    else if (fixedBits <= dynamicBits) {
+        bits.put(final ? 1 : 0, 1);
+        bits.put(1, 2);
+        writeSymbols(fixedLitLens, fixedDistLens);
+    }
+    else {
+        bits.put(final ? 1 : 0, 1);
+        bits.put(2, 2);
+        bits.put(uint32_t(hlit - 257), 5);
+        bits.put(uint32_t(hdist - 1), 5);
+        bits.put(uint32_t(hclen - 4), 4);
+        for (int k = 0; k < hclen; k++) bits.put(codeLenLens[CODELEN_ORDER[k]], 3);
+        std::vector<uint16_t> codeLenCodes;
+        buildCodes(codeLenLens, codeLenCodes);
+        for (const CodeLenToken& t : tokens) {
+            bits.putCode(codeLenCodes[t.sym], codeLenLens[t.sym]);
+            bits.put(t.extra, codeLenExtraBits(t.sym));
+        }
+        writeSymbols(litLens, distLens);
+    }
+    symbols.clear();
+}
+
+void Deflater::writeSymbols(const std::vector<uint8_t>& litLens, const std::vector<uint8_t>& distLens)
+{
+    std::vector<uint16_t> litCodes, distCodes;
+    buildCodes(litLens, litCodes);
+    buildCodes(distLens, distCodes);
+    for (const Symbol& s : symbols) {
+        if (s.dist == 0) {
+            bits.putCode(litCodes[s.litlen], litLens[s.litlen]);
+        }
+        else {
+            int lc = lengthCode(s.litlen);
+            int dc = distCode(s.dist);
+            bits.putCode(litCodes[257 + lc], litLens[257 + lc]);
+            bits.put(uint32_t(s.litlen - LENGTH_BASE[lc]), LENGTH_EXTRA[lc]);
+            bits.putCode(distCodes[dc], distLens[dc]);
+            bits.put(uint32_t(s.dist - DIST_BASE[dc]), DIST_EXTRA[dc]);
+        }
+    }
+    bits.putCode(litCodes[256], litLens[256]);
+}
+
+void Deflater::writeStored(size_t rawBegin, size_t rawEnd, bool final)
+{
+    // at least one block, even when empty
+    size_t p = rawBegin;
+    do {
+        size_t len = std::min(rawEnd - p, size_t(MAX_STORED));
+        bits.put(final && p + len == rawEnd ? 1 : 0, 1);
+        bits.put(0, 2);
+        bits.align();
+        bits.put(uint32_t(len), 16);
+        bits.put(uint32_t(~len) & 0xFFFF, 16);
+        for (size_t k = 0; k < len; k++) bits.put(data[p + k], 8);
+        p += len;
+    } while (p < rawEnd);
+}
+
+uint32_t adler32(const uint8_t* data, size_t size)
+{
+    const uint32_t MOD = 65521;
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        size_t n = std::min(size, size_t(5552));
+        for (size_t k = 0; k < n; k++) {
+            a += data[k];
+            b += a;
+        }
+        a %= MOD;
+        b %= MOD;
+        data += n;
+        size -= n;
+    }
+    return (b << 16) | a;
+}
+
+}
+
+
+void deflateZlib(const uint8_t* data, std::size_t size, std::vector<uint8_t>& out)
+{
+    // 32 KB window, no dictionary
+    out.push_back(0x78);
+    out.push_back(0x01);
+    Deflater(data, size, out).run();
+    uint32_t check = adler32(data, size);
+    for (int b = 3; b >= 0; b--) out.push_back(uint8_t(check >> (8*b)));
+}
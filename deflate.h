@@ -0,0 +1,13 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Appends the zlib stream (RFC 1950 around RFC 1951 deflate) of the data to
+// out, as TIFF deflate compression stores it. Matches are searched in hash
+// chains over the 32 KB window, and each block is written with dynamic,
+// fixed or no Huffman codes, whichever is smallest.
+void deflateZlib(const uint8_t* data, std::size_t size, std::vector<uint8_t>& out);
+
+#endif // DEFLATE_H
@@ -0,0 +1,318 @@
+#include "geotiffwriter.h"
+#include "deflate.h"
+#include "utils.h"
+#include <sstream>
+#include <locale>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+
+namespace {
+
+enum TiffType { TIFF_ASCII = 2, TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_DOUBLE = 12, TIFF_LONG8 = 16 };
+
+// tag with its values already in file order
+struct TiffEntry {
+    uint16_t    tag;
+    uint16_t    type;
+    uint64_t    count;
+    std::string bytes;
+};
+
+void appendLE(std::string& s, uint64_t v, int n) {
+    for (int b = 0; b < n; b++) s.push_back(char((v >> (8*b)) & 0xFF));
+}
+
+TiffEntry shortEntry(uint16_t tag, const std::vector<uint16_t>& values) {
+    TiffEntry e = { tag, TIFF_SHORT, values.size(), std::string() };
+    for (uint16_t v : values) appendLE(e.bytes, v, 2);
+    return e;
+}
+
+TiffEntry longEntry(uint16_t tag, uint32_t value) {
+    TiffEntry e = { tag, TIFF_LONG, 1, std::string() };
+    appendLE(e.bytes, value, 4);
+    return e;
+}
+
+TiffEntry offsetsEntry(uint16_t tag, const std::vector<uint64_t>& values, bool bigTiff) {
+    TiffEntry e = { tag, uint16_t(bigTiff ? TIFF_LONG8 : TIFF_LONG), values.size(), std::string() };
+    for (uint64_t v : values) appendLE(e.bytes, v, bigTiff ? 8 : 4);
+    return e;
+}
+
+TiffEntry doubleEntry(uint16_t tag, const std::vector<double>& values) {
+    TiffEntry e = { tag, TIFF_DOUBLE, values.size(), std::string() };
+    for (double v : values) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        appendLE(e.bytes, bits, 8);
+    }
+    return e;
+}
+
+TiffEntry asciiEntry(uint16_t tag, const std::string& text) {
+    TiffEntry e = { tag, TIFF_ASCII, text.size() + 1, text };
+    e.bytes.push_back('\0');
+    return e;
+}
+
+// horizontal byte differencing of each row with the bytes of its values
+// split from the most significant one, TIFF Technical Note 3 predictor 3
+void floatPredictor(const float* tile, uint8_t* out)
+{
+    const int ROW_BYTES = GeoTiffWriter::TILE_SIZE*int(sizeof(float));
+    for (int r = 0; r < GeoTiffWriter::TILE_SIZE; r++) {
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(tile + r*GeoTiffWriter::TILE_SIZE);
+        uint8_t* dst = out + r*ROW_BYTES;
+        for (int i = 0; i < GeoTiffWriter::TILE_SIZE; i++) {
+            for (int b = 0; b < 4; b++) {
+                dst[(3 - b)*GeoTiffWriter::TILE_SIZE + i] = src[4*i + b];
+            }
+        }
+        for (int k = ROW_BYTES - 1; k > 0; k--) dst[k] = uint8_t(dst[k] - dst[k - 1]);
+    }
+}
+
+}
+
+
+GeoTiffWriter::GeoTiffWriter(const std::string& path, const std::vector<glm::ivec2>& levelSizes,
+                             const glm::vec2& gridMin, const glm::vec2& gridRes, int epsg,
+                             float noValue, bool compress)
+    : fout(path, std::fstream::out | std::fstream::trunc | std::fstream::binary),
+      gridMin(gridMin), gridRes(gridRes), epsg(epsg), noValue(noValue), compress(compress)
+{
+    uint64_t maxData = 0;
+    for (const glm::ivec2& size : levelSizes) {
+        Level level;
+        level.size = size;
+        level.tiles = (size + glm::ivec2(TILE_SIZE - 1))/int(TILE_SIZE);
+        level.stripRows = 0;
+        level.tileRow = 0;
+        size_t numTiles = size_t(level.tiles.x)*size_t(level.tiles.y);
+        level.offsets.assign(numTiles, 0);
+        level.byteCounts.assign(numTiles, 0);
+        levels.push_back(level);
+        // deflate adds a few bytes per stored block to incompressible tiles
+        maxData += numTiles*(uint64_t(TILE_SIZE*TILE_SIZE*sizeof(float)) + 1024);
+    }
+
+    // the tiles go after the header and the space kept for the directories
+    bigTiff = false;
+    uint64_t start = 8 + directories(8).size();
+    if (start + maxData > 0xFFFFFFFFull) {
+        bigTiff = true;
+        start = 16 + directories(16).size();
+    }
+    fout.write(std::string(start, '\0').data(), std::streamsize(start));
+    dataEnd = start;
+}
+
+GeoTiffWriter::~GeoTiffWriter()
+{
+    close();
+}
+
+bool GeoTiffWriter::isGeoTiffPath(const std::string& path)
+{
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    return ext == "tif" || ext == "tiff";
+}
+
+std::vector<glm::ivec2> GeoTiffWriter::overviewSizes(const glm::ivec2& size)
+{
+    std::vector<glm::ivec2> sizes(1, size);
+    glm::ivec2 s = size;
+    while (glm::max(s.x, s.y) > TILE_SIZE && glm::min(s.x, s.y) >= 2) {
+        s /= 2;
+        sizes.push_back(s);
+    }
+    return sizes;
+}
+
+glm::ivec2 GeoTiffWriter::halve(const std::vector<float>& rows, const glm::ivec2& size,
+                                float noValue, std::vector<float>& half)
+{
+    glm::ivec2 halfSize = size/2;
+    half.assign(size_t(halfSize.x)*size_t(halfSize.y), noValue);
+    for (int r = 0; r < halfSize.y; r++) {
+        const float* row0 = &rows[size_t(2*r)*size.x];
+        const float* row1 = row0 + size.x;
+        for (int x = 0; x < halfSize.x; x++) {
+            const float v[4] = { row0[2*x], row0[2*x + 1], row1[2*x], row1[2*x + 1] };
+            float sum = 0;
+            int n = 0;
+            for (float h : v) {
+                if (h != noValue) {
+                    sum += h;
+                    n++;
+                }
+            }
+            if (n > 0) half[size_t(r)*halfSize.x + x] = sum/float(n);
+        }
+    }
+    return halfSize;
+}
+
+void GeoTiffWriter::writeRows(int level, const float* rows, int numRows)
+{
+    Level& lv = levels[level];
+    while (numRows > 0 && lv.tileRow < lv.tiles.y) {
+        if (lv.strip.empty()) lv.strip.resize(size_t(TILE_SIZE)*size_t(lv.size.x));
+        int n = std::min(numRows, TILE_SIZE - lv.stripRows);
+        std::copy(rows, rows + size_t(n)*lv.size.x, lv.strip.begin() + size_t(lv.stripRows)*lv.size.x);
+        lv.stripRows += n;
+        rows += size_t(n)*lv.size.x;
+        numRows -= n;
+        if (lv.stripRows == TILE_SIZE || lv.tileRow*TILE_SIZE + lv.stripRows == lv.size.y) {
+            writeTileRow(lv);
+        }
+    }
+}
+
+void GeoTiffWriter::writeTileRow(Level& level)
+{
+    // tiles encoded in parallel, then written in order
+    int numTiles = level.tiles.x;
+    encoded.resize(std::max(encoded.size(), size_t(numTiles)));
+    runTasks(numTiles, [&](int tx) { encodeTile(level, tx, encoded[tx]); });
+
+    for (int tx = 0; tx < numTiles; tx++) {
+        size_t t = size_t(level.tileRow)*numTiles + tx;
+        level.offsets[t] = dataEnd;
+        level.byteCounts[t] = encoded[tx].size();
+        fout.write((const char*)(encoded[tx].data()), std::streamsize(encoded[tx].size()));
+        dataEnd += encoded[tx].size();
+    }
+
+    level.tileRow++;
+    level.stripRows = 0;
+    if (level.tileRow == level.tiles.y) std::vector<float>().swap(level.strip);
+}
+
+void GeoTiffWriter::encodeTile(const Level& level, int tx, std::vector<uint8_t>& out) const
+{
+    // cells past the right and bottom edges are no value
+    std::vector<float> tile(TILE_SIZE*TILE_SIZE, noValue);
+    int x0 = tx*TILE_SIZE;
+    int cols = std::min(int(TILE_SIZE), level.size.x - x0);
+    for (int r = 0; r < level.stripRows; r++) {
+        const float* src = &level.strip[size_t(r)*level.size.x + x0];
+        std::copy(src, src + cols, tile.begin() + r*TILE_SIZE);
+    }
+
+    out.clear();
+    if (compress) {
+        std::vector<uint8_t> predicted(tile.size()*sizeof(float));
+        floatPredictor(tile.data(), predicted.data());
+        deflateZlib(predicted.data(), predicted.size(), out);
+    }
+    else {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(tile.data());
+        out.assign(bytes, bytes + tile.size()*sizeof(float));
+    }
+}
+
+std::string GeoTiffWriter::directories(uint64_t start) const
+{
+    std::ostringstream noData;
+    noData.imbue(std::locale::classic());
+    noData << noValue;
+
+    // one directory per level, each followed by its values that do not fit in the entries
+    const int entrySize  = bigTiff ? 20 : 12;
+    const int countSize  = bigTiff ? 8 : 2;
+    const int offsetSize = bigTiff ? 8 : 4;
+    std::string dirs;
+    for (size_t k = 0; k < levels.size(); k++) {
+        const Level& lv = levels[k];
+        std::vector<TiffEntry> entries;
+        entries.push_back(longEntry(254, k > 0 ? 1 : 0));                     // NewSubfileType: overview
+        entries.push_back(longEntry(256, uint32_t(lv.size.x)));                // ImageWidth
+        entries.push_back(longEntry(257, uint32_t(lv.size.y)));                // ImageLength
+        entries.push_back(shortEntry(258, { 32 }));                            // BitsPerSample
+        entries.push_back(shortEntry(259, { uint16_t(compress ? 8 : 1) }));    // Compression: deflate
+        entries.push_back(shortEntry(262, { 1 }));                             // Photometric: black is zero
+        entries.push_back(shortEntry(277, { 1 }));                             // SamplesPerPixel
+        entries.push_back(shortEntry(284, { 1 }));                             // PlanarConfiguration: chunky
+        if (compress) entries.push_back(shortEntry(317, { 3 }));               // Predictor: floating point
+        entries.push_back(shortEntry(322, { TILE_SIZE }));                     // TileWidth
+        entries.push_back(shortEntry(323, { TILE_SIZE }));                     // TileLength
+        entries.push_back(offsetsEntry(324, lv.offsets, bigTiff));             // TileOffsets
+        entries.push_back(offsetsEntry(325, lv.byteCounts, bigTiff));          // TileByteCounts
+        entries.push_back(shortEntry(339, { 3 }));                             // SampleFormat: IEEE float
+        if (k == 0) {
+            double top = double(gridMin.y) + double(lv.size.y)*double(gridRes.y);
+            entries.push_back(doubleEntry(33550, { gridRes.x, gridRes.y, 0 })); // ModelPixelScale
+            entries.push_back(doubleEntry(33922, { 0, 0, 0, gridMin.x, top, 0 })); // ModelTiepoint
+            entries.push_back(shortEntry(34735, {                               // GeoKeyDirectory
+                1, 1, 0, 4,
+                1024, 0, 1, 1,                  // GTModelType: projected
+                1025, 0, 1, 1,                  // GTRasterType: pixel is area
+                3072, 0, 1, uint16_t(epsg),     // ProjectedCSType
+                3076, 0, 1, 9001 }));           // ProjLinearUnits: metre
+        }
+        entries.push_back(asciiEntry(42113, noData.str()));                    // GDAL_NODATA
+
+        uint64_t pos = start + dirs.size();
+        uint64_t valuesPos = pos + countSize + entries.size()*entrySize + offsetSize;
+        std::string dir, values;
+        appendLE(dir, entries.size(), countSize);
+        for (const TiffEntry& e : entries) {
+            appendLE(dir, e.tag, 2);
+            appendLE(dir, e.type, 2);
+            appendLE(dir, e.count, offsetSize);
+            if (e.bytes.size() <= size_t(offsetSize)) {
+                dir += e.bytes;
+                dir.append(offsetSize - e.bytes.size(), '\0');
+            }
+            else {
+                appendLE(dir, valuesPos + values.size(), offsetSize);
+                values += e.bytes;
+                if (values.size()%2) values.push_back('\0');
+            }
+        }
+        uint64_t next = k + 1 < levels.size() ? valuesPos + values.size() : 0;
+        appendLE(dir, next, offsetSize);
+        dirs += dir + values;
+    }
+    return dirs;
+}
+
+bool GeoTiffWriter::good() const
+{
+    return fout.good();
+}
+
+bool GeoTiffWriter::close()
+{
+    if (!fout.is_open()) return false;
+
+    // rows never written are no value
+    for (Level& lv : levels) {
+        while (lv.tileRow < lv.tiles.y) writeTileRow(lv);
+    }
+
+    std::string header("II");
+    if (bigTiff) {
+        appendLE(header, 43, 2);
+        appendLE(header, 8, 2);
+        appendLE(header, 0, 2);
+        appendLE(header, 16, 8);
+    }
+    else {
+        appendLE(header, 42, 2);
+        appendLE(header, 8, 4);
+    }
+    header += directories(header.size());
+    fout.seekp(0);
+    fout.write(header.data(), std::streamsize(header.size()));
+    bool ok = fout.good();
+    fout.close();
+    return ok;
+}
@@ -0,0 +1,68 @@
+#ifndef GEOTIFFWRITER_H
+#define GEOTIFFWRITER_H
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include "glm/glm.hpp"
+
+// Tiled float32 GeoTIFF, in the row order of the RasterWriter files: rows
+// from north to south, the top left corner at gridMin + (0, size.y)*gridRes
+// in the projected system of the EPSG code (25831 for ETRS89 / UTM 31N).
+// Level 0 has the full resolution and each following level is an overview
+// of the same extent. Tiles are deflated with the floating point predictor
+// when compressing, spread over the cores one row of tiles at a time.
+// The directories are reserved at the start of the file and the tiles go
+// after them in the order they are written, so writing the levels from the
+// coarsest to level 0 gives the cloud optimized layout. Files that could
+// pass 4 GB are written as BigTIFF.
+class GeoTiffWriter
+{
+public:
+    enum { TILE_SIZE = 256 };
+
+    GeoTiffWriter(const std::string& path, const std::vector<glm::ivec2>& levelSizes,
+                  const glm::vec2& gridMin, const glm::vec2& gridRes, int epsg,
+                  float noValue, bool compress);
+    ~GeoTiffWriter();
+
+    // true for .tif and .tiff paths
+    static bool isGeoTiffPath(const std::string& path);
+
+    // size halved until it fits in one tile, the full size first
+    static std::vector<glm::ivec2> overviewSizes(const glm::ivec2& size);
+
+    // mean of each 2x2 block of rows with values, for overviews built in memory
+    static glm::ivec2 halve(const std::vector<float>& rows, const glm::ivec2& size,
+                            float noValue, std::vector<float>& half);
+
+    // the next numRows rows of a level, numRows*levelSizes[level].x values
+    void writeRows(int level, const float* rows, int numRows);
+
+    bool good() const;
+    bool close();
+
+private:
+    struct Level {
+        glm::ivec2 size, tiles;
+        std::vector<float> strip;       // rows of the next row of tiles
+        int stripRows;
+        int tileRow;
+        std::vector<uint64_t> offsets, byteCounts;
+    };
+
+    void writeTileRow(Level& level);
+    void encodeTile(const Level& level, int tx, std::vector<uint8_t>& out) const;
+    std::string directories(uint64_t start) const;
+
+    std::ofstream fout;
+    std::vector<Level> levels;
+    std::vector<std::vector<uint8_t> > encoded;
+    glm::vec2 gridMin, gridRes;
+    int       epsg;
+    float     noValue;
+    bool      compress, bigTiff;
+    uint64_t  dataEnd;
+};
+
+#endif // GEOTIFFWRITER_H
@@ -0,0 +1,56 @@
+#include "heightsbandreader.h"
+#include "querycontext.h"
+
+
+HeightsBandReader::HeightsBandReader(const HeightsTileset& tileset, const glm::vec2& pmin, const glm::vec2& pmax,
+                                     const glm::vec2& res, std::size_t maxBandBytes, ResampleFilter filter)
+    : tileset(tileset), gridMin(pmin), gridMax(pmax), gridRes(res), filter(filter)
+{
+    gridSize = glm::max(glm::ivec2((gridMax - gridMin)/gridRes), glm::ivec2(0));
+    int numPointsX = int(glm::ceil((gridMax.x - gridMin.x)/gridRes.x));
+    int maxRows = int(glm::max(maxBandBytes/(glm::max(std::size_t(numPointsX), std::size_t(1))*sizeof(float)),
+                               std::size_t(1)));
+
+    // runs of rows on the same tile row are kept together while they fit,
+    // runs larger than the budget are split
+    float tileExtY = tileset.getTileExtension().y;
+    float tsetMinY = tileset.getTilesetMin().y;
+    bandRows.push_back(0);
+    int start = 0;
+    int y = 0;
+    while (y < gridSize.y) {
+        int tile = int(glm::floor((gridMin.y + y*gridRes.y - tsetMinY)/tileExtY));
+        int runEnd = y + 1;
+        while (runEnd < gridSize.y && int(glm::floor((gridMin.y + runEnd*gridRes.y - tsetMinY)/tileExtY)) == tile) {
+            runEnd++;
+        }
+        if (y > start && runEnd - start > maxRows) {
+            start = y;
+            bandRows.push_back(start);
+        }
+        while (runEnd - start > maxRows) {
+            start += maxRows;
+            bandRows.push_back(start);
+        }
+        y = runEnd;
+    }
+    if (gridSize.y > 0) bandRows.push_back(gridSize.y);
+}
+
+glm::vec2 HeightsBandReader::getBandMin(int b) const {
+    return glm::vec2(gridMin.x, gridMin.y + float(bandRows[b])*gridRes.y);
+}
+
+glm::vec2 HeightsBandReader::getBandMax(int b) const {
+    return glm::vec2(gridMax.x, gridMin.y + float(bandRows[b + 1])*gridRes.y);
+}
+
+const HeightsGrid& HeightsBandReader::loadBand(int b, int next, QueryContext& ctx)
+{
+    // the next tiles are read while the caller writes this band
+    tileset.loadRegion(getBandMin(b), getBandMax(b), gridRes, band, ctx, HeightsGrid::FLOAT32, filter);
+    if (next >= 0 && next < getNumBands()) {
+        tileset.prefetchRegion(getBandMin(next), getBandMax(next));
+    }
+    return band;
+}
@@ -0,0 +1,77 @@
+#ifndef HEIGHTSBANDREADER_H
+#define HEIGHTSBANDREADER_H
+#include <vector>
+#include <cstddef>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+#include "heightstileset.h"
+
+class QueryContext;
+
+// Region of a tileset read in bands of whole rows, so exports can write
+// grids larger than memory. The cells are those of loadRegion over the same
+// region, and the bands follow the tile rows so each tile is read once when
+// a tile row fits in the budget.
+class HeightsBandReader
+{
+public:
+    HeightsBandReader(const HeightsTileset& tileset, const glm::vec2& pmin, const glm::vec2& pmax,
+                      const glm::vec2& res, std::size_t maxBandBytes, ResampleFilter filter = RESAMPLE_MEAN);
+
+    // cells wholly inside the region, as HeightsGrid::getGridSize
+    glm::ivec2 getGridSize() const;
+    glm::vec2  getGridMin() const;
+    glm::vec2  getGridRes() const;
+    float      getGridNoValue() const;
+
+    // band b holds the rows [getBandBegin(b), getBandEnd(b)), row y being
+    // cell (x, y - getBandBegin(b)) of the grid loadBand returns
+    int getNumBands() const;
+    int getBandBegin(int b) const;
+    int getBandEnd(int b) const;
+
+    // the tiles of band next, when given, are read ahead in the background
+    const HeightsGrid& loadBand(int b, int next, QueryContext& ctx);
+
+private:
+    glm::vec2 getBandMin(int b) const;
+    glm::vec2 getBandMax(int b) const;
+
+    const HeightsTileset& tileset;
+    glm::vec2      gridMin, gridMax, gridRes;
+    glm::ivec2     gridSize;
+    ResampleFilter filter;
+    std::vector<int> bandRows;      // first row of each band, and the end
+    HeightsGrid    band;
+};
+
+
+inline glm::ivec2 HeightsBandReader::getGridSize() const {
+    return gridSize;
+}
+
+inline glm::vec2 HeightsBandReader::getGridMin() const {
+    return gridMin;
+}
+
+inline glm::vec2 HeightsBandReader::getGridRes() const {
+    return gridRes;
+}
+
+inline float HeightsBandReader::getGridNoValue() const {
+    return tileset.getNoValue();
+}
+
+inline int HeightsBandReader::getNumBands() const {
+    return int(bandRows.size()) - 1;
+}
+
+inline int HeightsBandReader::getBandBegin(int b) const {
+    return bandRows[b];
+}
+
+inline int HeightsBandReader::getBandEnd(int b) const {
+    return bandRows[b + 1];
+}
+
+#endif // HEIGHTSBANDREADER_H
@@ -1,16 +1,36 @@
 #include "heightsgrid.h"
+#include "measurepass.h"
+#include "isolationsearch.h"
 #include <cmath>
-#include <queue>
-#include <utility>
+#include <algorithm>
 
 
+HeightsGrid::HeightsGrid()
+{
+    storage = FLOAT32;
+    stride = 0;
+    scaleOffset = 0;
+    scaleStep = 1;
+    gridMin = gridMax = gridRes = glm::vec2(0);
+    gridSize = glm::ivec2(0);
+    gridNoValue = -9999.0f;
+    heightMin = heightMax = gridNoValue;
+}
+
 HeightsGrid::HeightsGrid(const std::vector<std::vector<float> >& grid,
                          const glm::vec2& gmin,
                          const glm::vec2& gmax,
                          const glm::vec2& gres,
                          float gridNoVal)
 {
-    this->grid = grid;
+    storage = FLOAT32;
+    stride = grid.empty() ? 0 : int(grid[0].size());
+    scaleOffset = 0;
+    scaleStep = 1;
+    heights32.resize(grid.size()*std::size_t(stride));
+    for (std::size_t i = 0; i < grid.size(); i++) {
+        std::copy(grid[i].begin(), grid[i].begin() + stride, heights32.begin() + i*stride);
+    }
     this->gridMin = gmin;
     this->gridMax = gmax;
     this->gridRes = gres;
@@ -19,6 +39,81 @@ HeightsGrid::HeightsGrid(const std::vector<std::vector<float> >& grid,
     heightMin = heightMax = gridNoValue;
 }
 
+void HeightsGrid::resize(const glm::vec2& gmin, const glm::vec2& gmax, const glm::vec2& gres, float gridNoVal,
+                         Storage storage, float hmin, float hmax)
+{
+    this->gridMin = gmin;
+    this->gridMax = gmax;
+    this->gridRes = gres;
+    this->gridSize = glm::ivec2((gmax - gmin)/gres);
+    this->gridNoValue = gridNoVal;
+    heightMin = heightMax = gridNoValue;
+
+    // storage covers the partial last row and column, as loadRegion does
+    glm::ivec2 numPoints = glm::ivec2(glm::ceil((gmax - gmin)/gres));
+    std::size_t numCells = std::size_t(numPoints.x)*std::size_t(numPoints.y);
+    this->stride = numPoints.y;
+    this->storage = storage;
+    this->scaleOffset = hmin;
+    this->scaleStep = glm::max(hmax - hmin, 1.0f)/65534.0f;
+
+    // the vector of the previous storage is released when it changes
+    if (storage == FLOAT32) {
+        std::vector<uint16_t>().swap(heights16);
+        heights32.assign(numCells, gridNoValue);
+    }
+    else {
+        std::vector<float>().swap(heights32);
+        Int16DmCodec      dmCodec = { gridNoValue };
+        UInt16ScaledCodec scaledCodec = { gridNoValue, scaleOffset, scaleStep };
+        heights16.assign(numCells, storage == INT16_DM ? dmCodec.encode(gridNoValue) : scaledCodec.encode(gridNoValue));
+    }
+}
+
+void HeightsGrid::reframe(const glm::vec2& gmin, const glm::vec2& gmax)
+{
+    glm::ivec2 shift = glm::ivec2(glm::round((gmin - gridMin)/gridRes));
+    glm::ivec2 oldSize = gridSize;
+    int        oldStride = stride;
+
+    // the kept cells are copied column by column into the new extent
+    std::vector<float>    old32;
+    std::vector<uint16_t> old16;
+    old32.swap(heights32);
+    old16.swap(heights16);
+    float oldOffset = scaleOffset, oldStep = scaleStep;
+    resize(gmin, gmax, gridRes, gridNoValue, storage);
+    scaleOffset = oldOffset;
+    scaleStep = oldStep;
+
+    glm::ivec2 keepMin = glm::max(-shift, glm::ivec2(0));
+    glm::ivec2 keepMax = glm::min(oldSize - shift, gridSize);
+    for (int i = keepMin.x; i < keepMax.x; i++) {
+        std::size_t src = std::size_t(i + shift.x)*oldStride + (keepMin.y + shift.y);
+        std::size_t dst = std::size_t(i)*stride + keepMin.y;
+        int n = keepMax.y - keepMin.y;
+        if (n <= 0) break;
+        if (storage == FLOAT32) std::copy(old32.begin() + src, old32.begin() + src + n, heights32.begin() + dst);
+        else                    std::copy(old16.begin() + src, old16.begin() + src + n, heights16.begin() + dst);
+    }
+}
+
+void HeightsGrid::setRun(int i, int j, const float* h, int n)
+{
+    std::size_t k = std::size_t(i)*stride + j;
+    if (storage == FLOAT32) {
+        std::copy(h, h + n, heights32.begin() + k);
+    }
+    else if (storage == INT16_DM) {
+        Int16DmCodec codec = { gridNoValue };
+        for (int c = 0; c < n; c++) heights16[k + c] = codec.encode(h[c]);
+    }
+    else {
+        UInt16ScaledCodec codec = { gridNoValue, scaleOffset, scaleStep };
+        for (int c = 0; c < n; c++) heights16[k + c] = codec.encode(h[c]);
+    }
+}
+
 void HeightsGrid::buildTriangleModel(std::vector<glm::vec3> &verts, std::vector<glm::ivec3> &tris) const
 {
     // build vertices
@@ -26,8 +121,9 @@ void HeightsGrid::buildTriangleModel(std::vector<glm::vec3> &verts, std::vector<
     std::vector<std::vector<int> > vtxId(gridSize.x, std::vector<int>(gridSize.y, -1));
     for (int x = 0; x < gridSize.x; x++) {
         for (int y = 0; y < gridSize.y; y++) {
-            if (grid[x][y] > gridNoValue) {
-                glm::vec3 p(x*gridRes.x + gridMin.x, y*gridRes.y + gridMin.y, grid[x][y]);
+            float h = at(x, y);
+            if (h > gridNoValue) {
+                glm::vec3 p(x*gridRes.x + gridMin.x, y*gridRes.y + gridMin.y, h);
                 vtxId[x][y] = int(verts.size());
                 verts.push_back(p);
             }
@@ -64,10 +160,10 @@ void HeightsGrid::buildTriangleModel(std::vector<glm::vec3> &verts, std::vector<
 
 float HeightsGrid::getHeightMin() {
     if (heightMin <= gridNoValue) {
-        heightMin = grid[0][0];
+        heightMin = at(0, 0);
         for (int i = 0; i < gridSize.x; i++) {
             for (int j = 0; j < gridSize.y; j++) {
-                heightMin = glm::min(heightMin, grid[i][j]);
+                heightMin = glm::min(heightMin, at(i, j));
             }
         }
     }
@@ -76,10 +172,10 @@ float HeightsGrid::getHeightMin() {
 
 float HeightsGrid::getHeightMax() {
     if (heightMax <= gridNoValue) {
-        heightMax = grid[0][0];
+        heightMax = at(0, 0);
         for (int i = 0; i < gridSize.x; i++) {
             for (int j = 0; j < gridSize.y; j++) {
-                heightMax = glm::max(heightMax, grid[i][j]);
+                heightMax = glm::max(heightMax, at(i, j));
             }
         }
     }
@@ -89,117 +185,61 @@ float HeightsGrid::getHeightMax() {
 float HeightsGrid::getHeight(const glm::vec2 &p) const
 {
 	glm::ivec2 pcoords = glm::ivec2((p - gridMin) / gridRes);
-	return grid[pcoords.x][pcoords.y];
+	return at(pcoords.x, pcoords.y);
 }
 
 void HeightsGrid::computeRadialStatistics(const glm::vec2 &p, float rad, glm::vec3 &hmin, glm::vec3 &hmax, float &hmean, float &hdev) const
 {
     glm::ivec2 pcoords = glm::ivec2((p - gridMin)/gridRes);
-    float ph = grid[pcoords.x][pcoords.y];
+    float ph = at(pcoords.x, pcoords.y);
     return computeRadialStatistics(glm::vec3(p.x, p.y, ph), rad, hmin, hmax, hmean, hdev);
 }
 
 void HeightsGrid::computeRadialStatistics(const glm::vec3 &p, float rad, glm::vec3 &hmin, glm::vec3 &hmax, float &hmean, float &hdev) const
 {
-    double hsum = 0;
-    double ssum = 0;
-    int N = 0;
-
-    glm::vec2 p_xy = glm::vec2(p);
-    glm::ivec2 pcoords = glm::ivec2((p_xy - gridMin)/gridRes);
-    glm::ivec2 radOff = glm::ivec2(glm::ceil(glm::vec2(rad)/gridRes));
-    glm::ivec2 ijMin = glm::max(pcoords - radOff, glm::ivec2(0));
-    glm::ivec2 ijMax = glm::min(pcoords + radOff, gridSize);
-    hmin = hmax = p;
-
-    for (int i = ijMin.x; i < ijMax.x; i++) {
-        for (int j = ijMin.y; j < ijMax.y; j++) {
-            glm::vec2 pij = gridMin + glm::vec2(i + 0.5f, j + 0.5f)*gridRes;
-            if (glm::distance(pij, p_xy) <= rad && grid[i][j] >= 0) {
-                double h = static_cast<double>(grid[i][j]);
-                if (h < hmin.z) {
-                    hmin = glm::vec3(gridMin.x + i*gridRes.x, gridMin.y + j*gridRes.y, h);
-                }
-                if (h > hmax.z) {
-                    hmax = glm::vec3(gridMin.x + i*gridRes.x, gridMin.y + j*gridRes.y, h);
-                }
-                hsum += h;
-                ssum += h*h;
-                N++;
-            }
-        }
-    }
-
-    hmean = float(hsum/double(N));
-    hdev = float(glm::sqrt((ssum - hsum*hsum/double(N))/double(N - 1)));
+    RadialStatsPolicy& stats = QueryContext::threadContext().radialStats(rad);
+    measurePass(*this, p, stats);
+    hmin = stats.getMin(0);
+    hmax = stats.getMax(0);
+    hmean = stats.getMean(0);
+    hdev = stats.getStdev(0);
 }
 
-float HeightsGrid::computeIsolation(const glm::vec2 &p, float minDist, glm::vec3 &pIso, float minIsoArea, float hOffset) const
+float HeightsGrid::computeIsolation(const glm::vec2 &p, float minDist, glm::vec3 &pIso, float minIsoArea, float hOffset, QueryContext* ctx) const
 {
     glm::ivec2 pcoords = glm::ivec2((p - gridMin)/gridRes);
-    float ph = grid[pcoords.x][pcoords.y];
-    return computeIsolation(glm::vec3(p.x, p.y, ph), minDist, pIso, minIsoArea, hOffset);
-}
-
-float HeightsGrid::computeIsolation(const glm::vec3 &p, float minDist, glm::vec3 &pIso, float minIsoArea, float hOffset) const
-{
-    glm::vec2 p_xy = glm::vec2(p);
-    glm::ivec2 pcoords = glm::ivec2((p_xy - gridMin)/gridRes);
-    float ph = p.z + hOffset;
-    pIso = p;
-	float isoArea = 0;
-
-    std::priority_queue<std::pair<float, std::pair<int,int> > > Q;
-    std::vector<std::vector<bool> > Visited(gridSize.x, std::vector<bool>(gridSize.y, false));
-    Q.push(std::make_pair(0.0f, std::make_pair(pcoords.x, pcoords.y)));
-    while (!Q.empty()) {
-        std::pair<float, std::pair<int, int> > qtop = Q.top(); Q.pop();
-        int pcx = qtop.second.first;
-        int pcy = qtop.second.second;
-        if (pcx >= 0 && pcy >= 0 && pcx < gridSize.x && pcy < gridSize.y && !Visited[pcx][pcy]) {
-            Visited[pcx][pcy] = true;
-            float h = grid[pcx][pcy];
-			glm::vec2 pij = gridMin + glm::vec2(pcx + 0.5f, pcy + 0.5f)*gridRes;
-			float d = glm::distance(pij, p_xy);
-            if (h > ph && d >= minDist) {
-				// keep the last isolation point found
-                pIso = glm::vec3(pij.x, pij.y, h);
-				isoArea += gridRes.x * gridRes.y;
-				if (isoArea > minIsoArea)
-					break;
-            }
-
-            Q.push(std::make_pair(-d - std::sqrt(2.0f), std::make_pair(pcx - 1, pcy - 1)));
-            Q.push(std::make_pair(-d - 1,               std::make_pair(pcx - 1, pcy    )));
-            Q.push(std::make_pair(-d - std::sqrt(2.0f), std::make_pair(pcx - 1, pcy + 1)));
-            Q.push(std::make_pair(-d - 1,               std::make_pair(pcx,     pcy - 1)));
-            Q.push(std::make_pair(-d - 1,               std::make_pair(pcx,     pcy + 1)));
-            Q.push(std::make_pair(-d - std::sqrt(2.0f), std::make_pair(pcx + 1, pcy - 1)));
-            Q.push(std::make_pair(-d - 1,               std::make_pair(pcx + 1, pcy    )));
-            Q.push(std::make_pair(-d - std::sqrt(2.0f), std::make_pair(pcx + 1, pcy + 1)));
-        }
-    }
-
-    float dres = glm::distance(p_xy, glm::vec2(pIso));
-    if (dres > minDist) return dres;
-    else                return -1;
+    float ph = at(pcoords.x, pcoords.y);
+    return computeIsolation(glm::vec3(p.x, p.y, ph), minDist, pIso, minIsoArea, hOffset, ctx);
 }
 
-
-inline double slopeNormalization(double u) {
-	double atanu = atan(u);
-	return (4.0/(M_PI*M_PI*M_PI)) * (2*u*atanu - log(u*u + 1) - atanu*atanu);
+float HeightsGrid::computeIsolation(const glm::vec3 &p, float minDist, glm::vec3 &pIso, float minIsoArea, float hOffset, QueryContext* ctx) const
+{
+    // visited marks and heap come from the caller's scratch when given
+    if (!ctx) ctx = &QueryContext::threadContext();
+    float iso = -1;
+    visit([&](const auto& view) { iso = isolationSearch(view, p, minDist, pIso, minIsoArea, hOffset, *ctx); });
+    return iso;
 }
 
+
 float HeightsGrid::computeORS(const glm::vec2 &p, float radius) const
 {
 	glm::ivec2 pcoords = glm::ivec2((p - gridMin) / gridRes);
-	float ph = grid[pcoords.x][pcoords.y];
+	float ph = at(pcoords.x, pcoords.y);
 	return computeORS(glm::vec3(p.x, p.y, ph), radius);
 }
 
-float HeightsGrid::computeORS(const glm::vec3 &p, float radius) const
+namespace {
+
+// integral of computeORS, compiled for each storage type
+template<typename Grid>
+double orsIntegral(const Grid& grid, const glm::vec3 &p, float radius)
 {
+	glm::vec2  gridMin = grid.getGridMin();
+	glm::vec2  gridRes = grid.getGridRes();
+	glm::ivec2 gridSize = grid.getGridSize();
+	float      gridNoValue = grid.getGridNoValue();
+
 	glm::vec2 p_xy = glm::vec2(p);
 	double    h0 = p.z;
 	glm::ivec2 pcoords = glm::ivec2((p_xy - gridMin) / gridRes);
@@ -213,8 +253,9 @@ float HeightsGrid::computeORS(const glm::vec3 &p, float radius) const
 		for (int j = ijMin.y; j < ijMax.y; j++) { 
 			glm::vec2 pij = gridMin + glm::vec2(i + 0.5f, j + 0.5f)*gridRes;
 			float pdist = glm::distance(pij, p_xy);
-			if (pdist <= radius && pdist > 0.1*gridRes.x && grid[i][j] >= gridNoValue) {
-				double h = static_cast<double>(grid[i][j]);
+			float hij = grid.at(i, j);
+			if (pdist <= radius && pdist > 0.1*gridRes.x && hij >= gridNoValue) {
+				double h = static_cast<double>(hij);
 				// higher ground does not contribute
 				if (h <= h0) {
 					double y = h0 - h;
@@ -225,7 +266,35 @@ float HeightsGrid::computeORS(const glm::vec3 &p, float radius) const
 			}
 		}
 	}	
+	return integral;
+}
+
+}
+
+float HeightsGrid::computeORS(const glm::vec3 &p, float radius) const
+{
+	double integral = 0;
+	visit([&](const auto& view) { integral = orsIntegral(view, p, radius); });
 	double ors = sqrt(integral);
 
 	return float(ors);
 }
+
+void HeightsGrid::computeORS(const glm::vec2 &p, const std::vector<float>& radii, std::vector<float>& ors) const
+{
+	glm::ivec2 pcoords = glm::ivec2((p - gridMin) / gridRes);
+	float ph = at(pcoords.x, pcoords.y);
+	computeORS(glm::vec3(p.x, p.y, ph), radii, ors);
+}
+
+void HeightsGrid::computeORS(const glm::vec3 &p, const std::vector<float>& radii, std::vector<float>& ors) const
+{
+	ors.assign(radii.size(), 0.0f);
+	if (radii.empty()) return;
+
+	ORSPolicy orsPolicy(radii);
+	measurePass(*this, p, orsPolicy);
+	for (unsigned int r = 0; r < radii.size(); r++) {
+		ors[r] = orsPolicy.getORS(r);
+	}
+}
@@ -1,11 +1,26 @@
 #ifndef HEIGHTSGRID_H
 #define HEIGHTSGRID_H
 #include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
 #include "glm/glm.hpp"
 
+class QueryContext;
+template<typename Codec> class HeightsGridView;
+
 class HeightsGrid
 {
 public:
+    // how the heights are kept in memory
+    enum Storage {
+        FLOAT32,        // 4 bytes, exact
+        INT16_DM,       // 2 bytes, decimetres in [-3276.7, 3276.7] m
+        UINT16_SCALED   // 2 bytes, 65535 steps over the range given to resize
+    };
+
+    HeightsGrid();
     HeightsGrid(const std::vector<std::vector<float> >& grid,
                 const glm::vec2& gmin,
                 const glm::vec2& gmax,
@@ -19,7 +34,30 @@ public:
     glm::ivec2 getGridSize() const;
     float      getGridNoValue() const;
 
-    const std::vector<std::vector<float> >& data() const;
+    Storage     getStorage() const;
+    void        getStorageRange(float& hmin, float& hmax) const;
+    std::size_t getMemoryBytes() const;
+    static std::size_t getBytesPerHeight(Storage storage);
+
+    float at(int i, int j) const;
+    float atIfHigher(int i, int j, float h) const;
+    void  set(int i, int j, float h);
+    void  setRun(int i, int j, const float* h, int n);     // cells (i, j) to (i, j + n - 1)
+
+    // new extent filled with no values, reusing the current memory. Scaled
+    // storage covers [hmin, hmax], heights outside are clamped
+    void  resize(const glm::vec2& gmin, const glm::vec2& gmax, const glm::vec2& gres, float gridNoVal = -9999.0f,
+                 Storage storage = FLOAT32, float hmin = -500.0f, float hmax = 3500.0f);
+
+    // new extent on the same lattice of cells, (gmin - min)/res being whole.
+    // Cells lying wholly inside both extents keep their heights, the rest
+    // are no values
+    void  reframe(const glm::vec2& gmin, const glm::vec2& gmax);
+
+    // calls kernel(view) with the HeightsGridView of the current storage, so
+    // kernels are compiled once per storage type
+    template<typename Kernel>
+    void  visit(Kernel kernel) const;
 
     void  buildTriangleModel(std::vector<glm::vec3>& verts, std::vector<glm::ivec3>& tris) const;
 
@@ -29,13 +67,22 @@ public:
 
     void  computeRadialStatistics(const glm::vec2& p, float rad, glm::vec3& hmin, glm::vec3& hmax, float& hmean, float& hdev) const;
     void  computeRadialStatistics(const glm::vec3& p, float rad, glm::vec3& hmin, glm::vec3& hmax, float& hmean, float& hdev) const;
-    float computeIsolation(const glm::vec2& p, float minDist, glm::vec3& pIso, float minIsoArea = 0, float hOffset = 0) const;
-    float computeIsolation(const glm::vec3& p, float minDist, glm::vec3& pIso, float minIsoArea = 0, float hOffset = 0) const;
+    float computeIsolation(const glm::vec2& p, float minDist, glm::vec3& pIso, float minIsoArea = 0, float hOffset = 0, QueryContext* ctx = nullptr) const;
+    float computeIsolation(const glm::vec3& p, float minDist, glm::vec3& pIso, float minIsoArea = 0, float hOffset = 0, QueryContext* ctx = nullptr) const;
 	float computeORS(const glm::vec2& p, float radius) const;
 	float computeORS(const glm::vec3& p, float radius) const;
+	void  computeORS(const glm::vec2& p, const std::vector<float>& radii, std::vector<float>& ors) const;
+	void  computeORS(const glm::vec3& p, const std::vector<float>& radii, std::vector<float>& ors) const;
 
 private:
-    std::vector<std::vector<float> > grid;
+    // cells in column order, (i, j) at i*stride + j. Only the vector of the
+    // current storage holds data
+    Storage               storage;
+    std::vector<float>    heights32;
+    std::vector<uint16_t> heights16;
+    int                   stride;
+    float                 scaleOffset, scaleStep;
+
     glm::vec2  gridMin, gridMax, gridRes;
     glm::ivec2 gridSize;
     float      gridNoValue;
@@ -43,6 +90,72 @@ private:
     float heightMin, heightMax;
 };
 
+
+// Decoding of the cells of each storage
+struct Float32Codec {
+    typedef float Cell;
+    float noValue;
+    float decode(float c) const { return c; }
+    float encode(float h) const { return h; }
+};
+
+struct Int16DmCodec {
+    typedef uint16_t Cell;
+    static const int16_t NO_VALUE = -32768;
+    float noValue;
+    float decode(uint16_t c) const {
+        int16_t v = int16_t(c);
+        return v == NO_VALUE ? noValue : 0.1f*float(v);
+    }
+    uint16_t encode(float h) const {
+        if (h <= noValue) return uint16_t(NO_VALUE);
+        return uint16_t(int16_t(glm::clamp(std::floor(10.0f*h + 0.5f), -32767.0f, 32767.0f)));
+    }
+};
+
+struct UInt16ScaledCodec {
+    typedef uint16_t Cell;
+    float noValue, offset, step;    // code 0 is no value, h = offset + step*(code - 1)
+    float decode(uint16_t c) const {
+        return c == 0 ? noValue : offset + step*float(c - 1);
+    }
+    uint16_t encode(float h) const {
+        if (h <= noValue) return 0;
+        return uint16_t(1 + glm::clamp(std::floor((h - offset)/step + 0.5f), 0.0f, 65534.0f));
+    }
+};
+
+
+// Read access to the cells of a HeightsGrid with a fixed storage type, with
+// the getters used by the kernels
+template<typename Codec>
+class HeightsGridView
+{
+public:
+    HeightsGridView(const HeightsGrid& grid, const typename Codec::Cell* cells, int stride, const Codec& codec)
+        : grid(grid), cells(cells), stride(stride), codec(codec) {}
+
+    glm::vec2  getGridMin() const { return grid.getGridMin(); }
+    glm::vec2  getGridMax() const { return grid.getGridMax(); }
+    glm::vec2  getGridRes() const { return grid.getGridRes(); }
+    glm::ivec2 getGridSize() const { return grid.getGridSize(); }
+    float      getGridNoValue() const { return grid.getGridNoValue(); }
+
+    float at(int i, int j) const {
+        return codec.decode(cells[std::size_t(i)*stride + j]);
+    }
+    float atIfHigher(int i, int j, float /*h*/) const {
+        return at(i, j);
+    }
+
+private:
+    const HeightsGrid&          grid;
+    const typename Codec::Cell* cells;
+    int                         stride;
+    Codec                       codec;
+};
+
+
 inline glm::vec2 HeightsGrid::getGridMin() const {
     return gridMin;
 }
@@ -67,8 +180,99 @@ inline float HeightsGrid::getGridNoValue() const {
     return gridNoValue;
 }
 
-inline const std::vector<std::vector<float> >& HeightsGrid::data() const {
-    return grid;
+inline HeightsGrid::Storage HeightsGrid::getStorage() const {
+    return storage;
+}
+
+inline void HeightsGrid::getStorageRange(float& hmin, float& hmax) const {
+    switch (storage) {
+    case INT16_DM:
+        hmin = -3276.7f;
+        hmax = 3276.7f;
+        break;
+    case UINT16_SCALED:
+        hmin = scaleOffset;
+        hmax = scaleOffset + 65534.0f*scaleStep;
+        break;
+    default:
+        hmin = -std::numeric_limits<float>::max();
+        hmax = std::numeric_limits<float>::max();
+    }
+}
+
+inline std::size_t HeightsGrid::getBytesPerHeight(Storage storage) {
+    return storage == FLOAT32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+inline std::size_t HeightsGrid::getMemoryBytes() const {
+    return heights32.size()*sizeof(float) + heights16.size()*sizeof(uint16_t);
+}
+
+inline float HeightsGrid::at(int i, int j) const {
+    std::size_t k = std::size_t(i)*stride + j;
+    switch (storage) {
+    case INT16_DM: {
+        Int16DmCodec codec = { gridNoValue };
+        return codec.decode(heights16[k]);
+    }
+    case UINT16_SCALED: {
+        UInt16ScaledCodec codec = { gridNoValue, scaleOffset, scaleStep };
+        return codec.decode(heights16[k]);
+    }
+    default:
+        return heights32[k];
+    }
+}
+
+// height of the cell, or any value not above h when the cell cannot be
+// higher than h. Lets searches for higher ground skip reading samples.
+inline float HeightsGrid::atIfHigher(int i, int j, float /*h*/) const {
+    return at(i, j);
+}
+
+inline void HeightsGrid::set(int i, int j, float h) {
+    std::size_t k = std::size_t(i)*stride + j;
+    switch (storage) {
+    case INT16_DM: {
+        Int16DmCodec codec = { gridNoValue };
+        heights16[k] = codec.encode(h);
+        break;
+    }
+    case UINT16_SCALED: {
+        UInt16ScaledCodec codec = { gridNoValue, scaleOffset, scaleStep };
+        heights16[k] = codec.encode(h);
+        break;
+    }
+    default:
+        heights32[k] = h;
+    }
+}
+
+template<typename Kernel>
+inline void HeightsGrid::visit(Kernel kernel) const {
+    switch (storage) {
+    case INT16_DM: {
+        Int16DmCodec codec = { gridNoValue };
+        kernel(HeightsGridView<Int16DmCodec>(*this, heights16.data(), stride, codec));
+        break;
+    }
+    case UINT16_SCALED: {
+        UInt16ScaledCodec codec = { gridNoValue, scaleOffset, scaleStep };
+        kernel(HeightsGridView<UInt16ScaledCodec>(*this, heights16.data(), stride, codec));
+        break;
+    }
+    default: {
+        Float32Codec codec = { gridNoValue };
+        kernel(HeightsGridView<Float32Codec>(*this, heights32.data(), stride, codec));
+    }
+    }
+}
+
+// ORS integrand for a cell lying y meters lower at distance r, with u = y/r.
+// Non-decreasing in u, so higher or farther cells never contribute more.
+inline double slopeNormalization(double u) {
+	double atanu = atan(u);
+	return (4.0/(M_PI*M_PI*M_PI)) * (2*u*atanu - log(u*u + 1) - atanu*atanu);
 }
 
 #endif // HEIGHTSGRID_H
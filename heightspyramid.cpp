@@ -0,0 +1,440 @@
+#include "heightspyramid.h"
+#include <cmath>
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+
+
+HeightsPyramid::HeightsPyramid(const HeightsGrid& grid) : grid(grid)
+{
+    float noValue = grid.getGridNoValue();
+
+    glm::ivec2 prevSize = grid.getGridSize();
+    while (prevSize.x > 1 || prevSize.y > 1) {
+        Level lvl;
+        lvl.size = (prevSize + glm::ivec2(1))/2;
+        int n = lvl.size.x*lvl.size.y;
+        lvl.hmin.assign(n, noValue);
+        lvl.hmax.assign(n, noValue);
+        lvl.hmean.assign(n, noValue);
+        lvl.count.assign(n, 0);
+
+        for (int i = 0; i < lvl.size.x; i++) {
+            for (int j = 0; j < lvl.size.y; j++) {
+                float  hmin = std::numeric_limits<float>::max();
+                float  hmax = -std::numeric_limits<float>::max();
+                double hsum = 0;
+                int    num = 0;
+                for (int ci = 2*i; ci < glm::min(2*i + 2, prevSize.x); ci++) {
+                    for (int cj = 2*j; cj < glm::min(2*j + 2, prevSize.y); cj++) {
+                        int   cnum;
+                        float cmin, cmax, cmean;
+                        if (levels.empty()) {
+                            cmin = cmax = cmean = grid.at(ci, cj);
+                            cnum = (cmin >= noValue) ? 1 : 0;
+                        }
+                        else {
+                            const Level& prev = levels.back();
+                            int idx = ci*prevSize.y + cj;
+                            cmin  = prev.hmin[idx];
+                            cmax  = prev.hmax[idx];
+                            cmean = prev.hmean[idx];
+                            cnum  = prev.count[idx];
+                        }
+                        if (cnum > 0) {
+                            hmin = glm::min(hmin, cmin);
+                            hmax = glm::max(hmax, cmax);
+                            hsum += double(cmean)*cnum;
+                            num  += cnum;
+                        }
+                    }
+                }
+                if (num > 0) {
+                    int idx = i*lvl.size.y + j;
+                    lvl.hmin[idx]  = hmin;
+                    lvl.hmax[idx]  = hmax;
+                    lvl.hmean[idx] = float(hsum/double(num));
+                    lvl.count[idx] = num;
+                }
+            }
+        }
+
+        levels.push_back(lvl);
+        prevSize = lvl.size;
+    }
+}
+
+
+namespace {
+
+// pyramid node queued for refinement, ordered by the width of its bounds
+struct ORSNode {
+    double gap, lo, up, est;
+    int level, i, j;
+    int annulus;        // first disk holding the node
+    bool operator<(const ORSNode& n) const { return gap < n.gap; }
+};
+
+// block of query points [i0,i1)x[j0,j1) waiting to be bounded or refined
+struct ORSBlock {
+    double bound;
+    int i0, j0, i1, j1;
+    bool operator<(const ORSBlock& b) const { return bound < b.bound; }
+};
+
+}
+
+float HeightsPyramid::computeORS(const glm::vec2 &p, float radius, float maxError) const
+{
+    glm::ivec2 pcoords = glm::ivec2((p - grid.getGridMin()) / grid.getGridRes());
+    float ph = grid.at(pcoords.x, pcoords.y);
+    return computeORS(glm::vec3(p.x, p.y, ph), radius, maxError);
+}
+
+float HeightsPyramid::computeORS(const glm::vec3 &p, float radius, float maxError) const
+{
+    if (maxError <= 0) {
+        return grid.computeORS(p, radius);
+    }
+    std::vector<float> ors;
+    computeORS(p, std::vector<float>(1, radius), maxError, ors);
+    return ors[0];
+}
+
+void HeightsPyramid::computeORS(const glm::vec2 &p, const std::vector<float>& radii, float maxError, std::vector<float>& ors) const
+{
+    glm::ivec2 pcoords = glm::ivec2((p - grid.getGridMin()) / grid.getGridRes());
+    float ph = grid.at(pcoords.x, pcoords.y);
+    computeORS(glm::vec3(p.x, p.y, ph), radii, maxError, ors);
+}
+
+void HeightsPyramid::computeORS(const glm::vec3 &p, const std::vector<float>& radii, float maxError, std::vector<float>& ors) const
+{
+    if (maxError <= 0) {
+        grid.computeORS(p, radii, ors);
+        return;
+    }
+    ors.assign(radii.size(), 0.0f);
+    if (radii.empty()) return;
+
+    glm::vec2  gridMin = grid.getGridMin();
+    glm::vec2  gridRes = grid.getGridRes();
+    glm::ivec2 gridSize = grid.getGridSize();
+    float      gridNoValue = grid.getGridNoValue();
+
+    // all the radii share one traversal. Nodes and cells go to the annulus
+    // of the first disk holding them, with the same window and cell
+    // conditions as HeightsGrid::computeORS for that radius
+    std::vector<float> sortedRadii(radii);
+    std::sort(sortedRadii.begin(), sortedRadii.end());
+    int numAnnuli = int(sortedRadii.size());
+    float radius = sortedRadii.back();
+
+    glm::vec2 p_xy = glm::vec2(p);
+    double    h0 = p.z;
+    glm::ivec2 pcoords = glm::ivec2((p_xy - gridMin) / gridRes);
+    std::vector<glm::ivec2> ijMin(numAnnuli), ijMax(numAnnuli);
+    for (int k = 0; k < numAnnuli; k++) {
+        glm::ivec2 radOff = glm::ivec2(glm::ceil(glm::vec2(sortedRadii[k]) / gridRes));
+        ijMin[k] = glm::max(pcoords - radOff, glm::ivec2(0));
+        ijMax[k] = glm::min(pcoords + radOff, gridSize);
+    }
+    double dA = gridRes.x * gridRes.y;
+    double rExcl = 0.1*gridRes.x;
+    const double EPS = 0.01;
+    const int    EXACT_LEVEL = 2;
+
+    // the integral of each annulus is kept as an interval [sumLo, sumUp]
+    // plus an estimate, a disk adds up the annuli inside it
+    std::vector<double> sumLo(numAnnuli, 0.0), sumUp(numAnnuli, 0.0), sumEst(numAnnuli, 0.0);
+    std::priority_queue<ORSNode> Q;
+
+    std::vector<glm::ivec3> stack;
+    stack.push_back(glm::ivec3(getNumLevels() - 1, 0, 0));
+    auto expand = [&](int level, int ni, int nj) {
+        glm::ivec2 csize = getLevelSize(level - 1);
+        for (int ci = 2*ni; ci < glm::min(2*ni + 2, csize.x); ci++) {
+            for (int cj = 2*nj; cj < glm::min(2*nj + 2, csize.y); cj++) {
+                stack.push_back(glm::ivec3(level - 1, ci, cj));
+            }
+        }
+    };
+
+    auto process = [&]() {
+        while (!stack.empty()) {
+            glm::ivec3 node = stack.back(); stack.pop_back();
+            int level = node.x;
+
+            // cells covered by the node, clipped to the window of the largest radius
+            glm::ivec2 c0 = glm::ivec2(node.y, node.z)*(1 << level);
+            glm::ivec2 c1 = glm::min(c0 + glm::ivec2(1 << level), gridSize);
+            glm::ivec2 w0 = glm::max(c0, ijMin.back());
+            glm::ivec2 w1 = glm::min(c1, ijMax.back());
+            if (w0.x >= w1.x || w0.y >= w1.y) continue;
+            if (getCellCount(level, node.y, node.z) == 0) continue;
+
+            // small nodes are cheaper to integrate exactly than to bound
+            if (level <= EXACT_LEVEL) {
+                for (int i = w0.x; i < w1.x; i++) {
+                    for (int j = w0.y; j < w1.y; j++) {
+                        glm::vec2 pij = gridMin + glm::vec2(i + 0.5f, j + 0.5f)*gridRes;
+                        float pdist = glm::distance(pij, p_xy);
+                        float hij = grid.at(i, j);
+                        if (pdist <= radius && pdist > 0.1*gridRes.x && hij >= gridNoValue) {
+                            double h = static_cast<double>(hij);
+                            if (h > h0) continue;
+                            int k = 0;
+                            while (k < numAnnuli && (pdist > sortedRadii[k] || i < ijMin[k].x || j < ijMin[k].y ||
+                                                     i >= ijMax[k].x || j >= ijMax[k].y)) k++;
+                            double f = glm::max(slopeNormalization((h0 - h)/pdist)*dA, 0.0);
+                            sumLo[k] += f;
+                            sumUp[k] += f;
+                            sumEst[k] += f;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            glm::dvec2 q0 = glm::dvec2(gridMin) + (glm::dvec2(c0) + 0.5)*glm::dvec2(gridRes) - glm::dvec2(p_xy);
+            glm::dvec2 q1 = glm::dvec2(gridMin) + (glm::dvec2(c1) - 0.5)*glm::dvec2(gridRes) - glm::dvec2(p_xy);
+            glm::dvec2 dmin = glm::max(glm::max(q0, -q1), glm::dvec2(0));
+            glm::dvec2 dmax = glm::max(glm::abs(q0), glm::abs(q1));
+            double rmin = glm::length(dmin);
+            double rmax = glm::length(dmax);
+            if (rmin > radius + EPS) continue;
+
+            // first disk and window holding the whole node. Nodes crossing
+            // the border of a smaller disk or window, or the center, go down
+            bool split = rmin <= rExcl + EPS;
+            int k = 0;
+            for (; k < numAnnuli && !split; k++) {
+                glm::ivec2 wk0 = glm::max(c0, ijMin[k]);
+                glm::ivec2 wk1 = glm::min(c1, ijMax[k]);
+                if (wk0 == c0 && wk1 == c1 && rmax <= sortedRadii[k] - EPS) break;
+                split = wk0.x < wk1.x && wk0.y < wk1.y && rmin <= sortedRadii[k] + EPS;
+            }
+            if (split || k == numAnnuli) {
+                expand(level, node.y, node.z);
+                continue;
+            }
+
+            // the integrand grows with the drop and decreases with the distance
+            int    n = getCellCount(level, node.y, node.z);
+            double hmin = getCellMin(level, node.y, node.z);
+            double hmax = getCellMax(level, node.y, node.z);
+            double hmean = getCellMean(level, node.y, node.z);
+            double rctr = glm::length(0.5*(q0 + q1));
+            double lo = n*dA*glm::max(slopeNormalization(glm::max(h0 - hmax, 0.0)/rmax), 0.0);
+            double up = n*dA*glm::max(slopeNormalization(glm::max(h0 - hmin, 0.0)/rmin), 0.0);
+            double est = n*dA*glm::max(slopeNormalization(glm::max(h0 - hmean, 0.0)/rctr), 0.0);
+            est = glm::clamp(est, lo, up);
+            sumLo[k] += lo;
+            sumUp[k] += up;
+            sumEst[k] += est;
+            if (up > lo) {
+                ORSNode qn = {up - lo, lo, up, est, level, node.y, node.z, k};
+                Q.push(qn);
+            }
+        }
+    };
+
+    auto orsError = [&]() {
+        double lo = 0, up = 0, est = 0, error = 0;
+        for (int k = 0; k < numAnnuli; k++) {
+            lo += sumLo[k];
+            up += sumUp[k];
+            est += sumEst[k];
+            double ors = std::sqrt(glm::max(est, 0.0));
+            error = glm::max(error, glm::max(std::sqrt(glm::max(up, 0.0)) - ors, ors - std::sqrt(glm::max(lo, 0.0))));
+        }
+        return error;
+    };
+
+    // refine the loosest nodes until the ORS interval of every radius is
+    // tight enough. A node also counts in all the larger disks, so the
+    // loosest one is the one that helps the most
+    process();
+    while (!Q.empty() && orsError() > maxError) {
+        ORSNode qn = Q.top(); Q.pop();
+        sumLo[qn.annulus] -= qn.lo;
+        sumUp[qn.annulus] -= qn.up;
+        sumEst[qn.annulus] -= qn.est;
+        expand(qn.level, qn.i, qn.j);
+        process();
+    }
+
+    for (int k = 1; k < numAnnuli; k++) {
+        sumEst[k] += sumEst[k - 1];
+    }
+    for (unsigned int ri = 0; ri < radii.size(); ri++) {
+        int k = int(std::lower_bound(sortedRadii.begin(), sortedRadii.end(), radii[ri]) - sortedRadii.begin());
+        ors[ri] = float(std::sqrt(glm::max(sumEst[k], 0.0)));
+    }
+}
+
+float HeightsPyramid::getRangeMax(const glm::ivec2& ijMin, const glm::ivec2& ijMax) const
+{
+    // max height of the cells in [ijMin, ijMax], using the largest nodes fully inside
+    float hmax = -std::numeric_limits<float>::max();
+    std::vector<glm::ivec3> stack;
+    stack.push_back(glm::ivec3(getNumLevels() - 1, 0, 0));
+    while (!stack.empty()) {
+        glm::ivec3 node = stack.back(); stack.pop_back();
+        int level = node.x;
+        glm::ivec2 c0 = glm::ivec2(node.y, node.z)*(1 << level);
+        glm::ivec2 c1 = glm::min(c0 + glm::ivec2(1 << level), grid.getGridSize()) - glm::ivec2(1);
+        if (c0.x > ijMax.x || c0.y > ijMax.y || c1.x < ijMin.x || c1.y < ijMin.y) continue;
+        if (getCellCount(level, node.y, node.z) == 0) continue;
+        if (getCellMax(level, node.y, node.z) <= hmax) continue;
+
+        if (level == 0 || (c0.x >= ijMin.x && c0.y >= ijMin.y && c1.x <= ijMax.x && c1.y <= ijMax.y)) {
+            hmax = getCellMax(level, node.y, node.z);
+            continue;
+        }
+        glm::ivec2 csize = getLevelSize(level - 1);
+        for (int ci = 2*node.y; ci < glm::min(2*node.y + 2, csize.x); ci++) {
+            for (int cj = 2*node.z; cj < glm::min(2*node.z + 2, csize.y); cj++) {
+                stack.push_back(glm::ivec3(level - 1, ci, cj));
+            }
+        }
+    }
+    return hmax;
+}
+
+double HeightsPyramid::boundORS2(const glm::vec2& qmin, const glm::vec2& qmax, double h0, float radius) const
+{
+    // Upper bound of the ORS integral for any point in the rectangle [qmin, qmax]
+    // whose height is at most h0. Each node is bounded with its lowest height
+    // and its closest distance to the rectangle, opening the nodes that are
+    // big compared to that distance.
+    const double OPEN_FACTOR = 1.0;
+    glm::vec2  gridMin = grid.getGridMin();
+    glm::vec2  gridRes = grid.getGridRes();
+    glm::ivec2 gridSize = grid.getGridSize();
+    double dA = gridRes.x * gridRes.y;
+    double rExcl = 0.1*gridRes.x;
+
+    double bound = 0;
+    std::vector<glm::ivec3> stack;
+    stack.push_back(glm::ivec3(getNumLevels() - 1, 0, 0));
+    while (!stack.empty()) {
+        glm::ivec3 node = stack.back(); stack.pop_back();
+        int level = node.x;
+        if (getCellCount(level, node.y, node.z) == 0) continue;
+
+        glm::ivec2 c0 = glm::ivec2(node.y, node.z)*(1 << level);
+        glm::ivec2 c1 = glm::min(c0 + glm::ivec2(1 << level), gridSize);
+        glm::dvec2 p0 = glm::dvec2(gridMin) + (glm::dvec2(c0) + 0.5)*glm::dvec2(gridRes);
+        glm::dvec2 p1 = glm::dvec2(gridMin) + (glm::dvec2(c1) - 0.5)*glm::dvec2(gridRes);
+        glm::dvec2 d = glm::max(glm::max(p0 - glm::dvec2(qmax), glm::dvec2(qmin) - p1), glm::dvec2(0));
+        double dist = glm::length(d);
+        if (dist > radius) continue;
+
+        double hlow = getCellMin(level, node.y, node.z);
+        if (hlow >= h0) continue;
+
+        double nodeSize = (1 << level)*glm::max(gridRes.x, gridRes.y);
+        if (level > 0 && dist < OPEN_FACTOR*nodeSize) {
+            glm::ivec2 csize = getLevelSize(level - 1);
+            for (int ci = 2*node.y; ci < glm::min(2*node.y + 2, csize.x); ci++) {
+                for (int cj = 2*node.z; cj < glm::min(2*node.z + 2, csize.y); cj++) {
+                    stack.push_back(glm::ivec3(level - 1, ci, cj));
+                }
+            }
+            continue;
+        }
+
+        int n = getCellCount(level, node.y, node.z);
+        bound += n*dA*glm::max(slopeNormalization((h0 - hlow)/glm::max(dist, rExcl)), 0.0);
+    }
+    return bound;
+}
+
+int HeightsPyramid::findMaxORS(const glm::vec2& qmin, const glm::vec2& qres, const glm::ivec2& qsize,
+                               float radius, int k, std::vector<glm::vec3>& best) const
+{
+    best.clear();
+    if (k <= 0 || qsize.x <= 0 || qsize.y <= 0) return 0;
+
+    glm::vec2  gridMin = grid.getGridMin();
+    glm::vec2  gridRes = grid.getGridRes();
+    glm::ivec2 gridSize = grid.getGridSize();
+
+    // current top k as a min-heap on the ORS value
+    auto worse = [](const glm::vec3& a, const glm::vec3& b) { return a.z > b.z; };
+    std::unordered_set<long long> evaluated;
+    auto evaluate = [&](int i, int j) {
+        long long key = (long long)(i)*qsize.y + j;
+        if (!evaluated.insert(key).second) return;
+        glm::vec2 q = qmin + glm::vec2(i + 0.5f, j + 0.5f)*qres;
+        float ors = grid.computeORS(q, radius);
+        if (int(best.size()) < k) {
+            best.push_back(glm::vec3(q.x, q.y, ors));
+            std::push_heap(best.begin(), best.end(), worse);
+        }
+        else if (ors > best.front().z) {
+            std::pop_heap(best.begin(), best.end(), worse);
+            best.back() = glm::vec3(q.x, q.y, ors);
+            std::push_heap(best.begin(), best.end(), worse);
+        }
+    };
+    auto threshold = [&]() {
+        return int(best.size()) < k ? -1.0 : double(best.front().z);
+    };
+
+    auto bound = [&](const ORSBlock& b) {
+        glm::vec2 bmin = qmin + glm::vec2(b.i0 + 0.5f, b.j0 + 0.5f)*qres;
+        glm::vec2 bmax = qmin + glm::vec2(b.i1 - 0.5f, b.j1 - 0.5f)*qres;
+        glm::ivec2 cmin = glm::clamp(glm::ivec2((bmin - gridMin)/gridRes), glm::ivec2(0), gridSize - glm::ivec2(1));
+        glm::ivec2 cmax = glm::clamp(glm::ivec2((bmax - gridMin)/gridRes), glm::ivec2(0), gridSize - glm::ivec2(1));
+        double h0 = getRangeMax(cmin, cmax);
+        return std::sqrt(boundORS2(bmin, bmax, h0, radius));
+    };
+
+    // coarse pass: one exact sample per block sets the initial threshold
+    const int COARSE_POINTS = 4096;
+    int step = 1;
+    while ((qsize.x/step)*(qsize.y/step) > COARSE_POINTS) step *= 2;
+    for (int i = 0; i < qsize.x; i += step) {
+        for (int j = 0; j < qsize.y; j += step) {
+            evaluate(glm::min(i + step/2, qsize.x - 1), glm::min(j + step/2, qsize.y - 1));
+        }
+    }
+
+    // refine the blocks with the highest bounds until none can enter the top k
+    std::priority_queue<ORSBlock> Q;
+    for (int i = 0; i < qsize.x; i += step) {
+        for (int j = 0; j < qsize.y; j += step) {
+            ORSBlock b = {0, i, j, glm::min(i + step, qsize.x), glm::min(j + step, qsize.y)};
+            b.bound = bound(b);
+            if (b.bound > threshold()) Q.push(b);
+        }
+    }
+    while (!Q.empty()) {
+        ORSBlock b = Q.top(); Q.pop();
+        if (b.bound <= threshold()) break;
+
+        if (b.i1 - b.i0 == 1 && b.j1 - b.j0 == 1) {
+            evaluate(b.i0, b.j0);
+            continue;
+        }
+        int im = (b.i0 + b.i1 + 1)/2;
+        int jm = (b.j0 + b.j1 + 1)/2;
+        int is[3] = {b.i0, im, b.i1};
+        int js[3] = {b.j0, jm, b.j1};
+        for (int ci = 0; ci < 2; ci++) {
+            for (int cj = 0; cj < 2; cj++) {
+                ORSBlock c = {0, is[ci], js[cj], is[ci + 1], js[cj + 1]};
+                if (c.i0 >= c.i1 || c.j0 >= c.j1) continue;
+                c.bound = bound(c);
+                if (c.bound > threshold()) Q.push(c);
+            }
+        }
+    }
+
+    std::sort(best.begin(), best.end(), worse);
+    return int(evaluated.size());
+}
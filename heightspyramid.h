@@ -0,0 +1,80 @@
+#ifndef HEIGHTSPYRAMID_H
+#define HEIGHTSPYRAMID_H
+#include <vector>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+// Min/max/mean height pyramid over a HeightsGrid. Each level halves the
+// resolution of the previous one, level 0 being the grid itself.
+// The grid must outlive the pyramid.
+class HeightsPyramid
+{
+public:
+    HeightsPyramid(const HeightsGrid& grid);
+
+    int        getNumLevels() const;
+    glm::ivec2 getLevelSize(int level) const;
+
+    float getCellMin (int level, int i, int j) const;
+    float getCellMax (int level, int i, int j) const;
+    float getCellMean(int level, int i, int j) const;
+    int   getCellCount(int level, int i, int j) const;
+
+    // ORS with the far field integrated from the coarse levels. The result is
+    // guaranteed to be within maxError meters of HeightsGrid::computeORS.
+    // Several radii are refined together in a single traversal.
+    float computeORS(const glm::vec2& p, float radius, float maxError) const;
+    float computeORS(const glm::vec3& p, float radius, float maxError) const;
+    void  computeORS(const glm::vec2& p, const std::vector<float>& radii, float maxError, std::vector<float>& ors) const;
+    void  computeORS(const glm::vec3& p, const std::vector<float>& radii, float maxError, std::vector<float>& ors) const;
+
+    // Top k exact ORS values among the query points qmin + (i+0.5, j+0.5)*qres,
+    // 0 <= (i,j) < qsize, returned as (x, y, ors) in decreasing order. Blocks of
+    // points whose upper bound cannot beat the current k-th value are skipped.
+    int   findMaxORS(const glm::vec2& qmin, const glm::vec2& qres, const glm::ivec2& qsize,
+                     float radius, int k, std::vector<glm::vec3>& best) const;
+
+private:
+    float  getRangeMax(const glm::ivec2& ijMin, const glm::ivec2& ijMax) const;
+    double boundORS2(const glm::vec2& qmin, const glm::vec2& qmax, double h0, float radius) const;
+
+    // coarse levels, levels[l] is pyramid level l+1
+    struct Level {
+        glm::ivec2 size;
+        std::vector<float> hmin, hmax, hmean;
+        std::vector<int>   count;
+    };
+
+    const HeightsGrid& grid;
+    std::vector<Level> levels;
+};
+
+inline int HeightsPyramid::getNumLevels() const {
+    return int(levels.size()) + 1;
+}
+
+inline glm::ivec2 HeightsPyramid::getLevelSize(int level) const {
+    return level > 0 ? levels[level - 1].size : grid.getGridSize();
+}
+
+inline float HeightsPyramid::getCellMin(int level, int i, int j) const {
+    if (level == 0) return grid.at(i, j);
+    return levels[level - 1].hmin[i*levels[level - 1].size.y + j];
+}
+
+inline float HeightsPyramid::getCellMax(int level, int i, int j) const {
+    if (level == 0) return grid.at(i, j);
+    return levels[level - 1].hmax[i*levels[level - 1].size.y + j];
+}
+
+inline float HeightsPyramid::getCellMean(int level, int i, int j) const {
+    if (level == 0) return grid.at(i, j);
+    return levels[level - 1].hmean[i*levels[level - 1].size.y + j];
+}
+
+inline int HeightsPyramid::getCellCount(int level, int i, int j) const {
+    if (level == 0) return grid.at(i, j) >= grid.getGridNoValue() ? 1 : 0;
+    return levels[level - 1].count[i*levels[level - 1].size.y + j];
+}
+
+#endif // HEIGHTSPYRAMID_H
@@ -4,9 +4,43 @@
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <ctime>
+#include <sys/stat.h>
+
+
+namespace {
+
+// modification time of a file, false when it does not exist
+bool fileTime(const std::string& path, std::time_t& mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    mtime = st.st_mtime;
+    return true;
+}
+
+// FNV-1a of a tile as stored in its file
+unsigned int tileChecksum(unsigned int sx, unsigned int sy, const float* samples)
+{
+    unsigned int checksum = 2166136261u;
+    const unsigned char* bytes[2] = { (const unsigned char*)(&sx), (const unsigned char*)(&sy) };
+    for (int k = 0; k < 2; k++) {
+        for (size_t b = 0; b < sizeof(unsigned int); b++) {
+            checksum = (checksum ^ bytes[k][b])*16777619u;
+        }
+    }
+    const unsigned char* data = (const unsigned char*)(samples);
+    for (size_t b = 0; b < size_t(sx)*size_t(sy)*sizeof(float); b++) {
+        checksum = (checksum ^ data[b])*16777619u;
+    }
+    return checksum;
+}
+
+}
 
 
 HeightsTileset::HeightsTileset(const std::string& pathToDescriptor)
+    : manifestStale(false)
 {
     std::ifstream fin(pathToDescriptor, std::fstream::in);
     if (fin.good()) {
@@ -21,112 +55,606 @@ HeightsTileset::HeightsTileset(const std::string& pathToDescriptor)
         tsetExtension = tsetMax - tsetMin;
         tileExtension = glm::vec2(ppTile)*tileRes;
         numTiles = glm::ivec2(glm::ceil(tsetExtension/tileExtension));
-
-        loadBuffer = new float[ppTile.x*ppTile.y];
     }
     fin.close();
+
+    // a folder ending in .pack is a packed tileset
+    const std::string packExt = ".pack";
+    if (tilesFolder.size() > packExt.size() &&
+        tilesFolder.compare(tilesFolder.size() - packExt.size(), packExt.size(), packExt) == 0) {
+        if (!pack.open(tilesFolder)) {
+            std::cerr << "Error opening " << tilesFolder << std::endl;
+        }
+    }
+
+    loadManifest(pathToDescriptor + ".manifest");
 }
 
 HeightsTileset::~HeightsTileset()
 {
-    delete[] loadBuffer;
 }
 
 
-std::vector<std::vector<float> > HeightsTileset::readTile(int ti, int tj, const glm::ivec2 &outFactor)
-{    
+std::string HeightsTileset::getTilePath(int ti, int tj) const
+{
     std::ostringstream oss;
-    oss << tilesFolder << "tile_";
+    oss << tilesFolder << (pack.isOpen() ? ":" : "") << "tile_";
     oss << std::setw(2) << std::setfill('0') << ti << "_";
     oss << std::setw(2) << std::setfill('0') << tj << ".bin";
-    std::string tilePath = oss.str();
+    return oss.str();
+}
+
+bool HeightsTileset::readTileSamples(int ti, int tj, unsigned int& sx, unsigned int& sy, std::vector<float>& samples) const
+{
+    bool ok = (prefetcher && prefetcher->fetch(ti, tj, sx, sy, samples)) ||
+              readStoredSamples(ti, tj, sx, sy, samples);
+    if (ok) checkTile(ti, tj, sx, sy, samples);
+    return ok;
+}
+
+bool HeightsTileset::readStoredSamples(int ti, int tj, unsigned int& sx, unsigned int& sy, std::vector<float>& samples) const
+{
+    if (pack.isOpen()) {
+        if (!pack.getTileSize(0, ti, tj, sx, sy)) return false;
+        if (samples.size() < size_t(sx)*size_t(sy)) {
+            samples.resize(size_t(sx)*size_t(sy));
+        }
+        return pack.readTile(0, ti, tj, samples.data());
+    }
+
+    std::fstream fin(getTilePath(ti, tj), std::fstream::in | std::fstream::binary);
+    if (!fin.good()) return false;
+    fin.read((char*)(&sx), sizeof(unsigned int));
+    fin.read((char*)(&sy), sizeof(unsigned int));
+    if (!fin) return false;
+    if (samples.size() < size_t(sx)*size_t(sy)) {
+        samples.resize(size_t(sx)*size_t(sy));
+    }
+    fin.read((char*)(samples.data()), sx*sy*sizeof(float));
+    return bool(fin);
+}
+
+void HeightsTileset::loadManifest(const std::string& path)
+{
+    manifest.clear();
+    std::ifstream fin(path, std::fstream::in);
+    if (!fin.good()) return;
+
+    std::string name;
+    glm::ivec2 mTiles;
+    fin >> name >> mTiles.x >> mTiles.y;
+    if (!fin || mTiles != numTiles) {
+        std::cerr << "Ignoring manifest " << path << ", it does not match the tileset" << std::endl;
+        return;
+    }
+
+    std::vector<TileSummary> tiles(numTiles.x*numTiles.y);
+    for (size_t t = 0; t < tiles.size(); t++) {
+        int ti, tj, exists;
+        TileSummary s;
+        fin >> ti >> tj >> exists >> s.hmin >> s.hmax >> s.hmean >> s.count >> std::hex >> s.checksum >> std::dec;
+        if (!fin || ti < 0 || tj < 0 || ti >= numTiles.x || tj >= numTiles.y) {
+            std::cerr << "Ignoring manifest " << path << ", bad entry " << t << std::endl;
+            return;
+        }
+        s.exists = exists != 0;
+        tiles[ti*numTiles.y + tj] = s;
+    }
+    manifest.swap(tiles);
+
+    if (!isManifestCurrent(path)) {
+        std::cerr << "Ignoring manifest " << path << ", the tiles changed after it was written" << std::endl;
+        manifest.clear();
+        return;
+    }
+    tileChecked.reset(new std::atomic<bool>[manifest.size()]());
+}
+
+bool HeightsTileset::isManifestCurrent(const std::string& path) const
+{
+    // tiles skipped by their summary are never read, so their files are
+    // compared with the manifest now
+    std::time_t manifestTime, tileTime;
+    if (!fileTime(path, manifestTime)) return false;
+    if (pack.isOpen()) {
+        if (!fileTime(tilesFolder, tileTime) || tileTime > manifestTime) return false;
+        for (int ti = 0; ti < numTiles.x; ti++) {
+            for (int tj = 0; tj < numTiles.y; tj++) {
+                unsigned int sx, sy;
+                if (pack.getTileSize(0, ti, tj, sx, sy) != manifest[ti*numTiles.y + tj].exists) return false;
+            }
+        }
+        return true;
+    }
+    for (int ti = 0; ti < numTiles.x; ti++) {
+        for (int tj = 0; tj < numTiles.y; tj++) {
+            bool exists = fileTime(getTilePath(ti, tj), tileTime);
+            if (exists != manifest[ti*numTiles.y + tj].exists) return false;
+            if (exists && tileTime > manifestTime) return false;
+        }
+    }
+    return true;
+}
+
+void HeightsTileset::checkTile(int ti, int tj, unsigned int sx, unsigned int sy, const std::vector<float>& samples) const
+{
+    // once per tile, a file rewritten without changing its time is still
+    // caught the first time it is read
+    if (!hasManifest() || ti < 0 || tj < 0 || ti >= numTiles.x || tj >= numTiles.y) return;
+    int t = ti*numTiles.y + tj;
+    if (tileChecked[t].exchange(true)) return;
+    if (tileChecksum(sx, sy, samples.data()) != manifest[t].checksum) {
+        std::cerr << "Ignoring the manifest, " << getTilePath(ti, tj) << " changed after it was written" << std::endl;
+        manifestStale = true;
+    }
+}
+
+TileSummary HeightsTileset::getTileSummary(int ti, int tj) const
+{
+    if (!hasManifest() || ti < 0 || tj < 0 || ti >= numTiles.x || tj >= numTiles.y) {
+        TileSummary s;
+        s.exists = false;
+        s.hmin = s.hmax = s.hmean = hNoValue;
+        s.count = s.checksum = 0;
+        return s;
+    }
+    return manifest[ti*numTiles.y + tj];
+}
+
+bool HeightsTileset::getHeightRange(const glm::vec2& pmin, const glm::vec2& pmax, float& hmin, float& hmax) const
+{
+    // bounds of the existing tiles overlapping the region
+    if (!hasManifest()) return false;
+    glm::ivec2 tileIni = glm::max(glm::ivec2(glm::floor((pmin - tsetMin)/tileExtension)), glm::ivec2(0));
+    glm::ivec2 tileEnd = glm::min(glm::ivec2(glm::floor((pmax - tsetMin)/tileExtension)), numTiles - 1);
+    bool found = false;
+    for (int ti = tileIni.x; ti <= tileEnd.x; ti++) {
+        for (int tj = tileIni.y; tj <= tileEnd.y; tj++) {
+            const TileSummary& s = manifest[ti*numTiles.y + tj];
+            if (!s.exists) continue;
+            hmin = found ? glm::min(hmin, s.hmin) : s.hmin;
+            hmax = found ? glm::max(hmax, s.hmax) : s.hmax;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void HeightsTileset::enablePrefetch(std::size_t maxBytes)
+{
+    prefetcher.reset();
+    if (maxBytes > 0) prefetcher.reset(new TilePrefetcher(*this, maxBytes));
+}
+
+void HeightsTileset::prefetchRegion(const glm::vec2& pmin, const glm::vec2& pmax) const
+{
+    // same tiles as loadRegion, skipping those the manifest says need no read
+    if (!prefetcher) return;
+    glm::ivec2 tileIni = glm::max(glm::ivec2(glm::floor((pmin - tsetMin)/tileExtension)), glm::ivec2(0));
+    glm::ivec2 tileEnd = glm::min(glm::ivec2(glm::floor((pmax - tsetMin)/tileExtension)), numTiles - 1);
+    for (int ti = tileIni.x; ti <= tileEnd.x; ti++) {
+        for (int tj = tileIni.y; tj <= tileEnd.y; tj++) {
+            if (hasManifest()) {
+                const TileSummary& s = manifest[ti*numTiles.y + tj];
+                if (!s.exists || s.hmin == s.hmax) continue;
+            }
+            prefetcher->request(ti, tj);
+        }
+    }
+}
+
+PrefetchStats HeightsTileset::getPrefetchStats() const
+{
+    if (prefetcher) return prefetcher->getStats();
+    PrefetchStats stats;
+    stats.requested = stats.hits = stats.late = stats.misses = stats.wasted = 0;
+    return stats;
+}
+
+bool HeightsTileset::summarizeTile(int ti, int tj, TileSummary& summary, QueryContext& ctx) const
+{
+    summary.exists = false;
+    summary.hmin = summary.hmax = summary.hmean = hNoValue;
+    summary.count = summary.checksum = 0;
 
     unsigned int sx, sy;
-    bool loadError = false;
-    std::fstream fin(tilePath, std::fstream::in | std::fstream::binary);
-    if (fin.good()) {
-        fin.read((char*)(&sx), sizeof(unsigned int));
-        fin.read((char*)(&sy), sizeof(unsigned int));
-        fin.read((char*)(loadBuffer), sx*sy*sizeof(float));
-        fin.close();
+    std::vector<float>& loadBuffer = ctx.tileBuffer();
+    if (!readTileSamples(ti, tj, sx, sy, loadBuffer)) return false;
+
+    summary.checksum = tileChecksum(sx, sy, loadBuffer.data());
+
+    // same value mapping as readTile
+    double sumH = 0;
+    summary.hmin = summary.hmax = hSeaLevel;
+    for (size_t k = 0; k < size_t(sx)*size_t(sy); k++) {
+        float val = loadBuffer[k];
+        if (val > hNoValue) {
+            if (val <= hSeaValue) val = hSeaLevel;
+            sumH += val;
+            summary.count++;
+        }
+        else {
+            val = hSeaLevel;
+        }
+        if (k == 0) summary.hmin = summary.hmax = val;
+        summary.hmin = glm::min(summary.hmin, val);
+        summary.hmax = glm::max(summary.hmax, val);
     }
-    else {
+    summary.hmean = summary.count > 0 ? float(sumH/double(summary.count)) : hSeaLevel;
+    summary.exists = true;
+    return true;
+}
+
+bool HeightsTileset::writeManifest(const std::string& path) const
+{
+    std::ofstream fout(path, std::fstream::out);
+    if (!fout.good()) return false;
+
+    fout << "TILES\t" << numTiles.x << "\t" << numTiles.y << std::endl;
+    fout << std::setprecision(9);
+
+    QueryContext ctx;
+    for (int ti = 0; ti < numTiles.x; ti++) {
+        for (int tj = 0; tj < numTiles.y; tj++) {
+            TileSummary s;
+            summarizeTile(ti, tj, s, ctx);
+            fout << ti << "\t" << tj << "\t" << (s.exists ? 1 : 0) << "\t";
+            fout << s.hmin << "\t" << s.hmax << "\t" << s.hmean << "\t" << s.count << "\t";
+            fout << std::hex << s.checksum << std::dec << std::endl;
+        }
+    }
+    fout.close();
+    return fout.good();
+}
+
+
+void HeightsTileset::readTile(int ti, int tj, const glm::ivec2 &outFactor, QueryContext& ctx,
+                              ResampleFilter filter) const
+{
+    // tiles the manifest knows to be missing or flat are not read
+    if (hasManifest()) {
+        TileSummary ts = getTileSummary(ti, tj);
+        if (!ts.exists || ts.hmin == ts.hmax) {
+            glm::ivec2 osize = ppTile/outFactor;
+            std::vector<std::vector<float> >& H = ctx.tileGrid();
+            H.resize(osize.x);
+            for (int i = 0; i < osize.x; i++) {
+                H[i].assign(osize.y, ts.exists ? ts.hmin : hNoValue);
+            }
+            return;
+        }
+    }
+
+    // pyramid levels of a pack are already resampled, with the mean
+    unsigned int sx, sy;
+    std::vector<float>& loadBuffer = ctx.tileBuffer();
+    int level = outFactor.x == outFactor.y && filter == RESAMPLE_MEAN ? pack.getLevel(outFactor.x) : -1;
+    if (level > 0 && pack.getTileSize(level, ti, tj, sx, sy)) {
+        if (loadBuffer.size() < size_t(sx)*size_t(sy)) {
+            loadBuffer.resize(size_t(sx)*size_t(sy));
+        }
+        if (pack.readTile(level, ti, tj, loadBuffer.data())) {
+            std::vector<std::vector<float> >& H = ctx.tileGrid();
+            H.resize(sx);
+            for (unsigned int i = 0; i < sx; i++) {
+                H[i].assign(loadBuffer.begin() + size_t(i)*sy, loadBuffer.begin() + size_t(i + 1)*sy);
+            }
+            return;
+        }
+    }
+
+    bool loadError = false;
+    if (!readTileSamples(ti, tj, sx, sy, loadBuffer)) {
         sx = int(glm::round(tileExtension.x/tileRes.x));
         sy = int(glm::round(tileExtension.y/tileRes.y));
         loadError = true;
     }
 
+    // reuse the columns of the previous tile
     glm::ivec2 osize = glm::ivec2(sx, sy)/outFactor;
-    std::vector<std::vector<float> > H(osize.x, std::vector<float>(osize.y, hNoValue));
+    std::vector<std::vector<float> >& H = ctx.tileGrid();
+    H.resize(osize.x);
+    for (int i = 0; i < osize.x; i++) {
+        H[i].assign(osize.y, hNoValue);
+    }
 
     if (loadError) {
-        std::cerr << "Error loading " << tilePath << std::endl;
-        return H;
+        std::cerr << "Error loading " << getTilePath(ti, tj) << std::endl;
+        return;
     }
 
+    // samples past the last whole block are left out
+    SampleMapping mapping = { hNoValue, hSeaValue, hSeaLevel };
+    std::vector<float>& acc = ctx.resampleBuffer();
+    if (acc.size() < 2*size_t(sy)) {
+        acc.resize(2*size_t(sy));
+    }
     for (int i = 0; i < osize.x; i++) {
-        for (int j = 0; j < osize.y; j++) {
-            float sumH = 0;
-            int numH = 0;
-            for (int ii = 0; ii < outFactor.x; ii++) {
-                for (int jj = 0; jj < outFactor.y; jj++) {
-                    if (i*outFactor.x + ii < int(sx) && j*outFactor.y + jj < int(sy)) {
-                        float val = loadBuffer[(i*outFactor.x + ii)*sy + j*outFactor.y + jj];
-                        if (val > hNoValue) {          // ignore no values
-                            if (val <= hSeaValue) {    // replace sea values with desired sea level
-                                val = hSeaLevel;
-                            }
-                            sumH += val;
-                            numH++;
-                        }
-                    }
+        const float* rows = loadBuffer.data() + size_t(i)*outFactor.x*sy;
+        resampleRow(rows, outFactor.x, int(sy), outFactor.y, filter, mapping, H[i].data(), acc.data());
+    }
+}
+
+
+namespace {
+
+// Copies T[outRows - 1 - k][jj] to grid cell cell0 + (jj, k), for first <= (jj, k) < last.
+// Tile rows become grid columns, so the copy goes through blocks small
+// enough to stay in cache while they are transposed.
+void blitTile(const std::vector<std::vector<float> >& T, int outRows, const glm::ivec2& first,
+              const glm::ivec2& last, const glm::ivec2& cell0, HeightsGrid& grid)
+{
+    const int B = 64;
+    float block[B*B];
+    int kFirst = glm::max(first.y, outRows - int(T.size()));
+    int jLast = glm::min(last.x, T.empty() ? 0 : int(T[0].size()));
+    for (int jb = first.x; jb < jLast; jb += B) {
+        int nj = glm::min(B, jLast - jb);
+        for (int kb = kFirst; kb < last.y; kb += B) {
+            int nk = glm::min(B, last.y - kb);
+            for (int k = 0; k < nk; k++) {
+                const float* row = T[outRows - 1 - (kb + k)].data() + jb;
+                for (int j = 0; j < nj; j++) {
+                    block[j*B + k] = row[j];
                 }
             }
-            if (numH > 0) {
-                H[i][j] = sumH/float(numH);
-            }
-            else {
-                H[i][j] = hSeaLevel;
+            for (int j = 0; j < nj; j++) {
+                grid.setRun(cell0.x + jb + j, cell0.y + kb, block + j*B, nk);
             }
         }
     }
-    return H;
 }
 
+}
+
+
+HeightsGrid* HeightsTileset::loadRegion(const glm::vec2& dtmMin, const glm::vec2& dtmMax, const glm::vec2& outRes,
+                                        HeightsGrid::Storage storage, ResampleFilter filter) const
+{
+    HeightsGrid* grid = new HeightsGrid();
+    loadRegion(dtmMin, dtmMax, outRes, *grid, QueryContext::threadContext(), storage, filter);
+    return grid;
+}
 
-HeightsGrid* HeightsTileset::loadRegion(const glm::vec2& dtmMin, const glm::vec2& dtmMax, const glm::vec2& outRes)
+void HeightsTileset::loadRegion(const glm::vec2& dtmMin, const glm::vec2& dtmMax, const glm::vec2& outRes,
+                                HeightsGrid& grid, QueryContext& ctx, HeightsGrid::Storage storage,
+                                ResampleFilter filter) const
 {
     glm::vec2 regionMin = dtmMin;//glm::max(dtmMin, tsetMin);
     glm::vec2 regionMax = dtmMax;//glm::min(dtmMax, tsetMax);
-    glm::vec2  tileExtension = glm::vec2(ppTile)*tileRes;
-    glm::ivec2 tileIni = glm::ivec2((regionMin - tsetMin)/tileExtension);
-    glm::ivec2 tileEnd = glm::ivec2((regionMax - tsetMin)/tileExtension);
+    glm::ivec2 numPoints = glm::ivec2(glm::ceil((regionMax - regionMin)/outRes));
+
+    // scaled storage spans the heights of the tiles when they are known
+    float hmin = -500.0f, hmax = 3500.0f;
+    getHeightRange(regionMin, regionMax, hmin, hmax);
+    grid.resize(regionMin, regionMax, outRes, hNoValue, storage, hmin, hmax);
+    loadCells(regionMin, regionMax, outRes, glm::ivec2(0), numPoints, grid, ctx, filter);
+}
+
+bool HeightsTileset::reloadRegion(const glm::vec2& dtmMin, const glm::vec2& dtmMax, const glm::vec2& outRes,
+                                  HeightsGrid& grid, QueryContext& ctx, HeightsGrid::Storage storage,
+                                  ResampleFilter filter) const
+{
+    // the cells must keep their place on the same lattice, and the scaled
+    // storage must still cover the heights of the new region
+    glm::vec2  shift = (dtmMin - grid.getGridMin())/outRes;
+    glm::ivec2 shiftCells = glm::ivec2(glm::round(shift));
+    glm::ivec2 oldSize = grid.getGridSize();
+    bool reuse = grid.getGridRes() == outRes && grid.getStorage() == storage && oldSize.x > 0 && oldSize.y > 0 &&
+                 glm::abs(shift.x - float(shiftCells.x)) < 1e-3f && glm::abs(shift.y - float(shiftCells.y)) < 1e-3f;
+    if (reuse && storage == HeightsGrid::UINT16_SCALED) {
+        float hmin = -500.0f, hmax = 3500.0f, smin, smax;
+        getHeightRange(dtmMin, dtmMax, hmin, hmax);
+        grid.getStorageRange(smin, smax);
+        reuse = hmin >= smin - 0.01f && hmax <= smax + 0.01f;
+    }
+    if (!reuse) {
+        loadRegion(dtmMin, dtmMax, outRes, grid, ctx, storage, filter);
+        return false;
+    }
+
+    // cells kept by reframe, in the new indices, and the strips around them
+    grid.reframe(dtmMin, dtmMax);
+    glm::ivec2 numPoints = glm::ivec2(glm::ceil((dtmMax - dtmMin)/outRes));
+    glm::ivec2 keepMin = glm::clamp(-shiftCells, glm::ivec2(0), numPoints);
+    glm::ivec2 keepMax = glm::max(glm::min(oldSize - shiftCells, grid.getGridSize()), keepMin);
+    if (keepMin.x == keepMax.x || keepMin.y == keepMax.y) {
+        loadCells(dtmMin, dtmMax, outRes, glm::ivec2(0), numPoints, grid, ctx, filter);
+        return true;
+    }
+    loadCells(dtmMin, dtmMax, outRes, glm::ivec2(0), glm::ivec2(keepMin.x, numPoints.y), grid, ctx, filter);
+    loadCells(dtmMin, dtmMax, outRes, glm::ivec2(keepMax.x, 0), numPoints, grid, ctx, filter);
+    loadCells(dtmMin, dtmMax, outRes, glm::ivec2(keepMin.x, 0), glm::ivec2(keepMax.x, keepMin.y), grid, ctx, filter);
+    loadCells(dtmMin, dtmMax, outRes, glm::ivec2(keepMin.x, keepMax.y), glm::ivec2(keepMax.x, numPoints.y), grid, ctx, filter);
+    return true;
+}
+
+void HeightsTileset::loadCells(const glm::vec2& regionMin, const glm::vec2& regionMax, const glm::vec2& outRes,
+                               const glm::ivec2& cellMin, const glm::ivec2& cellMax,
+                               HeightsGrid& grid, QueryContext& ctx, ResampleFilter filter) const
+{
+    if (cellMin.x >= cellMax.x || cellMin.y >= cellMax.y) return;
+
+    // output points that do not fall on whole blocks of samples
+    glm::vec2 ratio = outRes/tileRes;
+    if (filter == RESAMPLE_BILINEAR ||
+        glm::abs(ratio.x - glm::round(ratio.x)) > 1e-3f || glm::abs(ratio.y - glm::round(ratio.y)) > 1e-3f) {
+        loadCellsBilinear(regionMin, outRes, cellMin, cellMax, grid, ctx);
+        return;
+    }
+
+    glm::vec2  windowMin = regionMin + glm::vec2(cellMin)*outRes;
+    glm::vec2  windowMax = glm::min(regionMin + glm::vec2(cellMax)*outRes, regionMax);
+    glm::ivec2 tileIni = glm::ivec2((windowMin - tsetMin)/tileExtension);
+    glm::ivec2 tileEnd = glm::ivec2((windowMax - tsetMin)/tileExtension);
 
     glm::ivec2 reduceFactor = glm::ivec2(glm::round(outRes/tileRes));
-    glm::ivec2 numPoints = glm::ivec2(glm::ceil((regionMax - regionMin)/outRes));
     glm::ivec2 outPPtile = ppTile/reduceFactor;
 
-    std::vector<std::vector<float> > H(numPoints.x, std::vector<float>(numPoints.y, hNoValue));
-
     for (int ti = tileIni.x; ti <= tileEnd.x; ti++) {
         for (int tj = tileIni.y; tj <= tileEnd.y; tj++) {
 
+            // T[ii][jj] lies at tmin + (jj, k)*outRes with k = outPPtile.x - 1 - ii,
+            // that is on cell floor(offset) + (jj, k) when inside the region
+            glm::vec2  tmin = tsetMin + glm::vec2(float(ti), float(tj))*tileExtension;
+            glm::vec2  offset = (tmin - regionMin)/outRes;
+            glm::ivec2 cell0 = glm::ivec2(glm::floor(offset));
+            glm::ivec2 first = glm::max(glm::max(glm::ivec2(glm::ceil(-offset)), glm::ivec2(0)), cellMin - cell0);
+            glm::ivec2 last = glm::min(glm::min(glm::ivec2(glm::ceil((regionMax - tmin)/outRes)),
+                                                glm::ivec2(outPPtile.y, outPPtile.x)), cellMax - cell0);
+            if (first.x >= last.x || first.y >= last.y) continue;
+
+            readTile(ti, tj, reduceFactor, ctx, filter);
+            blitTile(ctx.tileGrid(), outPPtile.x, first, last, cell0, grid);
+        }
+    }
+}
+
+bool HeightsTileset::readBilinearTile(int ti, int tj, QueryContext& ctx, unsigned int& sx, unsigned int& sy,
+                                      float& constantH) const
+{
+    // heights of tiles that need no read, as readTile gives them
+    sx = ppTile.y;
+    sy = ppTile.x;
+    constantH = hNoValue;
+    if (ti < 0 || tj < 0 || ti >= numTiles.x || tj >= numTiles.y) return false;
+    if (hasManifest()) {
+        TileSummary ts = getTileSummary(ti, tj);
+        constantH = ts.exists ? ts.hmin : hNoValue;
+        if (!ts.exists || ts.hmin == ts.hmax) return false;
+    }
+    unsigned int rx, ry;
+    if (!readTileSamples(ti, tj, rx, ry, ctx.tileBuffer())) {
+        std::cerr << "Error loading " << getTilePath(ti, tj) << std::endl;
+        constantH = hNoValue;
+        return false;
+    }
+    sx = rx;
+    sy = ry;
+    return true;
+}
+
+void HeightsTileset::readTileEdges(int ti, int tj, QueryContext& ctx, std::vector<float>& firstColumn,
+                                   std::vector<float>& lastRow) const
+{
+    unsigned int sx, sy;
+    float constantH;
+    if (!readBilinearTile(ti, tj, ctx, sx, sy, constantH)) {
+        firstColumn.assign(sx, constantH);
+        lastRow.assign(sy, constantH);
+        return;
+    }
+    const std::vector<float>& samples = ctx.tileBuffer();
+    firstColumn.resize(sx);
+    for (unsigned int r = 0; r < sx; r++) firstColumn[r] = samples[std::size_t(r)*sy];
+    lastRow.assign(samples.begin() + std::size_t(sx - 1)*sy, samples.begin() + std::size_t(sx)*sy);
+}
+
+void HeightsTileset::loadCellsBilinear(const glm::vec2& regionMin, const glm::vec2& outRes,
+                                       const glm::ivec2& cellMin, const glm::ivec2& cellMax,
+                                       HeightsGrid& grid, QueryContext& ctx) const
+{
+    // tile of each output column and row, each tile fills a contiguous range
+    std::vector<glm::ivec3> xRanges, yRanges;
+    for (int x0 = cellMin.x, x1; x0 < cellMax.x; x0 = x1) {
+        int ti = int(glm::floor((regionMin.x + x0*outRes.x - tsetMin.x)/tileExtension.x));
+        for (x1 = x0 + 1; x1 < cellMax.x; x1++) {
+            if (int(glm::floor((regionMin.x + x1*outRes.x - tsetMin.x)/tileExtension.x)) != ti) break;
+        }
+        xRanges.push_back(glm::ivec3(ti, x0, x1));
+    }
+    for (int y0 = cellMin.y, y1; y0 < cellMax.y; y0 = y1) {
+        int tj = int(glm::floor((regionMin.y + y0*outRes.y - tsetMin.y)/tileExtension.y));
+        for (y1 = y0 + 1; y1 < cellMax.y; y1++) {
+            if (int(glm::floor((regionMin.y + y1*outRes.y - tsetMin.y)/tileExtension.y)) != tj) break;
+        }
+        yRanges.push_back(glm::ivec3(tj, y0, y1));
+    }
+
+    // Points past the last sample column or row of a tile interpolate with
+    // the first column of the east tile and the last row of the north one.
+    // Tiles go from east to west and from north to south, so those edges
+    // come from the tiles already read, and only the neighbours out of the
+    // region are read for them. The first column of the tile north of the
+    // region gives the corner of the next column of tiles
+    SampleMapping mapping = { hNoValue, hSeaValue, hSeaLevel };
+    std::vector<std::vector<float> > eastColumns(yRanges.size()), westColumns(yRanges.size());
+    std::vector<float> northRow, northColumn, lastRow, column;
+    for (int xk = int(xRanges.size()) - 1; xk >= 0; xk--) {
+        int ti = xRanges[xk].x, x0 = xRanges[xk].y, x1 = xRanges[xk].z;
+        bool eastmost = xk == int(xRanges.size()) - 1;
+        for (int yk = int(yRanges.size()) - 1; yk >= 0; yk--) {
+            int tj = yRanges[yk].x, y0 = yRanges[yk].y, y1 = yRanges[yk].z;
+            bool northmost = yk == int(yRanges.size()) - 1;
+
+            // sample (r, c) of the tile lies at tile min + (c, sx - 1 - r)*tileRes,
+            // the east tile starts at c = sy and the north one ends at r = -1
             glm::vec2 tmin = tsetMin + glm::vec2(float(ti), float(tj))*tileExtension;
-            std::vector<std::vector<float> > T = readTile(ti, tj, reduceFactor);
-
-            for (int ii = 0; ii < outPPtile.x; ii++) {
-                for (int jj = 0; jj < outPPtile.y; jj++) {
-                    glm::vec2 p = tmin + glm::vec2(float(jj), float(outPPtile.x - 1 - ii))*outRes;
-                    if (p.x >= regionMin.x && p.x < regionMax.x && p.y >= regionMin.y && p.y < regionMax.y) {
-                        glm::ivec2 coords = glm::ivec2(glm::floor((p - regionMin)/outRes));
-                        glm::clamp(coords, glm::ivec2(0,0), glm::ivec2(numPoints.x, numPoints.y));
-                        H[coords.x][coords.y] = T[ii][jj];
-                    }
+            bool seamX = (regionMin.x + (x1 - 1)*outRes.x - tmin.x)/tileRes.x > float(ppTile.x - 1);
+            bool seamY = (regionMin.y + (y1 - 1)*outRes.y - tmin.y)/tileRes.y > float(ppTile.y - 1);
+            float corner = hNoValue;
+            if (seamX && seamY) {
+                if (!northmost)     corner = eastColumns[yk + 1].back();
+                else if (!eastmost) corner = northColumn.back();
+                else {
+                    readTileEdges(ti + 1, tj + 1, ctx, column, lastRow);
+                    corner = column.back();
+                }
+            }
+            if (seamX && eastmost) readTileEdges(ti + 1, tj, ctx, eastColumns[yk], lastRow);
+            if (seamY && northmost) readTileEdges(ti, tj + 1, ctx, northColumn, northRow);
+
+            unsigned int sx, sy;
+            float constantH;
+            bool read = readBilinearTile(ti, tj, ctx, sx, sy, constantH);
+            const std::vector<float>& samples = ctx.tileBuffer();
+            std::vector<float>& westColumn = westColumns[yk];
+            if (read) {
+                westColumn.resize(sx);
+                for (unsigned int r = 0; r < sx; r++) westColumn[r] = samples[std::size_t(r)*sy];
+                lastRow.assign(samples.begin() + std::size_t(sx - 1)*sy, samples.begin() + std::size_t(sx)*sy);
+            }
+            else {
+                westColumn.assign(sx, constantH);
+                lastRow.assign(sy, constantH);
+            }
+
+            // tiles without value stay so up to the next tile
+            if (!read && (constantH <= hNoValue || (!seamX && !seamY))) {
+                for (int x = x0; x < x1; x++) {
+                    for (int y = y0; y < y1; y++) grid.set(x, y, constantH);
                 }
+                northRow.swap(lastRow);
+                continue;
+            }
+
+            // the tile with the north row on top and the east column on the
+            // right, no value where a seam is not crossed
+            std::size_t py = std::size_t(sy) + 1;
+            std::vector<float>& padded = ctx.resampleBuffer();
+            if (padded.size() < (std::size_t(sx) + 1)*py) {
+                padded.resize((std::size_t(sx) + 1)*py);
+            }
+            for (unsigned int c = 0; c < sy; c++) {
+                padded[c] = seamY && c < northRow.size() ? northRow[c] : hNoValue;
+            }
+            padded[sy] = corner;
+            for (unsigned int r = 0; r < sx; r++) {
+                float* row = padded.data() + (std::size_t(r) + 1)*py;
+                if (read) std::copy(samples.begin() + std::size_t(r)*sy, samples.begin() + std::size_t(r + 1)*sy, row);
+                else      std::fill(row, row + sy, constantH);
+                row[sy] = seamX && r < eastColumns[yk].size() ? eastColumns[yk][r] : hNoValue;
             }
+
+            for (int x = x0; x < x1; x++) {
+                float c = (regionMin.x + x*outRes.x - tmin.x)/tileRes.x;
+                for (int y = y0; y < y1; y++) {
+                    float r = float(sx) - (regionMin.y + y*outRes.y - tmin.y)/tileRes.y;
+                    grid.set(x, y, resampleBilinear(padded.data(), int(sx) + 1, int(py), r, c, mapping));
+                }
+            }
+            northRow.swap(lastRow);
         }
+        eastColumns.swap(westColumns);
     }
-
-    HeightsGrid* grid = new HeightsGrid(H, regionMin, regionMax, outRes, hNoValue);
-    return grid;
 }
@@ -2,10 +2,33 @@
 #define HEIGHTSTILESET_H
 #include <vector>
 #include <string>
+#include <memory>
+#include <atomic>
 #include "glm/glm.hpp"
 #include "heightsgrid.h"
+#include "querycontext.h"
+#include "tilepack.h"
+#include "tileprefetcher.h"
+#include "resample.h"
 
 
+// Summary of a tile as readTile returns it, where samples without value
+// become sea level, so min and max bound the tile at any resolution.
+struct TileSummary
+{
+    bool         exists;
+    float        hmin, hmax;
+    float        hmean;         // over the valid samples
+    unsigned int count;         // valid samples
+    unsigned int checksum;      // FNV-1a of the tile file
+};
+
+
+// The tiles are tile_XX_YY.bin files in the folder named on the first line
+// of the descriptor, or a TilePack when that line is a .pack file.
+// The descriptor is read once in the constructor and never changes, so one
+// tileset can be shared by several threads. Queries keep their decode scratch
+// in a QueryContext, one per thread.
 class HeightsTileset
 {
 public:
@@ -17,13 +40,71 @@ public:
     glm::vec2 getTileRes() const;
     glm::vec2 getTileExtension() const;
     glm::vec2 getTilesetExtension() const;
+    glm::ivec2 getPointsPerTile() const;
+    glm::ivec2 getNumTiles() const;
+    float     getNoValue() const;
+
+    // per tile summaries, from the manifest next to the descriptor
+    // (<descriptor>.manifest) when it has been generated. The manifest is
+    // dropped when a tile changed after it was written, or when a tile read
+    // does not match its checksum
+    bool        hasManifest() const;
+    TileSummary getTileSummary(int ti, int tj) const;
+    bool        getHeightRange(const glm::vec2& pmin, const glm::vec2& pmax, float& hmin, float& hmax) const;
+
+    bool summarizeTile(int ti, int tj, TileSummary& summary, QueryContext& ctx) const;
+    bool writeManifest(const std::string& path) const;
 
-    HeightsGrid* loadRegion(const glm::vec2& pmin, const glm::vec2& pmax, const glm::vec2& res);
+    // without a context the scratch of the calling thread is used. Resolutions
+    // that are not a multiple of the tile resolution are always bilinear
+    HeightsGrid* loadRegion(const glm::vec2& pmin, const glm::vec2& pmax, const glm::vec2& res,
+                            HeightsGrid::Storage storage = HeightsGrid::FLOAT32,
+                            ResampleFilter filter = RESAMPLE_MEAN) const;
+    void         loadRegion(const glm::vec2& pmin, const glm::vec2& pmax, const glm::vec2& res,
+                            HeightsGrid& grid, QueryContext& ctx,
+                            HeightsGrid::Storage storage = HeightsGrid::FLOAT32,
+                            ResampleFilter filter = RESAMPLE_MEAN) const;
 
-protected:
-    std::vector<std::vector<float> > readTile(int ti, int tj, const glm::ivec2& outFactor);
+    // moves a grid loaded with the same filter to a new region, reading only
+    // the cells it did not already hold. Returns false when the resolution,
+    // storage or cell alignment changed and the whole region was loaded again
+    bool         reloadRegion(const glm::vec2& pmin, const glm::vec2& pmax, const glm::vec2& res,
+                              HeightsGrid& grid, QueryContext& ctx,
+                              HeightsGrid::Storage storage = HeightsGrid::FLOAT32,
+                              ResampleFilter filter = RESAMPLE_MEAN) const;
+
+    // samples of a tile as stored, sx*sy in column order
+    bool readTileSamples(int ti, int tj, unsigned int& sx, unsigned int& sy, std::vector<float>& samples) const;
+
+    // background reading of the tiles of upcoming query windows, kept up
+    // to maxBytes until the queries read them
+    void          enablePrefetch(std::size_t maxBytes);
+    void          prefetchRegion(const glm::vec2& pmin, const glm::vec2& pmax) const;
+    PrefetchStats getPrefetchStats() const;
+
+    // downsampled tile into ctx.tileGrid(), T[ii][jj] lies at
+    // tile min + (jj, ppTile.x/outFactor.x - 1 - ii)*outFactor*res
+    void readTile(int ti, int tj, const glm::ivec2& outFactor, QueryContext& ctx,
+                  ResampleFilter filter = RESAMPLE_MEAN) const;
 
 private:
+    // cells cellMin <= (x, y) < cellMax of a grid covering the region
+    void        loadCells(const glm::vec2& regionMin, const glm::vec2& regionMax, const glm::vec2& outRes,
+                          const glm::ivec2& cellMin, const glm::ivec2& cellMax,
+                          HeightsGrid& grid, QueryContext& ctx, ResampleFilter filter) const;
+    void        loadCellsBilinear(const glm::vec2& regionMin, const glm::vec2& outRes,
+                                  const glm::ivec2& cellMin, const glm::ivec2& cellMax,
+                                  HeightsGrid& grid, QueryContext& ctx) const;
+    bool        readBilinearTile(int ti, int tj, QueryContext& ctx, unsigned int& sx, unsigned int& sy,
+                                 float& constantH) const;
+    void        readTileEdges(int ti, int tj, QueryContext& ctx, std::vector<float>& firstColumn,
+                              std::vector<float>& lastRow) const;
+    std::string getTilePath(int ti, int tj) const;
+    bool        readStoredSamples(int ti, int tj, unsigned int& sx, unsigned int& sy, std::vector<float>& samples) const;
+    void        loadManifest(const std::string& path);
+    bool        isManifestCurrent(const std::string& path) const;
+    void        checkTile(int ti, int tj, unsigned int sx, unsigned int sy, const std::vector<float>& samples) const;
+
     // tileset properties
     std::string tilesFolder;
     glm::vec2   tsetMin, tsetMax, tsetExtension;
@@ -32,8 +113,20 @@ private:
     glm::ivec2  ppTile;
     glm::ivec2  numTiles;
 
-    // tmp buffer
-    float* loadBuffer;
+    // single file tileset, closed when reading a folder
+    TilePack    pack;
+
+    // tile summaries indexed by ti*numTiles.y + tj, empty without manifest
+    std::vector<TileSummary> manifest;
+    mutable std::atomic<bool> manifestStale;
+
+    // tiles whose checksum has been compared with the manifest
+    std::unique_ptr<std::atomic<bool>[]> tileChecked;
+
+    // destroyed first, its worker reads from this tileset
+    std::unique_ptr<TilePrefetcher> prefetcher;
+
+    friend class TilePrefetcher;
 };
 
 
@@ -57,5 +150,21 @@ inline glm::vec2 HeightsTileset::getTilesetExtension() const {
     return tsetExtension;
 }
 
+inline glm::ivec2 HeightsTileset::getPointsPerTile() const {
+    return ppTile;
+}
+
+inline glm::ivec2 HeightsTileset::getNumTiles() const {
+    return numTiles;
+}
+
+inline float HeightsTileset::getNoValue() const {
+    return hNoValue;
+}
+
+inline bool HeightsTileset::hasManifest() const {
+    return !manifest.empty() && !manifestStale.load(std::memory_order_relaxed);
+}
+
 
 #endif // HEIGHTSTILESET_H
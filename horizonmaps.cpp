@@ -0,0 +1,172 @@
+#include "horizonmaps.h"
+#include "viewshed.h"
+#include "utils.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace {
+
+const double RAD_TO_DEG = 180.0/M_PI;
+
+// point of a digital line, s along the sweep direction
+struct HullPoint {
+    double s, h;
+};
+
+}
+
+
+HorizonMaps::HorizonMaps(const HeightsGrid& grid, int numDirections, const glm::ivec2& cellMin, const glm::ivec2& cellMax)
+{
+    size = glm::max(cellMax - cellMin, glm::ivec2(0));
+    noValue = grid.getGridNoValue();
+    for (int m = 0; m < NUM_MAPS; m++) {
+        maps[m].assign(std::size_t(size.x)*std::size_t(size.y), 0.0f);
+    }
+    if (size.x == 0 || size.y == 0 || numDirections <= 0) return;
+
+    grid.visit([&](const auto& view) {
+        for (int d = 0; d < numDirections; d++) {
+            sweepDirection(view, float(2*M_PI*d/numDirections), cellMin);
+        }
+    });
+
+    for (int i = 0; i < size.x; i++) {
+        for (int j = 0; j < size.y; j++) {
+            std::size_t k = std::size_t(i)*size.y + j;
+            if (grid.at(cellMin.x + i, cellMin.y + j) <= noValue) {
+                maps[SKY_VIEW][k] = maps[OPENNESS][k] = noValue;
+            }
+            else {
+                maps[SKY_VIEW][k] = 1 - maps[SKY_VIEW][k]/numDirections;
+                maps[OPENNESS][k] = maps[OPENNESS][k]/numDirections;
+            }
+        }
+    }
+}
+
+template<typename View>
+void HorizonMaps::sweepDirection(const View& view, float azimuth, const glm::ivec2& cellMin)
+{
+    glm::vec2  res = view.getGridRes();
+    glm::ivec2 gridSize = view.getGridSize();
+
+    // direction in meters and in cells, the lines follow its major axis
+    glm::dvec2 dir(std::sin(azimuth), std::cos(azimuth));
+    glm::dvec2 u(dir.x/res.x, dir.y/res.y);
+    bool   xMajor = std::abs(u.x) >= std::abs(u.y);
+    int    numMajor = xMajor ? gridSize.x : gridSize.y;
+    int    numMinor = xMajor ? gridSize.y : gridSize.x;
+    double uMajor = xMajor ? u.x : u.y;
+    double t = (xMajor ? u.y : u.x)/uMajor;
+    int    ahead = uMajor > 0 ? 1 : -1;
+
+    // every cell is on the line k = minor - round(t*major)
+    std::vector<int> shift(numMajor);
+    for (int m = 0; m < numMajor; m++) shift[m] = int(std::floor(t*m + 0.5));
+    int kMin = -std::max(shift[0], shift[numMajor - 1]);
+    int kMax = numMinor - 1 - std::min(shift[0], shift[numMajor - 1]);
+    int numLines = kMax - kMin + 1;
+
+    // a task sweeps LINES_PER_TASK adjacent lines in lockstep, so each step
+    // along the major axis reads a run of contiguous cells
+    int numTasks = (numLines + LINES_PER_TASK - 1)/LINES_PER_TASK;
+    runTasks(numTasks, [&](int task) {
+        std::vector<std::vector<HullPoint> > hulls(LINES_PER_TASK);
+        std::vector<int> spanLo(LINES_PER_TASK), spanHi(LINES_PER_TASK);
+        int l0 = task*LINES_PER_TASK;
+        int numTaskLines = std::min(int(LINES_PER_TASK), numLines - l0);
+        int mMin = numMajor, mMax = -1;
+        for (int l = 0; l < numTaskLines; l++) {
+            int k = kMin + l0 + l;
+            auto inside = [&](int m) {
+                int q = k + shift[m];
+                return q >= 0 && q < numMinor;
+            };
+
+            // contiguous span of the line within the grid
+            int mLo = 0, mHi = numMajor - 1;
+            if (t != 0) {
+                double a = (-k - 0.5)/t, b = (numMinor - 0.5 - k)/t;
+                mLo = int(std::max(0.0, std::floor(std::min(a, b)) - 1));
+                mHi = int(std::min(numMajor - 1.0, std::ceil(std::max(a, b)) + 1));
+            }
+            while (mLo <= mHi && !inside(mLo)) mLo++;
+            while (mHi >= mLo && !inside(mHi)) mHi--;
+            spanLo[l] = mLo;
+            spanHi[l] = mHi;
+            if (mLo <= mHi) {
+                mMin = std::min(mMin, mLo);
+                mMax = std::max(mMax, mHi);
+            }
+        }
+        if (mMin > mMax) return;
+
+        // from the far end backwards, the hulls hold the cells ahead
+        int mFirst = ahead > 0 ? mMax : mMin;
+        int mLast = ahead > 0 ? mMin : mMax;
+        for (int m = mFirst; ; m -= ahead) {
+            for (int l = 0; l < numTaskLines; l++) {
+                if (m < spanLo[l] || m > spanHi[l]) continue;
+                int q = kMin + l0 + l + shift[m];
+                int i = xMajor ? m : q;
+                int j = xMajor ? q : m;
+                float h = view.at(i, j);
+                if (h <= noValue) continue;
+
+                std::vector<HullPoint>& hull = hulls[l];
+                HullPoint c = { i*double(res.x)*dir.x + j*double(res.y)*dir.y, h };
+                while (hull.size() >= 2) {
+                    const HullPoint& top = hull[hull.size() - 1];
+                    const HullPoint& second = hull[hull.size() - 2];
+                    if ((top.h - c.h)*(second.s - c.s) > (second.h - c.h)*(top.s - c.s)) break;
+                    hull.pop_back();
+                }
+
+                int mi = i - cellMin.x, mj = j - cellMin.y;
+                if (mi >= 0 && mj >= 0 && mi < size.x && mj < size.y) {
+                    double slope = hull.empty() ? 0.0 : (hull.back().h - c.h)/(hull.back().s - c.s);
+                    std::size_t idx = std::size_t(mi)*size.y + mj;
+                    if (slope > 0) maps[SKY_VIEW][idx] += float(slope/std::sqrt(1 + slope*slope));
+                    maps[OPENNESS][idx] += float(90 - std::atan(slope)*RAD_TO_DEG);
+                }
+                hull.push_back(c);
+            }
+            if (m == mLast) break;
+        }
+    });
+}
+
+void HorizonMaps::computeProfile(const HeightsGrid& grid, const glm::vec3& p, float radius, int numDirections,
+                                 float refraction, std::vector<float>& angles, std::vector<float>& distances)
+{
+    glm::vec2  gridMin = grid.getGridMin();
+    glm::vec2  res = grid.getGridRes();
+    glm::ivec2 gridSize = grid.getGridSize();
+    float      gridNoValue = grid.getGridNoValue();
+    double     drop = (1.0 - refraction)/(2.0*Viewshed::EARTH_RADIUS);
+    float      step = glm::min(res.x, res.y);
+    int        numSteps = int(radius/step);
+
+    angles.assign(numDirections, -90.0f);
+    distances.assign(numDirections, 0.0f);
+    for (int d = 0; d < numDirections; d++) {
+        double az = 2*M_PI*d/numDirections;
+        glm::vec2 dir(float(std::sin(az)), float(std::cos(az)));
+        double best = -std::numeric_limits<double>::max();
+        for (int k = 1; k <= numSteps; k++) {
+            float dist = k*step;
+            glm::ivec2 c = glm::ivec2(glm::floor((glm::vec2(p) + dist*dir - gridMin)/res));
+            if (c.x < 0 || c.y < 0 || c.x >= gridSize.x || c.y >= gridSize.y) break;
+            float h = grid.at(c.x, c.y);
+            if (h <= gridNoValue) continue;
+            double slope = (h - drop*dist*dist - p.z)/dist;
+            if (slope > best) {
+                best = slope;
+                angles[d] = float(std::atan(slope)*RAD_TO_DEG);
+                distances[d] = dist;
+            }
+        }
+    }
+}
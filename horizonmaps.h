@@ -0,0 +1,66 @@
+#ifndef HORIZONMAPS_H
+#define HORIZONMAPS_H
+#include <vector>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+// Sky-view factor and openness of every cell of a region, from the horizon
+// elevation angle in a set of azimuths. Each azimuth is swept along the
+// digital lines of the grid in that direction, keeping the upper convex hull
+// of the heights ahead in a stack, so the horizon of every cell costs O(1)
+// amortized and the maps O(N*D). The horizon is searched up to the border
+// of the grid, without Earth curvature.
+//   SKY_VIEW  1 - mean of sin(horizon angle), negative angles as 0
+//   OPENNESS  positive openness, mean of the zenith angle of the horizon, degrees
+class HorizonMaps
+{
+public:
+    enum Map { SKY_VIEW, OPENNESS, NUM_MAPS };
+
+    // maps of the cells [cellMin, cellMax) of the grid with numDirections
+    // azimuths evenly spaced from north
+    HorizonMaps(const HeightsGrid& grid, int numDirections, const glm::ivec2& cellMin, const glm::ivec2& cellMax);
+
+    glm::ivec2 getSize() const;
+    float      getNoValue() const;
+
+    // map cell (i, j) at i*size.y + j, no value where the cell has no height
+    const std::vector<float>& getMap(Map m) const;
+    float at(Map m, int i, int j) const;
+
+    // Horizon of a point within radius in numDirections azimuths clockwise
+    // from north, marching each ray cell by cell. Heights are lowered by the
+    // Earth curvature with refraction as in Viewshed. Angles are in degrees,
+    // negative when the horizon is below p, with the distance to the cell
+    // that sets them.
+    static void computeProfile(const HeightsGrid& grid, const glm::vec3& p, float radius, int numDirections,
+                               float refraction, std::vector<float>& angles, std::vector<float>& distances);
+
+private:
+    enum { LINES_PER_TASK = 64 };
+
+    template<typename View>
+    void sweepDirection(const View& view, float azimuth, const glm::ivec2& cellMin);
+
+    glm::ivec2         size;
+    float              noValue;
+    std::vector<float> maps[NUM_MAPS];
+};
+
+inline glm::ivec2 HorizonMaps::getSize() const {
+    return size;
+}
+
+inline float HorizonMaps::getNoValue() const {
+    return noValue;
+}
+
+inline const std::vector<float>& HorizonMaps::getMap(Map m) const {
+    return maps[m];
+}
+
+inline float HorizonMaps::at(Map m, int i, int j) const {
+    return maps[m][std::size_t(i)*size.y + j];
+}
+
+#endif // HORIZONMAPS_H
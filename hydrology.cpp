@@ -0,0 +1,560 @@
+#include "hydrology.h"
+#include "utils.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <queue>
+
+namespace {
+
+const double RAD_TO_DEG = 180.0/M_PI;
+
+// neighbours clockwise from north
+const int NEIGHBOUR_DI[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+const int NEIGHBOUR_DJ[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+
+// D-infinity facets, between a cardinal and a diagonal neighbour
+const int FACET_CARDINAL[8] = { 0, 2, 2, 4, 4, 6, 6, 0 };
+const int FACET_DIAGONAL[8] = { 1, 1, 3, 3, 5, 5, 7, 7 };
+
+const unsigned char NO_RECEIVER = 255;  // outlets and sinks
+const unsigned char UNDRAINED = 254;    // flats while their directions are searched
+
+// watershed labels of the tiled fill, the outlets drain to the ocean
+const int UNLABELED = 0;
+const int OCEAN = 1;
+
+// Cells by height, in buckets evenly spread over a height range and kept as
+// heaps, so cells pop in exact height order while pushing and popping only
+// sort the few cells of a bucket. Pushing below the current bucket moves back
+// to it.
+class HeightQueue
+{
+public:
+    enum { NUM_BUCKETS = 65536 };
+
+    HeightQueue() : buckets(NUM_BUCKETS), hMin(0), scale(0), current(0), count(0) {}
+
+    // the queue must be empty
+    void reset(float minHeight, float maxHeight) {
+        hMin = minHeight;
+        scale = maxHeight > minHeight ? (NUM_BUCKETS - 1)/(double(maxHeight) - double(minHeight)) : 0.0;
+        current = 0;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    void push(float h, std::size_t cell) {
+        double b = std::floor((double(h) - hMin)*scale);
+        int bucket = int(std::max(0.0, std::min(double(NUM_BUCKETS - 1), b)));
+        buckets[bucket].push_back(Item(h, cell));
+        std::push_heap(buckets[bucket].begin(), buckets[bucket].end(), std::greater<Item>());
+        current = std::min(current, bucket);
+        count++;
+    }
+
+    std::size_t pop() {
+        while (buckets[current].empty()) current++;
+        std::vector<Item>& bucket = buckets[current];
+        std::pop_heap(bucket.begin(), bucket.end(), std::greater<Item>());
+        std::size_t cell = bucket.back().second;
+        bucket.pop_back();
+        count--;
+        return cell;
+    }
+
+private:
+    typedef std::pair<float, std::size_t> Item;
+
+    std::vector<std::vector<Item> > buckets;
+    double      hMin, scale;
+    int         current;
+    std::size_t count;
+};
+
+// distances and azimuths, in degrees clockwise from north, to the neighbours
+void neighbourGeometry(const glm::vec2& res, float dist[8], float azimuths[8])
+{
+    float diagonal = std::sqrt(res.x*res.x + res.y*res.y);
+    float diagonalAzimuth = float(std::atan2(res.x, res.y)*RAD_TO_DEG);
+    for (int k = 0; k < 8; k++) {
+        dist[k] = k % 2 ? diagonal : (k % 4 == 0 ? res.y : res.x);
+    }
+    azimuths[0] = 0.0f;
+    azimuths[1] = diagonalAzimuth;
+    azimuths[2] = 90.0f;
+    azimuths[3] = 180.0f - diagonalAzimuth;
+    azimuths[4] = 180.0f;
+    azimuths[5] = 180.0f + diagonalAzimuth;
+    azimuths[6] = 270.0f;
+    azimuths[7] = 360.0f - diagonalAzimuth;
+}
+
+std::uint64_t edgeKey(int a, int b)
+{
+    return (std::uint64_t(std::min(a, b)) << 32) | std::uint32_t(std::max(a, b));
+}
+
+// lowest spill height between two watersheds
+void addSpill(std::unordered_map<std::uint64_t, float>& spills, int a, int b, float h)
+{
+    auto it = spills.insert(std::make_pair(edgeKey(a, b), h)).first;
+    it->second = std::min(it->second, h);
+}
+
+}
+
+
+Hydrology::Hydrology(const HeightsGrid& grid, Conditioning conditioning, Routing routing,
+                     const glm::ivec2& cellMin, const glm::ivec2& cellMax)
+{
+    size = glm::max(cellMax - cellMin, glm::ivec2(0));
+    noValue = grid.getGridNoValue();
+    for (int m = 0; m < NUM_MAPS; m++) {
+        maps[m].assign(std::size_t(size.x)*std::size_t(size.y), noValue);
+    }
+    if (size.x == 0 || size.y == 0) return;
+
+    grid.visit([&](const auto& view) { loadHeights(view, cellMin); });
+    findOutlets();
+
+    if (conditioning == FILL) fillTiles();
+    else breachDepressions();
+
+    computeDirections(routing, grid.getGridRes());
+    drainFlats(grid.getGridRes());
+    accumulateFlow(grid.getGridRes());
+}
+
+template<typename View>
+void Hydrology::loadHeights(const View& view, const glm::ivec2& cellMin)
+{
+    std::vector<float>& z = maps[CONDITIONED];
+    int numBlocks = (size.x + BLOCK_COLUMNS - 1)/BLOCK_COLUMNS;
+    runTasks(numBlocks, [&](int b) {
+        int iEnd = std::min((b + 1)*int(BLOCK_COLUMNS), size.x);
+        for (int i = b*BLOCK_COLUMNS; i < iEnd; i++) {
+            for (int j = 0; j < size.y; j++) {
+                float h = view.at(cellMin.x + i, cellMin.y + j);
+                z[std::size_t(i)*size.y + j] = h > noValue ? h : noValue;
+            }
+        }
+    });
+}
+
+void Hydrology::findOutlets()
+{
+    // before the conditioning, which changes the heights the tiles read
+    // across their edges
+    const std::vector<float>& z = maps[CONDITIONED];
+    outlets.assign(z.size(), 0);
+    int numBlocks = (size.x + BLOCK_COLUMNS - 1)/BLOCK_COLUMNS;
+    runTasks(numBlocks, [&](int b) {
+        int iEnd = std::min((b + 1)*int(BLOCK_COLUMNS), size.x);
+        for (int i = b*BLOCK_COLUMNS; i < iEnd; i++) {
+            for (int j = 0; j < size.y; j++) {
+                std::size_t c = std::size_t(i)*size.y + j;
+                if (z[c] <= noValue) continue;
+                bool outlet = i == 0 || j == 0 || i == size.x - 1 || j == size.y - 1;
+                for (int k = 0; k < 8 && !outlet; k++) {
+                    outlet = z[std::size_t(i + NEIGHBOUR_DI[k])*size.y + j + NEIGHBOUR_DJ[k]] <= noValue;
+                }
+                outlets[c] = outlet;
+            }
+        }
+    });
+}
+
+void Hydrology::fillTiles()
+{
+    std::vector<float>& z = maps[CONDITIONED];
+    std::vector<int> labels(z.size(), UNLABELED);
+
+    // each tile is flooded from its border, the cells of its edge label
+    // their own watershed and the outlets label the ocean
+    glm::ivec2 numTiles = (size + int(TILE_SIZE) - 1)/int(TILE_SIZE);
+    int labelsPerTile = 4*TILE_SIZE;
+    std::vector<std::unordered_map<std::uint64_t, float> > tileSpills(numTiles.x*numTiles.y);
+    runTasks(numTiles.x*numTiles.y, [&](int t) {
+        HeightQueue queue;
+        std::vector<std::size_t> pit;
+        std::unordered_map<std::uint64_t, float>& spills = tileSpills[t];
+
+        int i0 = (t/numTiles.y)*TILE_SIZE, i1 = std::min(i0 + int(TILE_SIZE), size.x);
+        int j0 = (t%numTiles.y)*TILE_SIZE, j1 = std::min(j0 + int(TILE_SIZE), size.y);
+        float hMin = std::numeric_limits<float>::max(), hMax = -hMin;
+        for (int i = i0; i < i1; i++) {
+            for (int j = j0; j < j1; j++) {
+                float h = z[std::size_t(i)*size.y + j];
+                if (h <= noValue) continue;
+                hMin = std::min(hMin, h);
+                hMax = std::max(hMax, h);
+            }
+        }
+        if (hMin > hMax) return;
+        queue.reset(hMin, hMax);
+
+        int nextLabel = OCEAN + 1 + t*labelsPerTile;
+        for (int i = i0; i < i1; i++) {
+            for (int j = j0; j < j1; j++) {
+                std::size_t c = std::size_t(i)*size.y + j;
+                if (z[c] <= noValue) continue;
+                if (!outlets[c] && i != i0 && j != j0 && i != i1 - 1 && j != j1 - 1) continue;
+                labels[c] = outlets[c] ? OCEAN : nextLabel++;
+                queue.push(z[c], c);
+            }
+        }
+
+        // cells raised to the current height go to the pit queue, which is
+        // emptied before popping the next height
+        std::size_t pitHead = 0;
+        while (pitHead < pit.size() || !queue.empty()) {
+            std::size_t c;
+            if (pitHead < pit.size()) {
+                c = pit[pitHead++];
+            }
+            else {
+                pit.clear();
+                pitHead = 0;
+                c = queue.pop();
+            }
+            int ci = int(c/size.y), cj = int(c%size.y);
+            for (int k = 0; k < 8; k++) {
+                int ni = ci + NEIGHBOUR_DI[k], nj = cj + NEIGHBOUR_DJ[k];
+                if (ni < i0 || nj < j0 || ni >= i1 || nj >= j1) continue;
+                std::size_t n = std::size_t(ni)*size.y + nj;
+                if (z[n] <= noValue) continue;
+                if (labels[n] == UNLABELED) {
+                    labels[n] = labels[c];
+                    if (z[n] <= z[c]) {
+                        z[n] = z[c];
+                        pit.push_back(n);
+                    }
+                    else {
+                        queue.push(z[n], n);
+                    }
+                }
+                else if (labels[n] != labels[c]) {
+                    addSpill(spills, labels[c], labels[n], std::max(z[c], z[n]));
+                }
+            }
+        }
+    });
+
+    // spills across the tile edges
+    std::unordered_map<std::uint64_t, float> edgeSpills;
+    auto crossSpill = [&](int ai, int aj, int bi, int bj) {
+        if (bj < 0 || bi < 0 || bi >= size.x || bj >= size.y) return;
+        std::size_t a = std::size_t(ai)*size.y + aj, b = std::size_t(bi)*size.y + bj;
+        if (z[a] <= noValue || z[b] <= noValue || labels[a] == labels[b]) return;
+        addSpill(edgeSpills, labels[a], labels[b], std::max(z[a], z[b]));
+    };
+    for (int i = TILE_SIZE - 1; i + 1 < size.x; i += TILE_SIZE) {
+        for (int j = 0; j < size.y; j++) {
+            for (int d = -1; d <= 1; d++) crossSpill(i, j, i + 1, j + d);
+        }
+    }
+    for (int j = TILE_SIZE - 1; j + 1 < size.y; j += TILE_SIZE) {
+        for (int i = 0; i < size.x; i++) {
+            for (int d = -1; d <= 1; d++) crossSpill(i, j, i + d, j + 1);
+        }
+    }
+
+    // graph of the watersheds, as offsets to the neighbours of each label
+    int numLabels = OCEAN + 1 + numTiles.x*numTiles.y*labelsPerTile;
+    std::vector<std::size_t> firstEdge(numLabels + 1, 0);
+    tileSpills.push_back(std::move(edgeSpills));
+    for (const auto& spills : tileSpills) {
+        for (const auto& s : spills) {
+            firstEdge[int(s.first >> 32) + 1]++;
+            firstEdge[int(s.first & 0xffffffffu) + 1]++;
+        }
+    }
+    for (int l = 0; l < numLabels; l++) firstEdge[l + 1] += firstEdge[l];
+    std::vector<std::pair<int, float> > edges(firstEdge[numLabels]);
+    std::vector<std::size_t> edgeEnd(firstEdge.begin(), firstEdge.end() - 1);
+    for (auto& spills : tileSpills) {
+        for (const auto& s : spills) {
+            int a = int(s.first >> 32), b = int(s.first & 0xffffffffu);
+            edges[edgeEnd[a]++] = std::make_pair(b, s.second);
+            edges[edgeEnd[b]++] = std::make_pair(a, s.second);
+        }
+        spills.clear();
+    }
+
+    // the spill height of a watershed is the lowest, over the paths to the
+    // ocean, of the highest spill along the path
+    const float INF = std::numeric_limits<float>::max();
+    std::vector<float> spillHeight(numLabels, INF);
+    typedef std::pair<float, int> LabelHeight;
+    std::priority_queue<LabelHeight, std::vector<LabelHeight>, std::greater<LabelHeight> > open;
+    spillHeight[OCEAN] = -INF;
+    open.push(LabelHeight(-INF, OCEAN));
+    while (!open.empty()) {
+        LabelHeight top = open.top();
+        open.pop();
+        if (top.first > spillHeight[top.second]) continue;
+        for (std::size_t e = firstEdge[top.second]; e < firstEdge[top.second + 1]; e++) {
+            float h = std::max(top.first, edges[e].second);
+            if (h < spillHeight[edges[e].first]) {
+                spillHeight[edges[e].first] = h;
+                open.push(LabelHeight(h, edges[e].first));
+            }
+        }
+    }
+
+    int numBlocks = (size.x + BLOCK_COLUMNS - 1)/BLOCK_COLUMNS;
+    runTasks(numBlocks, [&](int b) {
+        std::size_t kEnd = std::size_t(std::min((b + 1)*int(BLOCK_COLUMNS), size.x))*size.y;
+        for (std::size_t k = std::size_t(b)*BLOCK_COLUMNS*size.y; k < kEnd; k++) {
+            if (labels[k] == UNLABELED || spillHeight[labels[k]] == INF) continue;
+            z[k] = std::max(z[k], spillHeight[labels[k]]);
+        }
+    });
+}
+
+void Hydrology::breachDepressions()
+{
+    std::vector<float>& z = maps[CONDITIONED];
+    const unsigned char UNVISITED = 255, OUTLET = 8;
+
+    // neighbour each cell was reached from, the way back to an outlet
+    std::vector<unsigned char> parents(z.size(), UNVISITED);
+    float hMin = std::numeric_limits<float>::max(), hMax = -hMin;
+    for (float h : z) {
+        if (h <= noValue) continue;
+        hMin = std::min(hMin, h);
+        hMax = std::max(hMax, h);
+    }
+    if (hMin > hMax) return;
+
+    HeightQueue queue;
+    queue.reset(hMin, hMax);
+    for (std::size_t c = 0; c < z.size(); c++) {
+        if (outlets[c]) {
+            parents[c] = OUTLET;
+            queue.push(z[c], c);
+        }
+    }
+
+    while (!queue.empty()) {
+        std::size_t c = queue.pop();
+        int ci = int(c/size.y), cj = int(c%size.y);
+        for (int k = 0; k < 8; k++) {
+            int ni = ci + NEIGHBOUR_DI[k], nj = cj + NEIGHBOUR_DJ[k];
+            if (ni < 0 || nj < 0 || ni >= size.x || nj >= size.y) continue;
+            std::size_t n = std::size_t(ni)*size.y + nj;
+            if (z[n] <= noValue || parents[n] != UNVISITED) continue;
+            parents[n] = (k + 4) % 8;
+
+            // the bottom of a depression, lower every cell back to the
+            // outlet below the previous one
+            if (z[n] < z[c]) {
+                std::size_t prev = n, cur = c;
+                while (z[cur] >= z[prev]) {
+                    z[cur] = std::nextafter(z[prev], -std::numeric_limits<float>::max());
+                    if (parents[cur] == OUTLET) break;
+                    int pi = int(cur/size.y) + NEIGHBOUR_DI[parents[cur]];
+                    int pj = int(cur%size.y) + NEIGHBOUR_DJ[parents[cur]];
+                    prev = cur;
+                    cur = std::size_t(pi)*size.y + pj;
+                }
+            }
+            queue.push(z[n], n);
+        }
+    }
+}
+
+void Hydrology::computeDirections(Routing routing, const glm::vec2& res)
+{
+    const std::vector<float>& z = maps[CONDITIONED];
+    std::vector<float>& dirs = maps[FLOW_DIRECTION];
+    receivers.assign(z.size(), NO_RECEIVER);
+    nextFraction.assign(routing == DINF ? z.size() : 0, 0.0f);
+
+    float dist[8], azimuths[8];
+    neighbourGeometry(res, dist, azimuths);
+
+    int numBlocks = (size.x + BLOCK_COLUMNS - 1)/BLOCK_COLUMNS;
+    runTasks(numBlocks, [&](int b) {
+        int iEnd = std::min((b + 1)*int(BLOCK_COLUMNS), size.x);
+        for (int i = b*BLOCK_COLUMNS; i < iEnd; i++) {
+            for (int j = 0; j < size.y; j++) {
+                std::size_t c = std::size_t(i)*size.y + j;
+                if (z[c] <= noValue) continue;
+
+                // heights of the neighbours, no value out of the region
+                float zn[8];
+                for (int k = 0; k < 8; k++) {
+                    int ni = i + NEIGHBOUR_DI[k], nj = j + NEIGHBOUR_DJ[k];
+                    bool inside = ni >= 0 && nj >= 0 && ni < size.x && nj < size.y;
+                    zn[k] = inside ? z[std::size_t(ni)*size.y + nj] : noValue;
+                }
+
+                int best = -1;
+                float bestSlope = 0;
+                for (int k = 0; k < 8; k++) {
+                    float s = (z[c] - zn[k])/dist[k];
+                    if (zn[k] > noValue && s > bestSlope) {
+                        best = k;
+                        bestSlope = s;
+                    }
+                }
+                if (best < 0) {
+                    receivers[c] = outlets[c] ? NO_RECEIVER : UNDRAINED;
+                    dirs[c] = -1.0f;
+                    continue;
+                }
+                receivers[c] = (unsigned char)best;
+                dirs[c] = azimuths[best];
+                if (routing != DINF) continue;
+
+                // facets between a cardinal neighbour and a diagonal one, the
+                // flow leaves at angle r from the cardinal
+                double facetSlope = 0;
+                for (int f = 0; f < 8; f++) {
+                    int kc = FACET_CARDINAL[f], kd = FACET_DIAGONAL[f];
+                    bool clockwise = kd == kc + 1;
+                    if (zn[kc] <= noValue || zn[kd] <= noValue) continue;
+                    double d1 = dist[kc], d2 = kc % 4 == 0 ? res.x : res.y;
+                    double s1 = (z[c] - zn[kc])/d1, s2 = (zn[kc] - zn[kd])/d2;
+                    double r = std::atan2(s2, s1), rMax = std::atan2(d2, d1), s;
+                    if (r < 0) {
+                        r = 0;
+                        s = s1;
+                    }
+                    else if (r > rMax) {
+                        r = rMax;
+                        s = (z[c] - zn[kd])/dist[kd];
+                    }
+                    else {
+                        s = std::sqrt(s1*s1 + s2*s2);
+                    }
+                    if (s <= facetSlope) continue;
+                    facetSlope = s;
+
+                    // the first of the two neighbours clockwise receives 1 - fraction
+                    double a = azimuths[kc] + (clockwise ? r : -r)*RAD_TO_DEG;
+                    receivers[c] = (unsigned char)(clockwise ? kc : kd);
+                    nextFraction[c] = float(clockwise ? r/rMax : 1 - r/rMax);
+                    dirs[c] = float(a < 0 ? a + 360 : a);
+                }
+            }
+        }
+    });
+}
+
+void Hydrology::drainFlats(const glm::vec2& res)
+{
+    const std::vector<float>& z = maps[CONDITIONED];
+    std::vector<float>& dirs = maps[FLOW_DIRECTION];
+    float dist[8], azimuths[8];
+    neighbourGeometry(res, dist, azimuths);
+
+    // the undrained cells of a flat are reached breadth-first from the cells
+    // of the same height that already drain, so each flows towards the
+    // closest one. Undrained cells are not on the border, their neighbours
+    // are all in the region.
+    std::vector<std::pair<std::size_t, int> > seeds;
+    for (int i = 0; i < size.x; i++) {
+        for (int j = 0; j < size.y; j++) {
+            std::size_t c = std::size_t(i)*size.y + j;
+            if (z[c] <= noValue || receivers[c] != UNDRAINED) continue;
+            for (int k = 0; k < 8; k++) {
+                std::size_t n = std::size_t(i + NEIGHBOUR_DI[k])*size.y + j + NEIGHBOUR_DJ[k];
+                if (z[n] == z[c] && receivers[n] != UNDRAINED) {
+                    seeds.push_back(std::make_pair(c, k));
+                    break;
+                }
+            }
+        }
+    }
+
+    std::vector<std::size_t> front;
+    for (const auto& s : seeds) {
+        receivers[s.first] = (unsigned char)s.second;
+        dirs[s.first] = azimuths[s.second];
+        front.push_back(s.first);
+    }
+    for (std::size_t f = 0; f < front.size(); f++) {
+        std::size_t c = front[f];
+        int ci = int(c/size.y), cj = int(c%size.y);
+        for (int k = 0; k < 8; k++) {
+            std::size_t n = std::size_t(ci + NEIGHBOUR_DI[k])*size.y + cj + NEIGHBOUR_DJ[k];
+            if (receivers[n] != UNDRAINED || z[n] != z[c]) continue;
+            receivers[n] = (unsigned char)((k + 4) % 8);
+            dirs[n] = azimuths[(k + 4) % 8];
+            front.push_back(n);
+        }
+    }
+
+    // sinks, flats without any lower cell around
+    for (unsigned char& r : receivers) {
+        if (r == UNDRAINED) r = NO_RECEIVER;
+    }
+}
+
+void Hydrology::accumulateFlow(const glm::vec2& res)
+{
+    const std::vector<float>& z = maps[CONDITIONED];
+    std::vector<float>& acc = maps[ACCUMULATION];
+    bool split = !nextFraction.empty();
+    float cellArea = res.x*res.y;
+
+    // part of the flow of cell c sent to its neighbour k
+    auto share = [&](std::size_t c, int k) {
+        unsigned char r = receivers[c];
+        float f = split ? nextFraction[c] : 0.0f;
+        if (r == k) return 1 - f;
+        if (r != NO_RECEIVER && (r + 1) % 8 == k) return f;
+        return 0.0f;
+    };
+
+    // donors of every cell
+    std::vector<unsigned char> donors(z.size(), 0);
+    int numBlocks = (size.x + BLOCK_COLUMNS - 1)/BLOCK_COLUMNS;
+    runTasks(numBlocks, [&](int b) {
+        int iEnd = std::min((b + 1)*int(BLOCK_COLUMNS), size.x);
+        for (int i = b*BLOCK_COLUMNS; i < iEnd; i++) {
+            for (int j = 0; j < size.y; j++) {
+                std::size_t c = std::size_t(i)*size.y + j;
+                if (z[c] <= noValue) continue;
+                acc[c] = cellArea;
+                for (int k = 0; k < 8; k++) {
+                    int ni = i + NEIGHBOUR_DI[k], nj = j + NEIGHBOUR_DJ[k];
+                    if (ni < 0 || nj < 0 || ni >= size.x || nj >= size.y) continue;
+                    std::size_t n = std::size_t(ni)*size.y + nj;
+                    if (z[n] > noValue && share(n, (k + 4) % 8) > 0) donors[c]++;
+                }
+            }
+        }
+    });
+
+    // cells pass their flow downstream once all their donors have, starting
+    // from the cells without donors
+    const unsigned char DONE = 255;
+    std::vector<std::size_t> ready;
+    for (std::size_t c0 = 0; c0 < z.size(); c0++) {
+        if (z[c0] <= noValue || donors[c0] != 0) continue;
+        ready.push_back(c0);
+        while (!ready.empty()) {
+            std::size_t c = ready.back();
+            ready.pop_back();
+            donors[c] = DONE;
+            if (receivers[c] == NO_RECEIVER) continue;
+            int ci = int(c/size.y), cj = int(c%size.y);
+            for (int s = 0; s < 2; s++) {
+                int k = (receivers[c] + s) % 8;
+                float w = share(c, k);
+                if (w <= 0) continue;
+                std::size_t n = std::size_t(ci + NEIGHBOUR_DI[k])*size.y + cj + NEIGHBOUR_DJ[k];
+                acc[n] += w*acc[c];
+                if (--donors[n] == 0) ready.push_back(n);
+            }
+        }
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef HYDROLOGY_H
+#define HYDROLOGY_H
+#include <vector>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+// Hydrologically conditioned heights, flow directions and flow accumulation
+// of a region. The edge of the region and the cells next to cells without
+// value are outlets, and depressions are removed with priority-flood from
+// them, popping cells from a queue of height buckets:
+//   FILL    raises every depression to its spill height. The region is
+//           split in tiles flooded in parallel, each from its own border,
+//           and the spill heights between the watersheds of the tile
+//           borders are then solved on their graph (Barnes, 2016).
+//   BREACH  carves a descending channel from the bottom of every depression
+//           to the cell it was reached from, back to an outlet. Channels may
+//           cross the whole region, so it runs as a single flood.
+// Flats are drained towards their lowest border by a breadth-first search.
+//   CONDITIONED     heights without depressions, m
+//   FLOW_DIRECTION  degrees clockwise from north, -1 at outlets and sinks
+//   ACCUMULATION    area draining through the cell, itself included, m2
+class Hydrology
+{
+public:
+    enum Map { CONDITIONED, FLOW_DIRECTION, ACCUMULATION, NUM_MAPS };
+    enum Conditioning { FILL, BREACH };
+
+    // D8 sends the flow to the steepest of the 8 neighbours, D-infinity
+    // splits it between the two neighbours of the steepest facet (Tarboton)
+    enum Routing { D8, DINF };
+
+    // maps of the cells [cellMin, cellMax) of the grid, heights out of them
+    // are not used
+    Hydrology(const HeightsGrid& grid, Conditioning conditioning, Routing routing,
+              const glm::ivec2& cellMin, const glm::ivec2& cellMax);
+
+    glm::ivec2 getSize() const;
+    float      getNoValue() const;
+
+    // map cell (i, j) at i*size.y + j, no value where the cell has no height
+    const std::vector<float>& getMap(Map m) const;
+    float at(Map m, int i, int j) const;
+
+private:
+    enum { TILE_SIZE = 512, BLOCK_COLUMNS = 64 };
+
+    template<typename View>
+    void loadHeights(const View& view, const glm::ivec2& cellMin);
+
+    void findOutlets();
+    void fillTiles();
+    void breachDepressions();
+    void computeDirections(Routing routing, const glm::vec2& res);
+    void drainFlats(const glm::vec2& res);
+    void accumulateFlow(const glm::vec2& res);
+
+    glm::ivec2         size;
+    float              noValue;
+    std::vector<float> maps[NUM_MAPS];
+
+    // neighbour receiving the flow, clockwise from north, and for D-infinity
+    // the part sent to the next one
+    std::vector<unsigned char> receivers;
+    std::vector<float>         nextFraction;
+
+    // cells on the edge of the region or next to cells without value
+    std::vector<unsigned char> outlets;
+};
+
+inline glm::ivec2 Hydrology::getSize() const {
+    return size;
+}
+
+inline float Hydrology::getNoValue() const {
+    return noValue;
+}
+
+inline const std::vector<float>& Hydrology::getMap(Map m) const {
+    return maps[m];
+}
+
+inline float Hydrology::at(Map m, int i, int j) const {
+    return maps[m][std::size_t(i)*size.y + j];
+}
+
+#endif // HYDROLOGY_H
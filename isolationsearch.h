@@ -0,0 +1,67 @@
+#ifndef ISOLATIONSEARCH_H
+#define ISOLATIONSEARCH_H
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "glm/glm.hpp"
+#include "querycontext.h"
+
+// Isolation search of computeIsolation on any grid with the getters of
+// HeightsGrid and atIfHigher(i, j, h). Cells are visited in increasing distance until
+// minIsoArea of terrain higher than the point (plus hOffset) has been found.
+template<typename Grid>
+float isolationSearch(const Grid& grid, const glm::vec3 &p, float minDist, glm::vec3 &pIso,
+                      float minIsoArea, float hOffset, QueryContext& ctx)
+{
+    glm::vec2  gridMin = grid.getGridMin();
+    glm::vec2  gridRes = grid.getGridRes();
+    glm::ivec2 gridSize = grid.getGridSize();
+    glm::vec2 p_xy = glm::vec2(p);
+    glm::ivec2 pcoords = glm::ivec2((p_xy - gridMin)/gridRes);
+    float ph = p.z + hOffset;
+    pIso = p;
+	float isoArea = 0;
+
+    ctx.beginVisit(gridSize.x, gridSize.y);
+    std::vector<QueryContext::HeapNode>& Q = ctx.heap();
+    auto push = [&Q](float d, int x, int y) {
+        Q.push_back(std::make_pair(d, std::make_pair(x, y)));
+        std::push_heap(Q.begin(), Q.end());
+    };
+
+    push(0.0f, pcoords.x, pcoords.y);
+    while (!Q.empty()) {
+        std::pop_heap(Q.begin(), Q.end());
+        QueryContext::HeapNode qtop = Q.back(); Q.pop_back();
+        int pcx = qtop.second.first;
+        int pcy = qtop.second.second;
+        if (pcx >= 0 && pcy >= 0 && pcx < gridSize.x && pcy < gridSize.y && !ctx.isVisited(pcx, pcy)) {
+            ctx.setVisited(pcx, pcy);
+            float h = grid.atIfHigher(pcx, pcy, ph);
+			glm::vec2 pij = gridMin + glm::vec2(pcx + 0.5f, pcy + 0.5f)*gridRes;
+			float d = glm::distance(pij, p_xy);
+            if (h > ph && d >= minDist) {
+				// keep the last isolation point found
+                pIso = glm::vec3(pij.x, pij.y, h);
+				isoArea += gridRes.x * gridRes.y;
+				if (isoArea > minIsoArea)
+					break;
+            }
+
+            push(-d - std::sqrt(2.0f), pcx - 1, pcy - 1);
+            push(-d - 1,               pcx - 1, pcy    );
+            push(-d - std::sqrt(2.0f), pcx - 1, pcy + 1);
+            push(-d - 1,               pcx,     pcy - 1);
+            push(-d - 1,               pcx,     pcy + 1);
+            push(-d - std::sqrt(2.0f), pcx + 1, pcy - 1);
+            push(-d - 1,               pcx + 1, pcy    );
+            push(-d - std::sqrt(2.0f), pcx + 1, pcy + 1);
+        }
+    }
+
+    float dres = glm::distance(p_xy, glm::vec2(pIso));
+    if (dres > minDist) return dres;
+    else                return -1;
+}
+
+#endif // ISOLATIONSEARCH_H
@@ -1,39 +1,324 @@
 #include "loaderply.h"
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <cstdint>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PLY_SSE2
+#include <emmintrin.h>
+#endif
 
-bool LoaderPLY::loadPLY(const std::string& filename, std::vector<glm::vec3>& verts, std::vector<glm::ivec3>& faces)
+
+namespace {
+
+// uchar count and three int32 indices, as writePLY writes faces
+const std::size_t TRIANGLE_RECORD = 1 + 3*sizeof(int32_t);
+
+enum PLYScalar { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64, PLY_INVALID };
+
+struct PLYProperty {
+    std::string name;
+    PLYScalar   type;       // item type for lists
+    PLYScalar   countType;  // PLY_INVALID for scalars
+};
+
+struct PLYElement {
+    std::string name;
+    uint64_t    count;
+    std::vector<PLYProperty> props;
+    int         recordSize; // -1 when it has lists
+};
+
+PLYScalar scalarType(const std::string& name) {
+    if (name == "char"   || name == "int8")    return PLY_INT8;
+    if (name == "uchar"  || name == "uint8")   return PLY_UINT8;
+    if (name == "short"  || name == "int16")   return PLY_INT16;
+    if (name == "ushort" || name == "uint16")  return PLY_UINT16;
+    if (name == "int"    || name == "int32")   return PLY_INT32;
+    if (name == "uint"   || name == "uint32")  return PLY_UINT32;
+    if (name == "float"  || name == "float32") return PLY_FLOAT32;
+    if (name == "double" || name == "float64") return PLY_FLOAT64;
+    return PLY_INVALID;
+}
+
+int scalarSize(PLYScalar type) {
+    static const int sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+    return sizes[type];
+}
+
+double readScalar(const char* p, PLYScalar type) {
+    switch (type) {
+        case PLY_INT8:    { int8_t v;   std::memcpy(&v, p, 1); return v; }
+        case PLY_UINT8:   { uint8_t v;  std::memcpy(&v, p, 1); return v; }
+        case PLY_INT16:   { int16_t v;  std::memcpy(&v, p, 2); return v; }
+        case PLY_UINT16:  { uint16_t v; std::memcpy(&v, p, 2); return v; }
+        case PLY_INT32:   { int32_t v;  std::memcpy(&v, p, 4); return v; }
+        case PLY_UINT32:  { uint32_t v; std::memcpy(&v, p, 4); return v; }
+        case PLY_FLOAT32: { float v;    std::memcpy(&v, p, 4); return v; }
+        case PLY_FLOAT64: { double v;   std::memcpy(&v, p, 8); return v; }
+        default: return 0;
+    }
+}
+
+// elements and properties of the header, and where the data starts
+bool parseHeader(const char* data, std::size_t size, std::vector<PLYElement>& elements, std::size_t& bodyOffset)
+{
+    std::size_t pos = 0;
+    bool first = true, format = false;
+    while (pos < size) {
+        std::size_t eol = pos;
+        while (eol < size && data[eol] != '\n') eol++;
+        if (eol == size) return false;
+        std::string line(data + pos, eol - pos);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        pos = eol + 1;
+
+        std::istringstream iss(line);
+        std::string key;
+        iss >> key;
+        if (first) {
+            if (key != "ply") return false;
+            first = false;
+        }
+        else if (key == "format") {
+            std::string fmt, version;
+            iss >> fmt >> version;
+            if (fmt != "binary_little_endian" || version != "1.0") return false;
+            format = true;
+        }
+        else if (key == "element") {
+            PLYElement e;
+            iss >> e.name >> e.count;
+            if (iss.fail()) return false;
+            e.recordSize = 0;
+            elements.push_back(e);
+        }
+        else if (key == "property") {
+            if (elements.empty()) return false;
+            PLYElement& e = elements.back();
+            PLYProperty p;
+            std::string type;
+            iss >> type;
+            if (type == "list") {
+                std::string countType, itemType;
+                iss >> countType >> itemType >> p.name;
+                p.countType = scalarType(countType);
+                p.type = scalarType(itemType);
+                if (p.countType == PLY_INVALID || p.countType == PLY_FLOAT32 || p.countType == PLY_FLOAT64) return false;
+                e.recordSize = -1;
+            }
+            else {
+                iss >> p.name;
+                p.type = scalarType(type);
+                p.countType = PLY_INVALID;
+                if (e.recordSize >= 0) e.recordSize += scalarSize(p.type);
+            }
+            if (iss.fail() || p.type == PLY_INVALID) return false;
+            e.props.push_back(p);
+        }
+        else if (key == "end_header") {
+            bodyOffset = pos;
+            return format;
+        }
+        else if (key != "comment" && key != "obj_info" && !key.empty()) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// bytes of the record at p, 0 if it does not fit before end
+std::size_t recordBytes(const PLYElement& e, const char* p, const char* end)
 {
-    std::string foo, format;
-    unsigned int numVerts, numFaces;
-
-    std::ifstream fin(filename, std::fstream::in | std::fstream::binary);
-
-    std::getline(fin, foo);             // ply
-    fin >> foo >> format >> foo;        // format <format> 1.0
-    fin >> foo >> foo >> numVerts;      // element vertex Nv
-    std::getline(fin, foo);             // \n
-    std::getline(fin, foo);             // property float x
-    std::getline(fin, foo);             // property float y
-    std::getline(fin, foo);             // property float z
-    fin >> foo >> foo >> numFaces;      // element face Nf
-    std::getline(fin, foo);             // \n
-    std::getline(fin, foo);             // property list uint8 int32 vertex_index
-    fin >> foo;                         // end_header
-    std::getline(fin, foo);             // \n
-
-    verts.resize(numVerts);
-    fin.read((char*)(&verts[0].x), numVerts*sizeof(glm::vec3));
-    faces.resize(numFaces);
-    for (unsigned int i = 0; i < numFaces; i++) {
-        char fsize;
-        fin.read((char*)(&fsize), sizeof(char));
-        fin.read((char*)(&faces[i][0]), fsize*sizeof(int));
+    if (e.recordSize >= 0) return std::size_t(end - p) >= std::size_t(e.recordSize) ? std::size_t(e.recordSize) : 0;
+    const char* q = p;
+    for (const PLYProperty& prop : e.props) {
+        if (prop.countType == PLY_INVALID) {
+            q += scalarSize(prop.type);
+        }
+        else {
+            if (end - q < scalarSize(prop.countType)) return 0;
+            double n = readScalar(q, prop.countType);
+            if (n < 0) return 0;
+            q += scalarSize(prop.countType);
+            if (std::size_t(end - q) < std::size_t(n)*scalarSize(prop.type)) return 0;
+            q += std::size_t(n)*scalarSize(prop.type);
+        }
+        if (q > end) return 0;
     }
+    return std::size_t(q - p);
+}
 
-    fin.close();
+int findProperty(const PLYElement& e, const char* name) {
+    for (size_t i = 0; i < e.props.size(); i++) {
+        if (e.props[i].name == name) return int(i);
+    }
+    return -1;
+}
 
+// triangle records copied in one pass without parsing;
+// false if some face is not a triangle or has an index out of range
+bool copyTriangles(const char* p, std::size_t numFaces, unsigned int numVerts, glm::ivec3* faces)
+{
+    if (numFaces == 0) return true;
+    unsigned int badCount = 0;
+    std::size_t f = 0;
+#ifdef PLY_SSE2
+    // each 16 byte store also writes the start of the next face, which
+    // overwrites it, and the last face is copied alone so no load passes the end
+    int32_t* out = &faces[0][0];
+    __m128i outOfRange = _mm_setzero_si128();
+    __m128i maxIndex = _mm_set1_epi32(int(numVerts) - 1);
+    __m128i laneMask = _mm_set_epi32(0, -1, -1, -1);
+    for (; f + 1 < numFaces; f++) {
+        const char* rec = p + f*TRIANGLE_RECORD;
+        badCount |= unsigned(uint8_t(rec[0])) ^ 3u;
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rec + 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3*f), idx);
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi32(idx, _mm_setzero_si128()), _mm_cmpgt_epi32(idx, maxIndex));
+        outOfRange = _mm_or_si128(outOfRange, _mm_and_si128(bad, laneMask));
+    }
+    if (_mm_movemask_epi8(outOfRange) != 0) return false;
+#endif
+    for (; f < numFaces; f++) {
+        const char* rec = p + f*TRIANGLE_RECORD;
+        badCount |= unsigned(uint8_t(rec[0])) ^ 3u;
+        std::memcpy(&faces[f][0], rec + 1, 3*sizeof(int32_t));
+        for (int k = 0; k < 3; k++) {
+            if (unsigned(faces[f][k]) >= numVerts) return false;
+        }
+    }
+    return badCount == 0;
+}
+
+}
+
+
+PLYMesh::PLYMesh()
+{
+    verts = nullptr;
+    numVerts = 0;
+}
+
+
+bool LoaderPLY::loadPLY(const std::string& filename, PLYMesh& mesh)
+{
+    mesh.file.close();
+    mesh.verts = nullptr;
+    mesh.numVerts = 0;
+    mesh.gatheredVerts.clear();
+    mesh.faces.clear();
+
+    if (!mesh.file.open(filename)) return false;
+    const char* data = mesh.file.data();
+    const char* end = data + mesh.file.size();
+
+    std::vector<PLYElement> elements;
+    std::size_t bodyOffset = 0;
+    if (!parseHeader(data, mesh.file.size(), elements, bodyOffset)) return false;
+
+    const char* p = data + bodyOffset;
+    bool haveVerts = false;
+    for (const PLYElement& e : elements) {
+        if (e.name == "vertex" && !haveVerts) {
+            int px = findProperty(e, "x"), py = findProperty(e, "y"), pz = findProperty(e, "z");
+            if (px < 0 || py < 0 || pz < 0 || e.recordSize <= 0 || e.count > 0xFFFFFFFFu ||
+                std::size_t(end - p)/std::size_t(e.recordSize) < e.count) {
+                return false;
+            }
+            mesh.numVerts = unsigned(e.count);
+
+            // float x, y, z alone are already the buffer layout
+            bool packed = e.props.size() == 3 && px == 0 && py == 1 && pz == 2 &&
+                          e.props[0].type == PLY_FLOAT32 && e.props[1].type == PLY_FLOAT32 && e.props[2].type == PLY_FLOAT32;
+            if (packed) {
+                mesh.verts = p;
+            }
+            else {
+                std::size_t offsets[3] = { 0, 0, 0 };
+                int coords[3] = { px, py, pz };
+                for (int c = 0; c < 3; c++) {
+                    for (int k = 0; k < coords[c]; k++) offsets[c] += scalarSize(e.props[k].type);
+                }
+                mesh.gatheredVerts.resize(mesh.numVerts);
+                for (unsigned int i = 0; i < mesh.numVerts; i++) {
+                    const char* rec = p + std::size_t(i)*e.recordSize;
+                    for (int c = 0; c < 3; c++) {
+                        mesh.gatheredVerts[i][c] = float(readScalar(rec + offsets[c], e.props[coords[c]].type));
+                    }
+                }
+                mesh.verts = reinterpret_cast<const char*>(mesh.gatheredVerts.data());
+            }
+            p += std::size_t(e.count)*e.recordSize;
+            haveVerts = true;
+        }
+        else if (e.name == "face" && haveVerts) {
+            int pi = findProperty(e, "vertex_indices");
+            if (pi < 0) pi = findProperty(e, "vertex_index");
+            if (pi < 0 || e.props[pi].countType == PLY_INVALID || e.count > 0x7FFFFFFFu) return false;
+            const PLYProperty& list = e.props[pi];
+
+            // fixed size triangle records, as writePLY writes them
+            bool triangles = e.props.size() == 1 && scalarSize(list.countType) == 1 &&
+                             (list.type == PLY_INT32 || list.type == PLY_UINT32) &&
+                             std::size_t(end - p)/TRIANGLE_RECORD >= e.count;
+            if (triangles) {
+                mesh.faces.resize(std::size_t(e.count));
+                if (copyTriangles(p, std::size_t(e.count), mesh.numVerts, mesh.faces.data())) {
+                    p += std::size_t(e.count)*TRIANGLE_RECORD;
+                    continue;
+                }
+                mesh.faces.clear();
+            }
+
+            // any other layout, record by record
+            std::vector<int> poly;
+            for (uint64_t f = 0; f < e.count; f++) {
+                std::size_t bytes = recordBytes(e, p, end);
+                if (bytes == 0) return false;
+                const char* q = p;
+                for (int k = 0; k < pi; k++) {
+                    const PLYProperty& prop = e.props[k];
+                    if (prop.countType == PLY_INVALID) q += scalarSize(prop.type);
+                    else q += scalarSize(prop.countType) + std::size_t(readScalar(q, prop.countType))*scalarSize(prop.type);
+                }
+                int n = int(readScalar(q, list.countType));
+                q += scalarSize(list.countType);
+                poly.resize(n);
+                for (int k = 0; k < n; k++) {
+                    double v = readScalar(q + std::size_t(k)*scalarSize(list.type), list.type);
+                    if (v < 0 || v >= double(mesh.numVerts)) return false;
+                    poly[k] = int(v);
+                }
+                for (int k = 1; k + 1 < n; k++) {
+                    mesh.faces.push_back(glm::ivec3(poly[0], poly[k], poly[k + 1]));
+                }
+                p += bytes;
+            }
+        }
+        else if (e.name == "face") {
+            return false;
+        }
+        else {
+            for (uint64_t r = 0; r < e.count; r++) {
+                std::size_t bytes = recordBytes(e, p, end);
+                if (bytes == 0) return false;
+                p += bytes;
+            }
+        }
+    }
+
+    return haveVerts;
+}
+
+bool LoaderPLY::loadPLY(const std::string& filename, std::vector<glm::vec3>& verts, std::vector<glm::ivec3>& faces)
+{
+    PLYMesh mesh;
+    if (!loadPLY(filename, mesh)) return false;
+    verts.resize(mesh.getNumVertices());
+    if (!verts.empty()) std::memcpy(&verts[0].x, mesh.getVertexData(), verts.size()*sizeof(glm::vec3));
+    faces.assign(mesh.getFaceData(), mesh.getFaceData() + mesh.getNumFaces());
     return true;
 }
 
@@ -3,15 +3,69 @@
 
 #include <string>
 #include <vector>
+#include <cstring>
 #include "glm/glm.hpp"
+#include "mappedfile.h"
+
+// Triangle mesh of a binary little endian PLY file, kept mapped. When the
+// vertex element is just float x, y, z the positions are used in place from
+// the mapping, otherwise they are gathered into packed vec3. Faces are
+// triangles, polygons are split in fans.
+class PLYMesh
+{
+public:
+    PLYMesh();
+
+    unsigned int getNumVertices() const;
+    unsigned int getNumFaces() const;
+
+    // packed vec3 positions, not necessarily aligned to 4 bytes
+    const void* getVertexData() const;
+    glm::vec3   getVertex(unsigned int i) const;
+
+    const glm::ivec3* getFaceData() const;
+
+private:
+    friend class LoaderPLY;
+
+    MappedFile   file;
+    const char*  verts;
+    unsigned int numVerts;
+    std::vector<glm::vec3>  gatheredVerts;
+    std::vector<glm::ivec3> faces;
+};
 
 class LoaderPLY
 {
 public:
 
+    static bool loadPLY(const std::string& filename, PLYMesh& mesh);
     static bool loadPLY(const std::string& filename, std::vector<glm::vec3>& verts, std::vector<glm::ivec3>& faces);
     static bool writePLY(const std::string& filename, const std::vector<glm::vec3>& verts, const std::vector<glm::ivec3>& faces);
 
 };
 
+
+inline unsigned int PLYMesh::getNumVertices() const {
+    return numVerts;
+}
+
+inline unsigned int PLYMesh::getNumFaces() const {
+    return static_cast<unsigned int>(faces.size());
+}
+
+inline const void* PLYMesh::getVertexData() const {
+    return verts;
+}
+
+inline glm::vec3 PLYMesh::getVertex(unsigned int i) const {
+    glm::vec3 v;
+    std::memcpy(&v.x, verts + std::size_t(i)*sizeof(glm::vec3), sizeof(glm::vec3));
+    return v;
+}
+
+inline const glm::ivec3* PLYMesh::getFaceData() const {
+    return faces.data();
+}
+
 #endif // LOADERPLY_H
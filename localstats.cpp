@@ -0,0 +1,125 @@
+#include "localstats.h"
+#include "utils.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace {
+
+// out[t] = op of values[t .. t+w-1]. Prefix extremes inside blocks of w from
+// the left and from the right, so each output takes one op whatever w.
+template<typename Op>
+void slidingExtreme(const float* values, int n, int w, float* forward, float* backward, float* out, Op op)
+{
+    for (int b = 0; b < n; b += w) {
+        int e = std::min(b + w, n);
+        forward[b] = values[b];
+        for (int k = b + 1; k < e; k++) forward[k] = op(forward[k - 1], values[k]);
+        backward[e - 1] = values[e - 1];
+        for (int k = e - 2; k >= b; k--) backward[k] = op(backward[k + 1], values[k]);
+    }
+    for (int t = 0; t + w <= n; t++) {
+        out[t] = op(backward[t], forward[t + w - 1]);
+    }
+}
+
+struct MaxOp { float operator()(float a, float b) const { return a > b ? a : b; } };
+struct MinOp { float operator()(float a, float b) const { return a < b ? a : b; } };
+
+}
+
+
+LocalStats::LocalStats(const HeightsGrid& grid, float radius, const glm::ivec2& cellMin, const glm::ivec2& cellMax)
+{
+    size = glm::max(cellMax - cellMin, glm::ivec2(0));
+    noValue = grid.getGridNoValue();
+    for (int m = 0; m < NUM_MAPS; m++) {
+        maps[m].assign(std::size_t(size.x)*std::size_t(size.y), noValue);
+    }
+    if (size.x == 0 || size.y == 0) return;
+
+    grid.visit([&](const auto& view) { computeColumns(view, radius, cellMin); });
+}
+
+template<typename View>
+void LocalStats::computeColumns(const View& view, float radius, const glm::ivec2& cellMin)
+{
+    glm::vec2  res = view.getGridRes();
+    glm::ivec2 gridSize = view.getGridSize();
+
+    // rows of the disk for each column offset, cells whose center is within
+    // the radius on both sides of the cell
+    int rx = int(std::floor(radius/res.x));
+    std::vector<int> spans(2*rx + 1);
+    double r2 = double(radius)*double(radius)*(1 + 1e-6);
+    for (int dx = -rx; dx <= rx; dx++) {
+        double ddx = dx*double(res.x);
+        spans[dx + rx] = int(std::floor(std::sqrt(std::max(0.0, r2 - ddx*ddx))/res.y));
+    }
+    int hmax = spans[rx];
+
+    // columns are independent, each task takes a block of them
+    int numBlocks = (size.x + BLOCK_COLUMNS - 1)/BLOCK_COLUMNS;
+    runTasks(numBlocks, [&](int b) {
+        // rows cellMin.y - hmax .. cellMin.y + size.y + hmax of a grid column
+        int n = size.y + 2*hmax;
+        std::vector<float>  vmax(n), vmin(n), forward(n), backward(n), smax(n), smin(n);
+        std::vector<double> psum(n + 1), psum2(n + 1);
+        std::vector<int>    pcount(n + 1);
+        std::vector<float>  accMax(size.y), accMin(size.y);
+        std::vector<double> accSum(size.y), accSum2(size.y);
+        std::vector<int>    accCount(size.y);
+
+        int ciEnd = std::min((b + 1)*int(BLOCK_COLUMNS), size.x);
+        for (int ci = b*BLOCK_COLUMNS; ci < ciEnd; ci++) {
+            std::fill(accMax.begin(), accMax.end(), -std::numeric_limits<float>::max());
+            std::fill(accMin.begin(), accMin.end(), std::numeric_limits<float>::max());
+            std::fill(accSum.begin(), accSum.end(), 0.0);
+            std::fill(accSum2.begin(), accSum2.end(), 0.0);
+            std::fill(accCount.begin(), accCount.end(), 0);
+
+            for (int dx = -rx; dx <= rx; dx++) {
+                int gi = cellMin.x + ci + dx;
+                if (gi < 0 || gi >= gridSize.x) continue;
+
+                // heights below 0 and cells out of the grid do not count
+                psum[0] = psum2[0] = 0;
+                pcount[0] = 0;
+                for (int k = 0; k < n; k++) {
+                    int gj = cellMin.y - hmax + k;
+                    float h = gj >= 0 && gj < gridSize.y ? view.at(gi, gj) : -1.0f;
+                    bool valid = h >= 0;
+                    vmax[k] = valid ? h : -std::numeric_limits<float>::max();
+                    vmin[k] = valid ? h : std::numeric_limits<float>::max();
+                    psum[k + 1] = psum[k] + (valid ? h : 0.0);
+                    psum2[k + 1] = psum2[k] + (valid ? double(h)*h : 0.0);
+                    pcount[k + 1] = pcount[k] + (valid ? 1 : 0);
+                }
+
+                // output row t spans rows t - h .. t + h, from offset hmax - h
+                int h = spans[dx + rx];
+                int w = 2*h + 1;
+                int o = hmax - h;
+                slidingExtreme(&vmax[o], size.y + 2*h, w, &forward[0], &backward[0], &smax[0], MaxOp());
+                slidingExtreme(&vmin[o], size.y + 2*h, w, &forward[0], &backward[0], &smin[0], MinOp());
+                for (int t = 0; t < size.y; t++) {
+                    accMax[t] = std::max(accMax[t], smax[t]);
+                    accMin[t] = std::min(accMin[t], smin[t]);
+                    accSum[t] += psum[o + t + w] - psum[o + t];
+                    accSum2[t] += psum2[o + t + w] - psum2[o + t];
+                    accCount[t] += pcount[o + t + w] - pcount[o + t];
+                }
+            }
+
+            std::size_t base = std::size_t(ci)*size.y;
+            for (int t = 0; t < size.y; t++) {
+                int N = accCount[t];
+                if (N == 0) continue;
+                double var = N > 1 ? (accSum2[t] - accSum[t]*accSum[t]/N)/(N - 1) : 0.0;
+                maps[RELIEF][base + t] = accMax[t] - accMin[t];
+                maps[MEAN][base + t] = float(accSum[t]/N);
+                maps[STDEV][base + t] = float(std::sqrt(std::max(0.0, var)));
+            }
+        }
+    });
+}
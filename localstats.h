@@ -0,0 +1,59 @@
+#ifndef LOCALSTATS_H
+#define LOCALSTATS_H
+#include <vector>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+// Local relief (max - min), mean and standard deviation of the heights within
+// a radius of every cell of a region. As in RadialStatsPolicy heights below 0
+// are left out and the deviation is the sample one, but the disk is whole:
+// RadialStatsPolicy scans the window [p - R, p + R), so when the radius is a
+// multiple of the resolution it misses the cells at exactly +R east and north
+// that are counted here. The disk is split in one span of rows per column
+// offset, and each span slides along the grid columns with van Herk/Gil-Werman
+// max and min filters and running sums, so a map cell costs O(R/res) instead
+// of the O((R/res)^2) of a radial query.
+class LocalStats
+{
+public:
+    enum Map { RELIEF, MEAN, STDEV, NUM_MAPS };
+
+    // maps of the cells [cellMin, cellMax) of the grid. Neighbours are read
+    // from the whole grid, so it should extend the radius beyond the cells.
+    LocalStats(const HeightsGrid& grid, float radius, const glm::ivec2& cellMin, const glm::ivec2& cellMax);
+
+    glm::ivec2 getSize() const;
+    float      getNoValue() const;
+
+    // map cell (i, j) at i*size.y + j, no value where no height counts
+    const std::vector<float>& getMap(Map m) const;
+    float at(Map m, int i, int j) const;
+
+private:
+    enum { BLOCK_COLUMNS = 16 };
+
+    template<typename View>
+    void computeColumns(const View& view, float radius, const glm::ivec2& cellMin);
+
+    glm::ivec2         size;
+    float              noValue;
+    std::vector<float> maps[NUM_MAPS];
+};
+
+inline glm::ivec2 LocalStats::getSize() const {
+    return size;
+}
+
+inline float LocalStats::getNoValue() const {
+    return noValue;
+}
+
+inline const std::vector<float>& LocalStats::getMap(Map m) const {
+    return maps[m];
+}
+
+inline float LocalStats::at(Map m, int i, int j) const {
+    return maps[m][std::size_t(i)*size.y + j];
+}
+
+#endif // LOCALSTATS_H
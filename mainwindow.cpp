@@ -3,8 +3,107 @@
 #include <QFileDialog>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 #include "loaderply.h"
+#include "heightspyramid.h"
+#include "heightsbandreader.h"
+#include "measurepass.h"
 #include "utils.h"
+#include "textwriter.h"
+#include "rasterwriter.h"
+#include "geotiffwriter.h"
+#include "localstats.h"
+#include "terrainderivatives.h"
+#include "viewshed.h"
+#include "horizonmaps.h"
+#include "hydrology.h"
+#include "contourwriter.h"
+
+// memory for the tiles kept by the paged isolation queries
+static const size_t PAGED_TILES_BUDGET = size_t(1) << 30;
+// memory for the tiles read ahead of the list queries
+static const size_t PREFETCH_BUDGET = size_t(256) << 20;
+// memory for each band of rows of the streamed exports
+static const size_t EXPORT_BAND_BUDGET = size_t(512) << 20;
+// projected system of the tilesets, ETRS89 / UTM 31N
+static const int EXPORT_EPSG = 25831;
+
+// rows of the region from north to south, one call per band
+template<typename WriteRows>
+static void readRowsNorthToSouth(HeightsBandReader& bands, QueryContext& ctx, WriteRows writeRows)
+{
+    glm::ivec2 gridPoints = bands.getGridSize();
+    std::vector<float> rows;
+    for (int b = bands.getNumBands() - 1; b >= 0; b--) {
+        const HeightsGrid& band = bands.loadBand(b, b - 1, ctx);
+        int numRows = bands.getBandEnd(b) - bands.getBandBegin(b);
+        rows.resize(size_t(numRows)*size_t(gridPoints.x));
+        for (int r = 0; r < numRows; r++) {
+            for (int x = 0; x < gridPoints.x; x++) {
+                rows[size_t(r)*gridPoints.x + x] = band.at(x, numRows - 1 - r);
+            }
+        }
+        writeRows(rows.data(), numRows);
+    }
+}
+
+// name_suffix.ext from name.ext
+static std::string suffixedPath(const std::string& path, const std::string& suffix)
+{
+    size_t ext = path.rfind('.');
+    std::string name = path.substr(0, ext) + suffix;
+    if (ext != std::string::npos) name += path.substr(ext);
+    return name;
+}
+
+// map stored by columns, cell (i, j) at i*size.y + j, as rows from north to south
+static void columnsToRows(const std::vector<float>& columns, const glm::ivec2& size, std::vector<float>& rows)
+{
+    rows.resize(size_t(size.x)*size_t(size.y));
+    for (int y = 0; y < size.y; y++) {
+        for (int x = 0; x < size.x; x++) {
+            rows[size_t(y)*size.x + x] = columns[size_t(x)*size.y + size.y - 1 - y];
+        }
+    }
+}
+
+// map held in memory as rows from north to south, in the format of the file
+// extension. GeoTIFF overviews are halved from the rows, which are consumed.
+static void saveMapRows(const std::string& path, std::vector<float>& rows, const glm::ivec2& size,
+                        const glm::vec2& mapMin, const glm::vec2& mapRes, float noValue, bool compress)
+{
+    RasterWriter::Format format;
+    if (GeoTiffWriter::isGeoTiffPath(path)) {
+        std::vector<glm::ivec2> sizes = GeoTiffWriter::overviewSizes(size);
+        std::vector<std::vector<float> > levels(sizes.size());
+        levels[0].swap(rows);
+        for (size_t k = 1; k < sizes.size(); k++) {
+            sizes[k] = GeoTiffWriter::halve(levels[k - 1], sizes[k - 1], noValue, levels[k]);
+        }
+        GeoTiffWriter tiff(path, sizes, mapMin, mapRes, EXPORT_EPSG, noValue, compress);
+        for (int k = int(sizes.size()) - 1; k >= 0; k--) {
+            tiff.writeRows(k, levels[k].data(), sizes[k].y);
+        }
+        tiff.close();
+    }
+    else if (RasterWriter::formatFromPath(path, format)) {
+        RasterWriter raster(path, format, size, mapMin, mapRes, noValue);
+        raster.writeRows(rows.data(), size.y);
+        raster.close();
+    }
+    else {
+        TextWriter fout(path);
+        fout.writeRows(size.y, [&](int y, TextBuffer& text) {
+            const float* row = &rows[size_t(y)*size.x];
+            text << row[0];
+            for (int x = 1; x < size.x; x++) {
+                text << " " << row[x];
+            }
+            text << "\n";
+        });
+        fout.close();
+    }
+}
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -14,9 +113,13 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->glWidget->showRegion(ui->checkShowRegion->isChecked());
 
     tileset = new HeightsTileset("catalunya.tiles");
+    tileset->enablePrefetch(PREFETCH_BUDGET);
+    pagedTiles = new PagedHeightsGrid(*tileset, PAGED_TILES_BUDGET);
     gridMin = tileset->getTilesetMin();
     gridMax = tileset->getTilesetMax();
     gridRes = tileset->getTileRes();
+    gridStorage = HeightsGrid::FLOAT32;
+    gridFilter = RESAMPLE_MEAN;
     ui->elvXmin->setMinimum(gridMin.x);
     ui->elvXmin->setMaximum(gridMax.x);
     ui->elvXmin->setValue(gridMin.x);
@@ -57,16 +160,26 @@ MainWindow::MainWindow(QWidget *parent) :
 	ui->queryOrsX->setMaximum(gridMax.x);
 	ui->queryOrsY->setMinimum(gridMin.y);
 	ui->queryOrsY->setMaximum(gridMax.y);
+	ui->queryViewshedX->setValue(0.5*(gridMin.x + gridMax.x));
+	ui->queryViewshedY->setValue(0.5*(gridMin.y + gridMax.y));
+	ui->queryViewshedX->setMinimum(gridMin.x);
+	ui->queryViewshedX->setMaximum(gridMax.x);
+	ui->queryViewshedY->setMinimum(gridMin.y);
+	ui->queryViewshedY->setMaximum(gridMax.y);
 
 	ui->buttonExportRegionORS->setEnabled(false);
+	ui->buttonExportPointViewshed->setEnabled(false);
 
     grid = nullptr;
+    viewshed = nullptr;
     dirtyGrid = true;
 }
 
 MainWindow::~MainWindow()
 {
     if (grid) delete grid;
+    if (viewshed) delete viewshed;
+    delete pagedTiles;
     delete tileset;
     delete ui;
 }
@@ -106,35 +219,65 @@ void MainWindow::setGridResolution(double f)
     emitUpdatedRegion();
 }
 
+void MainWindow::setGridStorage(int i)
+{
+    // same order as the elvStorage items
+    const HeightsGrid::Storage storages[] = { HeightsGrid::FLOAT32, HeightsGrid::INT16_DM, HeightsGrid::UINT16_SCALED };
+    gridStorage = storages[i];
+    dirtyGrid = true;
+    emitUpdatedRegion();
+}
+
+void MainWindow::setGridFilter(int i)
+{
+    // same order as the elvFilter items
+    const ResampleFilter filters[] = { RESAMPLE_MEAN, RESAMPLE_MAX, RESAMPLE_MIN, RESAMPLE_BILINEAR };
+    gridFilter = filters[i];
+    dirtyGrid = true;
+
+    // the loaded heights cannot be reused with another filter
+    if (grid) delete grid;
+    grid = nullptr;
+}
+
 void MainWindow::saveGridELV()
 {
     QString filename = QFileDialog::getSaveFileName(this, tr("Desar elevacions per a WinProm"), QString(), tr("ELV (*.elv)"));
     if (!filename.isEmpty()) {
         ui->tabWidget->setEnabled(false);
-        checkGrid();
-        glm::ivec2 gridPoints = grid->getGridSize();
+        HeightsBandReader bands(*tileset, gridMin, gridMax, gridRes, EXPORT_BAND_BUDGET, gridFilter);
+        glm::ivec2 gridPoints = bands.getGridSize();
 		float elevScale = ui->elvScaleFactor->value();
 
         this->ui->statusBar->showMessage("Desant ELV...");
         std::ofstream fout(filename.toStdString(), std::fstream::out | std::fstream::trunc | std::fstream::binary);
 
-        write_long(fout, grid->getGridMin().y);                     // min lat
-        write_long(fout, grid->getGridMin().y + gridPoints.y - 1);  // max lat
-        write_long(fout, grid->getGridMin().x);                     // min lon
-        write_long(fout, grid->getGridMin().x + gridPoints.x - 1);  // max lon
-        write_short(fout, grid->getGridNoValue());                  // default
+        write_long(fout, bands.getGridMin().y);                     // min lat
+        write_long(fout, bands.getGridMin().y + gridPoints.y - 1);  // max lat
+        write_long(fout, bands.getGridMin().x);                     // min lon
+        write_long(fout, bands.getGridMin().x + gridPoints.x - 1);  // max lon
+        write_short(fout, bands.getGridNoValue());                  // default
         write_long(fout, 0);    // xdim, ydim
         write_long(fout, 0);    // winprom throws error if they are not both 0
         write_long(fout, 2);    // WinProm assumes equat grid (code 2)
-        write_long(fout, grid->getGridRes().y);     // lat_step
-        write_long(fout, grid->getGridRes().x);     // lon_step
+        write_long(fout, bands.getGridRes().y);     // lat_step
+        write_long(fout, bands.getGridRes().x);     // lon_step
         write_long(fout, gridPoints.y);
         write_long(fout, gridPoints.x);
 
-        for (int y = 0; y < gridPoints.y; y++) {
-            for (int x = 0; x < gridPoints.x; x++) {
-                write_short(fout, short(elevScale*grid->data()[x][y] + 0.5));
+        // rows from south to north, one write per band
+        QueryContext& ctx = QueryContext::threadContext();
+        std::vector<short> rows;
+        for (int b = 0; b < bands.getNumBands(); b++) {
+            const HeightsGrid& band = bands.loadBand(b, b + 1, ctx);
+            int numRows = bands.getBandEnd(b) - bands.getBandBegin(b);
+            rows.resize(size_t(numRows)*size_t(gridPoints.x));
+            for (int y = 0; y < numRows; y++) {
+                for (int x = 0; x < gridPoints.x; x++) {
+                    rows[size_t(y)*gridPoints.x + x] = short(elevScale*band.at(x, y) + 0.5);
+                }
             }
+            fout.write((const char*)(rows.data()), rows.size()*sizeof(short));
         }
 
         fout.close();
@@ -175,21 +318,75 @@ void MainWindow::saveGridPLY()
 
 void MainWindow::saveGridDATA()
 {
-    QString filename = QFileDialog::getSaveFileName(this, tr("Desar elevacions com a matriu"), QString(), tr("DATA (*.data)"));
+    bool compress;
+    QString filename = getMapSaveFileName(tr("Desar elevacions com a matriu"), compress);
     if (!filename.isEmpty()) {
         ui->tabWidget->setEnabled(false);
 
-        checkGrid();
-        glm::ivec2 gridPoints = grid->getGridSize();
+        HeightsBandReader bands(*tileset, gridMin, gridMax, gridRes, EXPORT_BAND_BUDGET, gridFilter);
+        glm::ivec2 gridPoints = bands.getGridSize();
+        QueryContext& ctx = QueryContext::threadContext();
+
+        // binary rasters in the same row order, one write per band
+        RasterWriter::Format format;
+        if (RasterWriter::formatFromPath(filename.toStdString(), format)) {
+            this->ui->statusBar->showMessage("Desant matriu binària...");
+            RasterWriter raster(filename.toStdString(), format, gridPoints, bands.getGridMin(), bands.getGridRes(), bands.getGridNoValue());
+            readRowsNorthToSouth(bands, ctx, [&](const float* rows, int numRows) {
+                raster.writeRows(rows, numRows);
+            });
+            if (raster.close()) this->ui->statusBar->showMessage("Completat!", 5000);
+            else                this->ui->statusBar->showMessage("No s'ha pogut desar la matriu");
+            ui->tabWidget->setEnabled(true);
+            return;
+        }
 
-        this->ui->statusBar->showMessage("Desant DATA...");
-        std::ofstream fout(filename.toStdString(), std::fstream::out | std::fstream::trunc);
-        for (int y = 0; y < gridPoints.y; y++) {
-            fout << grid->data()[0][gridPoints.y - 1 - y];
-            for (int x = 1; x < gridPoints.x; x++) {
-                fout << " " << grid->data()[x][gridPoints.y - 1 - y];
+        // GeoTIFF overviews are the region read again at twice the spacing each,
+        // anchored at the north west corner, and go first in the file
+        if (GeoTiffWriter::isGeoTiffPath(filename.toStdString())) {
+            this->ui->statusBar->showMessage("Desant GeoTIFF...");
+            glm::vec2 corner(bands.getGridMin().x, bands.getGridMin().y + float(gridPoints.y)*bands.getGridRes().y);
+            std::vector<glm::ivec2> sizes = GeoTiffWriter::overviewSizes(gridPoints);
+            auto overviewReader = [&](int k) {
+                // padded half a cell so rounding cannot drop the last column or row
+                glm::vec2 res = bands.getGridRes()*float(1 << k);
+                glm::vec2 pmin(corner.x, corner.y - float(sizes[k].y)*res.y);
+                glm::vec2 pmax(corner.x + (float(sizes[k].x) + 0.5f)*res.x, corner.y + 0.5f*res.y);
+                return HeightsBandReader(*tileset, pmin, pmax, res, EXPORT_BAND_BUDGET, gridFilter);
+            };
+            for (size_t k = 1; k < sizes.size(); k++) sizes[k] = overviewReader(int(k)).getGridSize();
+
+            GeoTiffWriter tiff(filename.toStdString(), sizes, bands.getGridMin(), bands.getGridRes(),
+                               EXPORT_EPSG, bands.getGridNoValue(), compress);
+            for (int k = int(sizes.size()) - 1; k > 0; k--) {
+                HeightsBandReader overview = overviewReader(k);
+                readRowsNorthToSouth(overview, ctx, [&](const float* rows, int numRows) {
+                    tiff.writeRows(k, rows, numRows);
+                });
             }
-            fout << std::endl;
+            readRowsNorthToSouth(bands, ctx, [&](const float* rows, int numRows) {
+                tiff.writeRows(0, rows, numRows);
+            });
+            if (tiff.close()) this->ui->statusBar->showMessage("Completat!", 5000);
+            else              this->ui->statusBar->showMessage("No s'ha pogut desar el GeoTIFF");
+            ui->tabWidget->setEnabled(true);
+            return;
+        }
+
+        // rows from north to south, the rows of each band formatted in parallel
+        this->ui->statusBar->showMessage("Desant DATA...");
+        TextWriter fout(filename.toStdString());
+        for (int b = bands.getNumBands() - 1; b >= 0; b--) {
+            const HeightsGrid& band = bands.loadBand(b, b - 1, ctx);
+            int numRows = bands.getBandEnd(b) - bands.getBandBegin(b);
+            fout.writeRows(numRows, [&](int r, TextBuffer& rows) {
+                int y = numRows - 1 - r;
+                rows << band.at(0, y);
+                for (int x = 1; x < gridPoints.x; x++) {
+                    rows << " " << band.at(x, y);
+                }
+                rows << "\n";
+            });
         }
         fout.close();
 
@@ -234,6 +431,141 @@ void MainWindow::computeRadialStats()
 }
 
 
+void MainWindow::saveGridContours()
+{
+    QString filename = QFileDialog::getSaveFileName(this, tr("Desar corbes de nivell"), QString(),
+                                                    tr("GeoJSON (*.geojson);;Polilínies binàries (*.cnt)"));
+    if (filename.isEmpty()) return;
+
+    ContourWriter::Format format;
+    if (!ContourWriter::formatFromPath(filename.toStdString(), format)) {
+        format = ContourWriter::GEOJSON;
+        filename += ".geojson";
+    }
+
+    ui->tabWidget->setEnabled(false);
+
+    // bands from south to north, the writer keeps only the lines still open
+    this->ui->statusBar->showMessage("Desant corbes de nivell...");
+    HeightsBandReader bands(*tileset, gridMin, gridMax, gridRes, EXPORT_BAND_BUDGET, gridFilter);
+    QueryContext& ctx = QueryContext::threadContext();
+    ContourWriter contours(filename.toStdString(), format, bands.getGridSize().x, bands.getGridMin(),
+                           bands.getGridRes(), EXPORT_EPSG, bands.getGridNoValue(), float(ui->contourInterval->value()));
+    for (int b = 0; b < bands.getNumBands(); b++) {
+        contours.addBand(bands.loadBand(b, b + 1, ctx));
+    }
+    if (contours.close()) this->ui->statusBar->showMessage("Completat!", 5000);
+    else                  this->ui->statusBar->showMessage("No s'han pogut desar les corbes de nivell");
+
+    ui->tabWidget->setEnabled(true);
+}
+
+
+QString MainWindow::getMapSaveFileName(const QString& title, bool& compress)
+{
+    QString tiffUncompressed = tr("GeoTIFF sense compressió (*.tif)");
+    QString selectedFilter;
+    QString filename = QFileDialog::getSaveFileName(this, title, QString(),
+                                                    tr("DATA (*.data);;NPY (*.npy);;RAW float32 + JSON (*.raw);;GeoTIFF (*.tif);;")
+                                                    + tiffUncompressed, &selectedFilter);
+    compress = selectedFilter != tiffUncompressed;
+    return filename;
+}
+
+// Loads the region plus padPoints cells around it, computes the maps of the
+// region cells with compute(grid, cellMin, cellMax) and saves map m as
+// name<suffixes[m]>.ext
+template<typename Compute>
+void MainWindow::computeRegionMaps(const QString& maps, const glm::ivec2& padPoints, double maxCells,
+                                   const std::vector<const char*>& suffixes, Compute compute)
+{
+    glm::ivec2 gridPoints = glm::ivec2(glm::ceil((gridMax - gridMin)/gridRes));
+    if (gridPoints.x <= 0 || gridPoints.y <= 0 ||
+        double(gridPoints.x + 2*padPoints.x)*double(gridPoints.y + 2*padPoints.y) > maxCells) {
+        this->ui->statusBar->showMessage("ERROR: Regió massa gran per als " + maps + "!");
+        return;
+    }
+
+    bool compress;
+    QString filename = getMapSaveFileName(tr("Desar ") + maps, compress);
+    if (filename.isEmpty()) return;
+
+    this->ui->tabWidget->setEnabled(false);
+
+    this->ui->statusBar->showMessage("Carregant tiles...");
+    glm::vec2 pad = glm::vec2(padPoints)*gridRes;
+    HeightsGrid* gridArea = tileset->loadRegion(gridMin - pad, gridMin + glm::vec2(gridPoints)*gridRes + pad,
+                                                gridRes, gridStorage, gridFilter);
+
+    this->ui->statusBar->showMessage("Calculant " + maps + "...");
+    auto regionMaps = compute(*gridArea, padPoints, padPoints + gridPoints);
+    delete gridArea;
+
+    this->ui->statusBar->showMessage("Desant " + maps + "...");
+    typedef decltype(regionMaps) Maps;
+    std::vector<float> rows;
+    for (int m = 0; m < int(suffixes.size()); m++) {
+        columnsToRows(regionMaps.getMap(typename Maps::Map(m)), gridPoints, rows);
+        saveMapRows(suffixedPath(filename.toStdString(), suffixes[m]), rows, gridPoints, gridMin, gridRes,
+                    regionMaps.getNoValue(), compress);
+    }
+
+    this->ui->statusBar->showMessage("Completat!", 5000);
+    this->ui->tabWidget->setEnabled(true);
+}
+
+void MainWindow::computeRegionStats()
+{
+    float rad = float(ui->queryStatsRad->value());
+    glm::ivec2 padPoints = glm::ivec2(glm::ceil(glm::vec2(rad)/gridRes));
+    computeRegionMaps(tr("mapes de relleu"), padPoints, 1000000000.0, { "_relleu", "_mitjana", "_desv" },
+                      [&](const HeightsGrid& grid, const glm::ivec2& cellMin, const glm::ivec2& cellMax) {
+        return LocalStats(grid, rad, cellMin, cellMax);
+    });
+}
+
+
+void MainWindow::computeRegionDerivatives()
+{
+    // five float maps of the region are kept at once, the stencils need
+    // one cell around it
+    computeRegionMaps(tr("mapes de pendent"), glm::ivec2(1), 200000000.0,
+                      { "_pendent", "_orientacio", "_curvplanta", "_curvperfil", "_tri" },
+                      [&](const HeightsGrid& grid, const glm::ivec2& cellMin, const glm::ivec2& cellMax) {
+        return TerrainDerivatives(grid, cellMin, cellMax);
+    });
+}
+
+
+void MainWindow::computeRegionHorizon()
+{
+    // the horizon is searched up to the radius beyond the region, two float
+    // maps of the region are kept
+    float rad = float(ui->queryStatsRad->value());
+    int numDirections = ui->queryHorizonDirections->value();
+    glm::ivec2 padPoints = glm::ivec2(glm::ceil(glm::vec2(rad)/gridRes));
+    computeRegionMaps(tr("mapes de cel visible"), padPoints, 500000000.0, { "_svf", "_obertura" },
+                      [&](const HeightsGrid& grid, const glm::ivec2& cellMin, const glm::ivec2& cellMax) {
+        return HorizonMaps(grid, numDirections, cellMin, cellMax);
+    });
+}
+
+
+void MainWindow::computeRegionHydrology()
+{
+    // three float maps of the region plus the watershed labels and flow
+    // receivers are kept at once
+    Hydrology::Conditioning conditioning = ui->comboHydrologyConditioning->currentIndex() == 0 ?
+                                           Hydrology::FILL : Hydrology::BREACH;
+    Hydrology::Routing routing = ui->comboHydrologyRouting->currentIndex() == 0 ? Hydrology::D8 : Hydrology::DINF;
+    computeRegionMaps(tr("mapes hidrològics"), glm::ivec2(0), 100000000.0,
+                      { "_condicionat", "_direccio", "_acumulacio" },
+                      [&](const HeightsGrid& grid, const glm::ivec2& cellMin, const glm::ivec2& cellMax) {
+        return Hydrology(grid, conditioning, routing, cellMin, cellMax);
+    });
+}
+
+
 void MainWindow::computePointIsolation()
 {
 	this->ui->tabWidget->setEnabled(false);
@@ -247,7 +579,9 @@ void MainWindow::computePointIsolation()
 	glm::vec2 pmin = p - glm::vec2(gridRad, gridRad);
 	glm::vec2 pmax = p + glm::vec2(gridRad, gridRad);
 
-	HeightsGrid* gridArea = tileset->loadRegion(pmin, pmax, tileset->getTileRes());
+	// tiles are read as the search reaches them
+	PagedHeightsGrid* gridArea = pagedTiles;
+	gridArea->setWindow(pmin, pmax);
 
 	this->ui->statusBar->showMessage("Calculant aïllament...");
 
@@ -268,7 +602,6 @@ void MainWindow::computePointIsolation()
 	ui->lineQisolResIsoX->setText(txt.sprintf("%.1f", pIso.x));
 	ui->lineQisolResIsoY->setText(txt.sprintf("%.1f", pIso.y));
 
-	delete gridArea;
 	this->ui->statusBar->showMessage("Completat!", 5000);
 	this->ui->tabWidget->setEnabled(true);
 }
@@ -280,7 +613,8 @@ void MainWindow::computePointORS()
 
 	this->ui->statusBar->showMessage("Carregant tiles...");
 	glm::vec2 p(float(ui->queryOrsX->value()), float(ui->queryOrsY->value()));
-	float gridRad = ui->queryOrsRad->value();
+	std::vector<float> radii = getORSRadii();
+	float gridRad = *std::max_element(radii.begin(), radii.end());
 	glm::vec2 pmin = p - glm::vec2(gridRad, gridRad);
 	glm::vec2 pmax = p + glm::vec2(gridRad, gridRad);
 
@@ -288,10 +622,17 @@ void MainWindow::computePointORS()
 
 	this->ui->statusBar->showMessage("Calculant ORS...");
 
-	float ors = gridArea->computeORS(p, gridRad);
+	// always exact, a pyramid of the window costs more than the single pass
+	std::vector<float> ors;
+	gridArea->computeORS(p, radii, ors);
 
-	QString txt;
-	ui->lineQorsValue->setText(txt.sprintf("%.2f", ors));
+	// main radius first, then the extra ones
+	QString txt, orsTxt;
+	orsTxt = txt.sprintf("%.2f", ors[0]);
+	for (unsigned int ri = 1; ri < ors.size(); ri++) {
+		orsTxt += txt.sprintf(" / %.2f", ors[ri]);
+	}
+	ui->lineQorsValue->setText(orsTxt);
 
 	delete gridArea;
 	this->ui->statusBar->showMessage("Completat!", 5000);
@@ -300,7 +641,8 @@ void MainWindow::computePointORS()
 
 void MainWindow::computeRegionORS()
 {
-	float rad = ui->queryOrsRad->value();
+	std::vector<float> radii = getORSRadii();
+	float rad = *std::max_element(radii.begin(), radii.end());
 	glm::vec2 pmin = glm::max(gridMin - glm::vec2(rad), tileset->getTilesetMin());
 	glm::vec2 pmax = glm::min(gridMax + glm::vec2(rad), tileset->getTilesetMax());
 	glm::ivec2 gridPoints = glm::ivec2(glm::ceil((gridMax - gridMin) / gridRes));
@@ -312,7 +654,14 @@ void MainWindow::computeRegionORS()
 	this->ui->tabWidget->setEnabled(false);
 
 	this->ui->statusBar->showMessage("Carregant tiles...");
-	HeightsGrid* gridArea = tileset->loadRegion(pmin, pmax, tileset->getTileRes());
+	HeightsGrid* gridArea = tileset->loadRegion(pmin, pmax, tileset->getTileRes(), gridStorage);
+
+	float maxError = float(ui->queryOrsMaxError->value());
+	HeightsPyramid* pyramid = nullptr;
+	if (maxError > 0) {
+		this->ui->statusBar->showMessage("Construint piràmide d'alçades...");
+		pyramid = new HeightsPyramid(*gridArea);
+	}
 
 	QString txt;
 	this->ui->statusBar->showMessage("Calculant ORS...");
@@ -321,7 +670,12 @@ void MainWindow::computeRegionORS()
 	float maxOrs = 0;
 	glm::vec2  pmaxOrs;
 	float orsSum = 0;	
-	orsGrid = std::vector<std::vector<float> >(gridPoints.x, std::vector<float>(gridPoints.y, 0));
+	orsRadii = radii;
+	orsGridMin = gridMin + glm::vec2(rad);
+	orsGridRes = gridRes;
+	orsGrid = std::vector<std::vector<std::vector<float> > >(radii.size(), 
+		std::vector<std::vector<float> >(gridPoints.x, std::vector<float>(gridPoints.y, 0)));
+	std::vector<float> orsValues;
 
 	for (int i = 0; i < gridPoints.x; i++) {
 		for (int j = 0; j < gridPoints.y; j++) {
@@ -330,8 +684,13 @@ void MainWindow::computeRegionORS()
 
 			glm::vec2 p = gridMin + glm::vec2(i + 0.5, j + 0.5)*gridRes + glm::vec2(rad);
 			
-			float ors = gridArea->computeORS(p, rad);
-			orsGrid[i][j] = ors;
+			// one pass for all the radii, the main one drives the region stats
+			if (pyramid) pyramid->computeORS(p, radii, maxError, orsValues);
+			else         gridArea->computeORS(p, radii, orsValues);
+			for (unsigned int ri = 0; ri < radii.size(); ri++) {
+				orsGrid[ri][i][j] = orsValues[ri];
+			}
+			float ors = orsValues[0];
 
 			orsSum += ors;
 			if (ors > maxOrs) {
@@ -347,31 +706,108 @@ void MainWindow::computeRegionORS()
 	ui->lineQorsResMaxY->setText(txt.sprintf("%.1f", pmaxOrs.y));
 	ui->lineQorsResMean->setText(txt.sprintf("%.2f", orsMean));
 
+	if (pyramid) delete pyramid;
 	delete gridArea;
 	this->ui->statusBar->showMessage("Completat!", 5000);
 	this->ui->tabWidget->setEnabled(true);
 	this->ui->buttonExportRegionORS->setEnabled(true);
 }
 
+void MainWindow::computeRegionTopORS()
+{
+	float rad = ui->queryOrsRad->value();
+	int topK = ui->queryOrsTopK->value();
+	glm::vec2 pmin = glm::max(gridMin - glm::vec2(rad), tileset->getTilesetMin());
+	glm::vec2 pmax = glm::min(gridMax + glm::vec2(rad), tileset->getTilesetMax());
+	glm::ivec2 gridPoints = glm::ivec2(glm::ceil((gridMax - gridMin) / gridRes));
+	if (gridPoints.x * gridPoints.y > 1000000000) {
+		this->ui->statusBar->showMessage("ERROR: Regió massa gran per al càlcul d'ORS!");
+		return;
+	}
+
+	QString filename = QFileDialog::getSaveFileName(this, tr("Desar màxims d'ORS"), QString(), tr("CSV (*.csv)"));
+	if (filename.isEmpty()) return;
+
+	this->ui->tabWidget->setEnabled(false);
+
+	this->ui->statusBar->showMessage("Carregant tiles...");
+	HeightsGrid* gridArea = tileset->loadRegion(pmin, pmax, tileset->getTileRes(), gridStorage);
+
+	this->ui->statusBar->showMessage("Construint piràmide d'alçades...");
+	HeightsPyramid* pyramid = new HeightsPyramid(*gridArea);
+
+	// same sample points as computeRegionORS
+	this->ui->statusBar->showMessage("Cercant màxims d'ORS...");
+	std::vector<glm::vec3> best;
+	int numEval = pyramid->findMaxORS(gridMin + glm::vec2(rad), gridRes, gridPoints, rad, topK, best);
+
+	TextWriter fout(filename.toStdString());
+	fout << "Posicio" << ", ";
+	fout << "X" << ", ";
+	fout << "Y" << ", ";
+	fout << "Altitud" << ", ";
+	fout << "ORS" << "\n";
+	fout.setFixed(true);
+	for (unsigned int bi = 0; bi < best.size(); bi++) {
+		glm::vec2 p(best[bi]);
+		fout.precision(0);
+		fout << bi + 1 << ", ";
+		fout << p.x << ", ";
+		fout << p.y << ", ";
+		fout << gridArea->getHeight(p) << ", ";
+		fout.precision(2);
+		fout << best[bi].z << "\n";
+	}
+	fout.close();
+
+	// the full map is not computed, so there is no mean nor export
+	QString txt;
+	if (!best.empty()) {
+		ui->lineQorsResMax->setText(txt.sprintf("%.2f", best[0].z));
+		ui->lineQorsResMaxX->setText(txt.sprintf("%.1f", best[0].x));
+		ui->lineQorsResMaxY->setText(txt.sprintf("%.1f", best[0].y));
+	}
+	ui->lineQorsResMean->setText("");
+	ui->buttonExportRegionORS->setEnabled(false);
+
+	delete pyramid;
+	delete gridArea;
+	this->ui->statusBar->showMessage(txt.sprintf("Completat! Avaluats %d de %d punts", numEval, gridPoints.x*gridPoints.y), 5000);
+	this->ui->tabWidget->setEnabled(true);
+}
+
 void MainWindow::exportRegionORS()
 {
-	QString filename = QFileDialog::getSaveFileName(this, tr("Desar ORS com a matriu"), QString(), tr("DATA (*.data)"));
+	bool compress;
+	QString filename = getMapSaveFileName(tr("Desar ORS com a matriu"), compress);
 	if (!filename.isEmpty()) {
 		ui->tabWidget->setEnabled(false);
 
 		checkGrid();
-		glm::ivec2 gridPoints = glm::vec2(orsGrid.size(), orsGrid[0].size());
 
 		this->ui->statusBar->showMessage("Desant ORS...");
-		std::ofstream fout(filename.toStdString(), std::fstream::out | std::fstream::trunc);
-		for (int y = 0; y < gridPoints.y; y++) {
-			fout << orsGrid[0][gridPoints.y - 1 - y];
-			for (int x = 1; x < gridPoints.x; x++) {
-				fout << " " << orsGrid[x][gridPoints.y - 1 - y];
+		for (unsigned int ri = 0; ri < orsGrid.size(); ri++) {
+			const std::vector<std::vector<float> >& orsMap = orsGrid[ri];
+			glm::ivec2 gridPoints = glm::vec2(orsMap.size(), orsMap[0].size());
+
+			// with several radii, each map goes to its own file: name_<radius>m.data
+			std::string path = filename.toStdString();
+			if (orsGrid.size() > 1) {
+				std::ostringstream oss;
+				oss << "_" << orsRadii[ri] << "m";
+				path = suffixedPath(path, oss.str());
+			}
+
+			// rows from north to south
+			std::vector<float> rows(size_t(gridPoints.x)*size_t(gridPoints.y));
+			for (int y = 0; y < gridPoints.y; y++) {
+				for (int x = 0; x < gridPoints.x; x++) {
+					rows[size_t(y)*gridPoints.x + x] = orsMap[x][gridPoints.y - 1 - y];
+				}
 			}
-			fout << std::endl;
+			saveMapRows(path, rows, gridPoints, orsGridMin, orsGridRes, tileset->getNoValue(),
+			            compress);
 		}
-		fout.close();
 
 		this->ui->statusBar->showMessage("Completat!", 5000);
 		ui->tabWidget->setEnabled(true);
@@ -394,7 +830,7 @@ void MainWindow::computeListStats()
             ui->tabWidget->setEnabled(false);
 
             std::fstream fin(infile.toStdString(), std::fstream::in);
-            std::fstream fout(filename.toStdString(), std::fstream::out);
+            TextWriter fout(filename.toStdString());
 
             fout << "X" << ", ";
             fout << "Y" << ", ";
@@ -406,11 +842,17 @@ void MainWindow::computeListStats()
                 fout << "Min " << radii[ri] << ", ";
                 fout << "Max " << radii[ri];
 				if (ri < NUM_RADII - 1) fout << ", ";
-				else                    fout << std::endl;
+				else                    fout << "\n";
             }
-            fout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+            fout.setFixed(true);
             fout.precision(0);
 
+            // grid, scratch memory and statistics reused by all the points
+            HeightsGrid  regionGrid;
+            QueryContext queryCtx;
+            RadialStatsPolicy stats(std::vector<float>(radii, radii + NUM_RADII));
+
+            PrefetchStats prefetchStart = tileset->getPrefetchStats();
             unsigned int pnum = 1;
             std::string line;
             while (std::getline(fin, line)) {
@@ -426,7 +868,10 @@ void MainWindow::computeListStats()
                 glm::vec2 p(px, py);
                 glm::vec2 pmin = p - glm::vec2(rad, rad);
                 glm::vec2 pmax = p + glm::vec2(rad, rad);
-                HeightsGrid* gridArea = tileset->loadRegion(pmin, pmax, tileset->getTileRes());
+                // read ahead the tiles of the next point
+                prefetchNextPoint(fin, rad);
+                HeightsGrid* gridArea = &regionGrid;
+                tileset->loadRegion(pmin, pmax, tileset->getTileRes(), regionGrid, queryCtx);
 
                 // variables
                 glm::vec3 hmin, hmax;
@@ -447,24 +892,134 @@ void MainWindow::computeListStats()
                 fout << pref.y << ", ";
                 fout << pref.z << ", ";
 
-                // get radial queries
+                // get radial queries, all radii in one pass
+                measurePass(*gridArea, pref, stats);
                 for (unsigned int ri = 0; ri < NUM_RADII; ri++) {
-                    gridArea->computeRadialStatistics(pref, radii[ri], hmin, hmax, hmean, hdev);
-                    fout << hmean << ", ";
-                    fout << hmin.z << ", ";
-					fout << hmax.z;
+                    fout << stats.getMean(ri) << ", ";
+                    fout << stats.getMin(ri).z << ", ";
+					fout << stats.getMax(ri).z;
 					if (ri < NUM_RADII - 1) fout << ", ";
-					else                    fout << std::endl;
+					else                    fout << "\n";
+                }
+
+                pnum++;
+            }
+
+            fout.close();
+            fin.close();
+            ui->tabWidget->setEnabled(true);
+            this->ui->statusBar->showMessage("Completat! " + prefetchSummary(prefetchStart), 5000);
+        }
+    }
+}
+
+
+void MainWindow::computeListReport()
+{
+    const unsigned int NUM_RADII = 9;
+    const float radii[NUM_RADII] = {50, 100, 200, 500, 1000, 2000, 5000, 10000, 25000};
+    std::vector<float> statsRadii(radii, radii + NUM_RADII);
+    std::vector<float> orsRadii = getORSRadii();
+    float refRadius = ui->queryStatsRadSummit->value();
+    bool givenHeights = ui->checkListStatsWithHeights->isChecked();
+
+    QString infile = QFileDialog::getOpenFileName(this, tr("Obrir llistat de punts"), QString(), tr("TXT (*.txt)"));
+    if (!infile.isEmpty()) {
+
+        QString filename = QFileDialog::getSaveFileName(this, tr("Desar mesures del llistat"), QString(), tr("CSV (*.csv)"));
+        if (!filename.isEmpty()) {
+            ui->tabWidget->setEnabled(false);
+
+            std::fstream fin(infile.toStdString(), std::fstream::in);
+            TextWriter fout(filename.toStdString());
+
+            fout << "X" << ", ";
+            fout << "Y" << ", ";
+            fout << "X ref" << ", ";
+            fout << "Y ref" << ", ";
+            fout << "Altitud ref" << ", ";
+            for (unsigned int ri = 0; ri < NUM_RADII; ri++) {
+                fout << "Mitja " << radii[ri] << ", ";
+                fout << "Min " << radii[ri] << ", ";
+                fout << "Max " << radii[ri] << ", ";
+            }
+            for (unsigned int ri = 0; ri < orsRadii.size(); ri++) {
+                fout << "ORS " << orsRadii[ri] << ", ";
+            }
+            fout << "Aillament" << ", ";
+            fout << "X aill" << ", ";
+            fout << "Y aill" << "\n";
+            fout.setFixed(true);
+
+            // grid, scratch memory and measures reused by all the points
+            HeightsGrid  regionGrid;
+            QueryContext queryCtx;
+            RadialStatsPolicy summit(std::vector<float>(1, refRadius));
+            RadialStatsPolicy stats(statsRadii);
+            ORSPolicy         ors(orsRadii);
+
+            PrefetchStats prefetchStart = tileset->getPrefetchStats();
+            unsigned int pnum = 1;
+            std::string line;
+            while (std::getline(fin, line)) {
+                this->ui->statusBar->showMessage("Processant punt #" + QString::number(pnum) + "...");
+
+                std::istringstream iss(line);
+                float px, py, pz;
+                iss >> px >> py;
+                if (givenHeights) iss >> pz;
+
+                // load the biggest area of all the measures
+                float rad = glm::max(radii[NUM_RADII-1], *std::max_element(orsRadii.begin(), orsRadii.end()));
+                glm::vec2 p(px, py);
+                glm::vec2 pmin = p - glm::vec2(rad, rad);
+                glm::vec2 pmax = p + glm::vec2(rad, rad);
+                // read ahead the tiles of the next point
+                prefetchNextPoint(fin, rad);
+                HeightsGrid* gridArea = &regionGrid;
+                tileset->loadRegion(pmin, pmax, tileset->getTileRes(), regionGrid, queryCtx);
+
+                // get reference point
+                glm::vec3 pref;
+                if (givenHeights) {
+                    pref = glm::vec3(px, py, pz);
+                }
+                else {
+                    measurePass(*gridArea, glm::vec3(px, py, gridArea->getHeight(p)), summit);
+                    pref = summit.getMax(0);
+                }
+
+                // all the measures around the reference point in a single sweep
+                NearestHigherPolicy isolation(rad, refRadius);
+                measurePass(*gridArea, pref, stats, ors, isolation);
+
+                fout.precision(0);
+                fout << px << ", ";
+                fout << py << ", ";
+                fout << pref.x << ", ";
+                fout << pref.y << ", ";
+                fout << pref.z << ", ";
+                for (unsigned int ri = 0; ri < NUM_RADII; ri++) {
+                    fout << stats.getMean(ri) << ", ";
+                    fout << stats.getMin(ri).z << ", ";
+                    fout << stats.getMax(ri).z << ", ";
+                }
+                fout.precision(2);
+                for (unsigned int ri = 0; ri < orsRadii.size(); ri++) {
+                    fout << ors.getORS(ri) << ", ";
                 }
+                fout.precision(0);
+                fout << isolation.getIsolation() << ", ";
+                fout << isolation.getIsolationPoint().x << ", ";
+                fout << isolation.getIsolationPoint().y << "\n";
 
-                delete gridArea;
                 pnum++;
             }
 
             fout.close();
             fin.close();
             ui->tabWidget->setEnabled(true);
-            this->ui->statusBar->showMessage("Completat!", 5000);
+            this->ui->statusBar->showMessage("Completat! " + prefetchSummary(prefetchStart), 5000);
         }
     }
 }
@@ -487,7 +1042,7 @@ void MainWindow::computeListIsolation()
 			ui->tabWidget->setEnabled(false);
 
 			std::fstream fin(infile.toStdString(), std::fstream::in);
-			std::fstream fout(filename.toStdString(), std::fstream::out);
+			TextWriter fout(filename.toStdString());
 
 			fout << "X" << ", ";
 			fout << "Y" << ", ";
@@ -502,12 +1057,17 @@ void MainWindow::computeListIsolation()
 				fout << "X aill net (+" << heightOffsets[hi] << "m), ";
 				fout << "Y aill net (+" << heightOffsets[hi] << "m)";
 				if (hi < NUM_HEIGHTS-1) fout << ", ";
-				else                    fout << std::endl;
+				else                    fout << "\n";
 			}
 
-			fout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+			fout.setFixed(true);
 			fout.precision(0);
 
+			// tiles and scratch memory reused by all the points
+			PagedHeightsGrid* gridArea = pagedTiles;
+			QueryContext queryCtx;
+
+			PrefetchStats prefetchStart = tileset->getPrefetchStats();
 			unsigned int pnum = 1;
 			std::string line;
 			while (std::getline(fin, line)) {
@@ -522,7 +1082,9 @@ void MainWindow::computeListIsolation()
 				glm::vec2 p(px, py);
 				glm::vec2 pmin = p - glm::vec2(gridRad, gridRad);
 				glm::vec2 pmax = p + glm::vec2(gridRad, gridRad);
-				HeightsGrid* gridArea = tileset->loadRegion(pmin, pmax, tileset->getTileRes());
+				// read ahead the tiles of the next point
+				prefetchNextPoint(fin, refRadius);
+				gridArea->setWindow(pmin, pmax);
 
 				// variables
 				glm::vec3 hmin, hmax;
@@ -545,29 +1107,28 @@ void MainWindow::computeListIsolation()
 
 				// get isolation
 				glm::vec3 pIso;
-				float isolation = gridArea->computeIsolation(pref, refRadius, pIso, 0, 0);
+				float isolation = gridArea->computeIsolation(pref, refRadius, pIso, 0, 0, &queryCtx);
 				fout << isolation << ",";
 				fout << pIso.x << ", ";
 				fout << pIso.y << ", ";
 
 				// get clean isolations (TODO! do it in one query)
 				for (unsigned int hi = 0; hi < NUM_HEIGHTS; hi++) {
-					float cleanIso = gridArea->computeIsolation(pref, refRadius, pIso, minIsoArea, heightOffsets[hi]);
+					float cleanIso = gridArea->computeIsolation(pref, refRadius, pIso, minIsoArea, heightOffsets[hi], &queryCtx);
 					fout << cleanIso << ",";
 					fout << pIso.x << ", ";
 					fout << pIso.y;
 					if (hi < NUM_HEIGHTS - 1) fout << ", ";
-					else                    fout << std::endl;
+					else                    fout << "\n";
 				}
 
-				delete gridArea;
 				pnum++;
 			}
 
 			fout.close();
 			fin.close();
 			ui->tabWidget->setEnabled(true);
-			this->ui->statusBar->showMessage("Completat!", 5000);
+			this->ui->statusBar->showMessage("Completat! " + prefetchSummary(prefetchStart), 5000);
 		}
 	}
 }
@@ -575,7 +1136,8 @@ void MainWindow::computeListIsolation()
 
 void MainWindow::computeListORS()
 {
-	float refRadius = ui->queryOrsRad->value();
+	std::vector<float> radii = getORSRadii();
+	float refRadius = *std::max_element(radii.begin(), radii.end());
 	bool givenHeights = ui->checkListStatsWithHeights->isChecked();
 
 	QString infile = QFileDialog::getOpenFileName(this, tr("Obrir llistat de punts"), QString(), tr("TXT (*.txt)"));
@@ -586,18 +1148,27 @@ void MainWindow::computeListORS()
 			ui->tabWidget->setEnabled(false);
 
 			std::fstream fin(infile.toStdString(), std::fstream::in);
-			std::fstream fout(filename.toStdString(), std::fstream::out);
+			TextWriter fout(filename.toStdString());
 
 			fout << "X" << ", ";
 			fout << "Y" << ", ";
 			fout << "X ref" << ", ";
 			fout << "Y ref" << ", ";
 			fout << "Altitud" << ", ";
-			fout << "ORS" << std::endl;
+			fout << "ORS";
+			for (unsigned int ri = 1; ri < radii.size(); ri++) {
+				fout << ", " << "ORS " << radii[ri];
+			}
+			fout << "\n";
 
-			fout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+			fout.setFixed(true);
 			fout.precision(0);
 
+			// grid and scratch memory reused by all the points
+			HeightsGrid  regionGrid;
+			QueryContext queryCtx;
+
+			PrefetchStats prefetchStart = tileset->getPrefetchStats();
 			unsigned int pnum = 1;
 			std::string line;
 			while (std::getline(fin, line)) {
@@ -613,7 +1184,10 @@ void MainWindow::computeListORS()
 				glm::vec2 p(px, py);
 				glm::vec2 pmin = p - glm::vec2(rad, rad);
 				glm::vec2 pmax = p + glm::vec2(rad, rad);
-				HeightsGrid* gridArea = tileset->loadRegion(pmin, pmax, tileset->getTileRes());
+				// read ahead the tiles of the next point
+				prefetchNextPoint(fin, rad);
+				HeightsGrid* gridArea = &regionGrid;
+				tileset->loadRegion(pmin, pmax, tileset->getTileRes(), regionGrid, queryCtx);
 
 				// variables
 				glm::vec3 pref;
@@ -631,23 +1205,178 @@ void MainWindow::computeListORS()
 				fout << pref.y << ", ";
 				fout << pref.z << ", ";
 
-				// get ors
-				float ors = gridArea->computeORS(pref, rad);
-				fout << ors << std::endl;
+				// get ors for all radii at once, exact as the point query
+				std::vector<float> ors;
+				gridArea->computeORS(pref, radii, ors);
+				fout << ors[0];
+				for (unsigned int ri = 1; ri < ors.size(); ri++) {
+					fout << ", " << ors[ri];
+				}
+				fout << "\n";
 
-				delete gridArea;
 				pnum++;
 			}
 
 			fout.close();
 			fin.close();
 			ui->tabWidget->setEnabled(true);
-			this->ui->statusBar->showMessage("Completat!", 5000);
+			this->ui->statusBar->showMessage("Completat! " + prefetchSummary(prefetchStart), 5000);
 		}
 	}
 }
 
 
+void MainWindow::computePointViewshed()
+{
+	this->ui->tabWidget->setEnabled(false);
+
+	this->ui->statusBar->showMessage("Carregant tiles...");
+	glm::vec2 p(float(ui->queryViewshedX->value()), float(ui->queryViewshedY->value()));
+	float rad = float(ui->queryViewshedRad->value());
+	HeightsGrid* gridArea = tileset->loadRegion(p - glm::vec2(rad), p + glm::vec2(rad), tileset->getTileRes());
+
+	this->ui->statusBar->showMessage("Calculant visibilitat...");
+	if (viewshed) delete viewshed;
+	viewshed = new Viewshed(*gridArea, glm::vec3(p, gridArea->getHeight(p)), rad,
+	                        float(ui->queryViewshedObserver->value()), float(ui->queryViewshedTarget->value()),
+	                        float(ui->queryViewshedRefraction->value()));
+
+	QString txt;
+	ui->lineQviewshedArea->setText(txt.sprintf("%.2f", viewshed->getVisibleArea()*1e-6f));
+	ui->lineQviewshedFraction->setText(txt.sprintf("%.1f", 100*viewshed->getVisibleFraction()));
+	ui->lineQviewshedMaxDist->setText(txt.sprintf("%.0f", viewshed->getMaxVisibleDistance()));
+
+	delete gridArea;
+	this->ui->statusBar->showMessage("Completat!", 5000);
+	this->ui->tabWidget->setEnabled(true);
+	this->ui->buttonExportPointViewshed->setEnabled(true);
+}
+
+void MainWindow::exportPointViewshed()
+{
+	bool compress;
+	QString filename = getMapSaveFileName(tr("Desar visibilitat com a matriu"), compress);
+	if (!filename.isEmpty() && viewshed) {
+		ui->tabWidget->setEnabled(false);
+		this->ui->statusBar->showMessage("Desant visibilitat...");
+
+		std::vector<float> rows;
+		columnsToRows(viewshed->getMap(), viewshed->getSize(), rows);
+		saveMapRows(filename.toStdString(), rows, viewshed->getSize(), viewshed->getMapMin(), viewshed->getMapRes(),
+		            viewshed->getNoValue(), compress);
+
+		this->ui->statusBar->showMessage("Completat!", 5000);
+		ui->tabWidget->setEnabled(true);
+	}
+}
+
+void MainWindow::computePointHorizon()
+{
+	QString filename = QFileDialog::getSaveFileName(this, tr("Desar perfil d'horitzó"), QString(), tr("CSV (*.csv)"));
+	if (filename.isEmpty()) return;
+
+	this->ui->tabWidget->setEnabled(false);
+
+	this->ui->statusBar->showMessage("Carregant tiles...");
+	glm::vec2 p(float(ui->queryViewshedX->value()), float(ui->queryViewshedY->value()));
+	float rad = float(ui->queryViewshedRad->value());
+	HeightsGrid* gridArea = tileset->loadRegion(p - glm::vec2(rad), p + glm::vec2(rad), tileset->getTileRes());
+
+	// one direction per degree
+	this->ui->statusBar->showMessage("Calculant perfil d'horitzó...");
+	const int NUM_DIRECTIONS = 360;
+	glm::vec3 eye(p, gridArea->getHeight(p) + float(ui->queryViewshedObserver->value()));
+	std::vector<float> angles, distances;
+	HorizonMaps::computeProfile(*gridArea, eye, rad, NUM_DIRECTIONS, float(ui->queryViewshedRefraction->value()),
+	                            angles, distances);
+	delete gridArea;
+
+	TextWriter fout(filename.toStdString());
+	fout << "Azimut" << ", ";
+	fout << "Angle" << ", ";
+	fout << "Distancia" << "\n";
+	fout.setFixed(true);
+	for (int d = 0; d < NUM_DIRECTIONS; d++) {
+		fout.precision(1);
+		fout << 360.0f*d/NUM_DIRECTIONS << ", ";
+		fout.precision(3);
+		fout << angles[d] << ", ";
+		fout.precision(0);
+		fout << distances[d] << "\n";
+	}
+	fout.close();
+
+	this->ui->statusBar->showMessage("Completat!", 5000);
+	this->ui->tabWidget->setEnabled(true);
+}
+
+void MainWindow::computeListViewshed()
+{
+	float rad = float(ui->queryViewshedRad->value());
+	float observerHeight = float(ui->queryViewshedObserver->value());
+	float targetHeight = float(ui->queryViewshedTarget->value());
+	float refraction = float(ui->queryViewshedRefraction->value());
+	bool givenHeights = ui->checkListViewshedWithHeights->isChecked();
+
+	QString infile = QFileDialog::getOpenFileName(this, tr("Obrir llistat de punts"), QString(), tr("TXT (*.txt)"));
+	if (infile.isEmpty()) return;
+	QString filename = QFileDialog::getSaveFileName(this, tr("Desar mesures del llistat"), QString(), tr("CSV (*.csv)"));
+	if (filename.isEmpty()) return;
+
+	ui->tabWidget->setEnabled(false);
+
+	std::fstream fin(infile.toStdString(), std::fstream::in);
+	TextWriter fout(filename.toStdString());
+	fout << "X" << ", ";
+	fout << "Y" << ", ";
+	fout << "Altitud" << ", ";
+	fout << "Area visible (km2)" << ", ";
+	fout << "Visible (%)" << ", ";
+	fout << "Dist max visible" << "\n";
+	fout.setFixed(true);
+
+	// grid and scratch memory reused by all the points
+	HeightsGrid  regionGrid;
+	QueryContext queryCtx;
+
+	PrefetchStats prefetchStart = tileset->getPrefetchStats();
+	unsigned int pnum = 1;
+	std::string line;
+	while (std::getline(fin, line)) {
+		this->ui->statusBar->showMessage("Processant punt #" + QString::number(pnum) + "...");
+
+		std::istringstream iss(line);
+		float px, py, pz;
+		iss >> px >> py;
+		if (givenHeights) iss >> pz;
+
+		glm::vec2 p(px, py);
+		prefetchNextPoint(fin, rad);
+		tileset->loadRegion(p - glm::vec2(rad), p + glm::vec2(rad), tileset->getTileRes(), regionGrid, queryCtx);
+		if (!givenHeights) pz = regionGrid.getHeight(p);
+
+		Viewshed vs(regionGrid, glm::vec3(p, pz), rad, observerHeight, targetHeight, refraction);
+		fout.precision(0);
+		fout << px << ", ";
+		fout << py << ", ";
+		fout << pz << ", ";
+		fout.precision(2);
+		fout << vs.getVisibleArea()*1e-6f << ", ";
+		fout.precision(1);
+		fout << 100*vs.getVisibleFraction() << ", ";
+		fout.precision(0);
+		fout << vs.getMaxVisibleDistance() << "\n";
+
+		pnum++;
+	}
+
+	fout.close();
+	fin.close();
+	ui->tabWidget->setEnabled(true);
+	this->ui->statusBar->showMessage("Completat! " + prefetchSummary(prefetchStart), 5000);
+}
+
+
 void MainWindow::selectPoint()
 {
 	ui->buttonClickPointStats->setEnabled(false);
@@ -666,6 +1395,8 @@ void MainWindow::pointSelected()
 	ui->queryIsolY->setValue(p.y);
 	ui->queryOrsX->setValue(p.x);
 	ui->queryOrsY->setValue(p.y);
+	ui->queryViewshedX->setValue(p.x);
+	ui->queryViewshedY->setValue(p.y);
 }
 
 void MainWindow::centerViewToRadialStats()
@@ -689,6 +1420,13 @@ void MainWindow::centerViewToORS()
 	ui->viewRadius->setValue(ui->queryOrsRad->value());
 }
 
+void MainWindow::centerViewToViewshed()
+{
+	ui->viewX->setValue(ui->queryViewshedX->value());
+	ui->viewY->setValue(ui->queryViewshedY->value());
+	ui->viewRadius->setValue(ui->queryViewshedRad->value());
+}
+
 
 void MainWindow::toggleShowRegion(bool b)
 {
@@ -707,12 +1445,30 @@ void MainWindow::setSeaLevel(int v)
     ui->spinSeaLevel->setValue(double(v));
 }
 
+std::vector<float> MainWindow::getORSRadii() const
+{
+    // main radius first, then the extra ones typed by the user
+    std::vector<float> radii(1, float(ui->queryOrsRad->value()));
+    std::string extra = ui->queryOrsExtraRadii->text().toStdString();
+    std::replace(extra.begin(), extra.end(), ',', ' ');
+    std::replace(extra.begin(), extra.end(), ';', ' ');
+    std::istringstream iss(extra);
+    float r;
+    while (iss >> r) {
+        if (r > 0 && std::find(radii.begin(), radii.end(), r) == radii.end()) {
+            radii.push_back(r);
+        }
+    }
+    return radii;
+}
+
 void MainWindow::checkGrid()
 {
     if (dirtyGrid) {
+        // moving the borders only reads the strips that were not loaded
         this->ui->statusBar->showMessage("Carregant tiles de la regió seleccionada...");
-        if (grid) delete grid;
-        grid = tileset->loadRegion(gridMin, gridMax, gridRes);
+        if (!grid) grid = new HeightsGrid();
+        tileset->reloadRegion(gridMin, gridMax, gridRes, *grid, QueryContext::threadContext(), gridStorage, gridFilter);
         dirtyGrid = false;
     }
 }
@@ -720,7 +1476,7 @@ void MainWindow::checkGrid()
 void MainWindow::emitUpdatedRegion()
 {
     glm::ivec2 gridPoints = glm::ivec2(glm::ceil((gridMax - gridMin)/gridRes));
-    float megas = float(gridPoints.x)*float(gridPoints.y)*sizeof(float)/float(1024*1024);
+    float megas = float(gridPoints.x)*float(gridPoints.y)*HeightsGrid::getBytesPerHeight(gridStorage)/float(1024*1024);
 
     QString txt;
     emit changedGridWidth(txt.sprintf("%.1f km", (gridMax.x - gridMin.x)/1000.0f));
@@ -742,3 +1498,28 @@ void MainWindow::emitUpdatedRegion()
     ui->glWidget->setRegion(gridMin, gridMax);
 	ui->buttonExportRegionORS->setEnabled(false);
 }
+
+void MainWindow::prefetchNextPoint(std::istream& fin, float rad)
+{
+    // peek the next line of the list and queue the tiles around it
+    std::streampos pos = fin.tellg();
+    std::string line;
+    if (std::getline(fin, line)) {
+        std::istringstream iss(line);
+        float px, py;
+        if (iss >> px >> py) {
+            glm::vec2 p(px, py);
+            tileset->prefetchRegion(p - glm::vec2(rad, rad), p + glm::vec2(rad, rad));
+        }
+    }
+    fin.clear();
+    fin.seekg(pos);
+}
+
+QString MainWindow::prefetchSummary(const PrefetchStats& since) const
+{
+    PrefetchStats now = tileset->getPrefetchStats();
+    return "Tiles avançades: " + QString::number(now.hits - since.hits) + " a temps, " +
+           QString::number(now.late - since.late) + " tard, " +
+           QString::number(now.misses - since.misses) + " sense avançar";
+}
@@ -4,6 +4,8 @@
 #include <QMainWindow>
 #include "heightstileset.h"
 #include "heightsgrid.h"
+#include "pagedheightsgrid.h"
+#include "viewshed.h"
 #include "glm/glm.hpp"
 
 
@@ -26,13 +28,21 @@ public slots:
     void setGridXmax(double);
     void setGridYmax(double);
     void setGridResolution(double);
+    void setGridStorage(int);
+    void setGridFilter(int);
     void saveGridELV();
     void saveGridPLY();
     void saveGridDATA();
+    void saveGridContours();
 
     // height radial stats
 	void computeRadialStats();
+	void computeRegionStats();
+	void computeRegionDerivatives();
+	void computeRegionHorizon();
+	void computeRegionHydrology();
 	void computeListStats();
+	void computeListReport();
 
 	// isolations
 	void computePointIsolation();
@@ -41,15 +51,23 @@ public slots:
 	// ORS
 	void computePointORS();
 	void computeRegionORS();
+	void computeRegionTopORS();
 	void computeListORS();
 	void exportRegionORS();
 
+	// visibility
+	void computePointViewshed();
+	void computeListViewshed();
+	void exportPointViewshed();
+	void computePointHorizon();
+
 	// point selection
 	void selectPoint();
 	void pointSelected();
 	void centerViewToRadialStats();
 	void centerViewToIsolation();
 	void centerViewToORS();
+	void centerViewToViewshed();
 
     // render
     void toggleShowRegion(bool);
@@ -66,16 +84,30 @@ signals:
 private:
     void checkGrid();
     void emitUpdatedRegion();
+    std::vector<float> getORSRadii() const;
+    void prefetchNextPoint(std::istream& fin, float rad);
+    QString prefetchSummary(const PrefetchStats& since) const;
+    QString getMapSaveFileName(const QString& title, bool& compress);
+    template<typename Compute>
+    void computeRegionMaps(const QString& maps, const glm::ivec2& padPoints, double maxCells,
+                           const std::vector<const char*>& suffixes, Compute compute);
 
 private:
     Ui::MainWindow *ui;
 
     HeightsTileset* tileset;
+    PagedHeightsGrid* pagedTiles;
     HeightsGrid* grid;
     glm::vec2 gridMin, gridMax, gridRes;
+    HeightsGrid::Storage gridStorage;
+    ResampleFilter gridFilter;
     bool dirtyGrid;
 
-	std::vector<std::vector<float> > orsGrid;
+	std::vector<float> orsRadii;
+	std::vector<std::vector<std::vector<float> > > orsGrid;
+	glm::vec2 orsGridMin, orsGridRes;     // cell (0, 0) of the maps and their spacing
+
+	Viewshed* viewshed;                   // last point visibility, for the export
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,85 @@
+#include "mappedfile.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+MappedFile::MappedFile()
+{
+    base = nullptr;
+    length = 0;
+    handle = nullptr;
+    mapping = nullptr;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(h, &fsize) || fsize.QuadPart == 0) {
+        CloseHandle(h);
+        return false;
+    }
+    HANDLE m = CreateFileMappingA(h, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m) {
+        CloseHandle(h);
+        return false;
+    }
+    const void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(m);
+        CloseHandle(h);
+        return false;
+    }
+    handle = h;
+    mapping = m;
+    length = std::size_t(fsize.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+    // read once from start to end, ahead of the first accesses
+    madvise(view, std::size_t(st.st_size), MADV_SEQUENTIAL);
+    madvise(view, std::size_t(st.st_size), MADV_WILLNEED);
+    length = std::size_t(st.st_size);
+#endif
+    base = static_cast<const char*>(view);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (!base) return;
+#ifdef _WIN32
+    UnmapViewOfFile(base);
+    CloseHandle(HANDLE(mapping));
+    CloseHandle(HANDLE(handle));
+#else
+    munmap(const_cast<char*>(base), length);
+#endif
+    base = nullptr;
+    length = 0;
+    handle = nullptr;
+    mapping = nullptr;
+}
@@ -0,0 +1,42 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+#include <string>
+#include <cstddef>
+
+// Whole file mapped read only, so its contents can be used in place
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+
+    const char* data() const;
+    std::size_t size() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* base;
+    std::size_t length;
+    void*       handle;     // file and mapping HANDLEs on Windows
+    void*       mapping;
+};
+
+inline bool MappedFile::isOpen() const {
+    return base != nullptr;
+}
+
+inline const char* MappedFile::data() const {
+    return base;
+}
+
+inline std::size_t MappedFile::size() const {
+    return length;
+}
+
+#endif // MAPPEDFILE_H
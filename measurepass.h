@@ -0,0 +1,380 @@
+#ifndef MEASUREPASS_H
+#define MEASUREPASS_H
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+// Fused traversal of the disk around a point of a HeightsGrid, or of any grid
+// with the same getters and at(i, j), such as PagedHeightsGrid. Every policy
+// sees each cell of the window of the largest radius once, and the set of
+// policies is fixed at compile time, e.g.
+//
+//   RadialStatsPolicy stats(radii);
+//   ORSPolicy ors(orsRadii);
+//   measurePass(grid, p, stats, ors);
+//
+// A policy provides:
+//   float getRadius() const;                           disk radius it needs
+//   template<typename Grid> void begin(const Grid& grid, const glm::vec3& p);
+//   void  add(int i, int j, float h, float dist);      dist to the cell center
+//   void  end();
+//
+// Each policy applies the same cell conditions as its standalone query, so
+// results are the same as running the queries one by one.
+template<typename Grid, typename... Policies>
+void measurePass(const Grid& grid, const glm::vec3& p, Policies&... policies)
+{
+    float radius = 0;
+    float radii[] = {0.0f, policies.getRadius()...};
+    for (float r : radii) radius = glm::max(radius, r);
+
+    int beginAll[] = {0, (policies.begin(grid, p), 0)...};
+    (void)beginAll;
+
+    glm::vec2  gridMin = grid.getGridMin();
+    glm::vec2  gridRes = grid.getGridRes();
+    glm::vec2  p_xy = glm::vec2(p);
+    glm::ivec2 pcoords = glm::ivec2((p_xy - gridMin)/gridRes);
+    glm::ivec2 radOff = glm::ivec2(glm::ceil(glm::vec2(radius)/gridRes));
+    glm::ivec2 ijMin = glm::max(pcoords - radOff, glm::ivec2(0));
+    glm::ivec2 ijMax = glm::min(pcoords + radOff, grid.getGridSize());
+
+    for (int i = ijMin.x; i < ijMax.x; i++) {
+        for (int j = ijMin.y; j < ijMax.y; j++) {
+            glm::vec2 pij = gridMin + glm::vec2(i + 0.5f, j + 0.5f)*gridRes;
+            float dist = glm::distance(pij, p_xy);
+            if (dist <= radius) {
+                float h = grid.at(i, j);
+                int addAll[] = {0, (policies.add(i, j, h, dist), 0)...};
+                (void)addAll;
+            }
+        }
+    }
+
+    int endAll[] = {0, (policies.end(), 0)...};
+    (void)endAll;
+}
+
+// HeightsGrid runs the pass on the view of its storage type
+template<typename... Policies>
+void measurePass(const HeightsGrid& grid, const glm::vec3& p, Policies&... policies)
+{
+    grid.visit([&](const auto& view) { measurePass(view, p, policies...); });
+}
+
+
+// Radii sorted in increasing order, with the window each one would scan on
+// its own. Cells go to the first annulus that contains them.
+class MeasureAnnuli
+{
+public:
+    MeasureAnnuli(const std::vector<float>& radii);
+
+    // new radii, reusing the memory of the previous ones
+    void  setRadii(const float* r, int n);
+
+    float getRadius() const;
+    int   getNumAnnuli() const;
+    int   getAnnulus(int sortedIndex) const;
+
+    template<typename Grid>
+    void  begin(const Grid& grid, const glm::vec3& p);
+    int   findAnnulus(int i, int j, float dist) const;
+
+private:
+    std::vector<float>      radii, sortedRadii;
+    std::vector<glm::ivec2> radiiOff;
+    glm::ivec2              pcoords;
+};
+
+inline MeasureAnnuli::MeasureAnnuli(const std::vector<float>& radii)
+{
+    setRadii(radii.data(), int(radii.size()));
+}
+
+inline void MeasureAnnuli::setRadii(const float* r, int n)
+{
+    radii.assign(r, r + n);
+    sortedRadii.assign(r, r + n);
+    std::sort(sortedRadii.begin(), sortedRadii.end());
+    radiiOff.resize(sortedRadii.size());
+}
+
+inline float MeasureAnnuli::getRadius() const {
+    return sortedRadii.empty() ? 0.0f : sortedRadii.back();
+}
+
+inline int MeasureAnnuli::getNumAnnuli() const {
+    return int(sortedRadii.size());
+}
+
+inline int MeasureAnnuli::getAnnulus(int r) const {
+    return int(std::lower_bound(sortedRadii.begin(), sortedRadii.end(), radii[r]) - sortedRadii.begin());
+}
+
+template<typename Grid>
+inline void MeasureAnnuli::begin(const Grid& grid, const glm::vec3& p) {
+    pcoords = glm::ivec2((glm::vec2(p) - grid.getGridMin())/grid.getGridRes());
+    for (size_t k = 0; k < sortedRadii.size(); k++) {
+        radiiOff[k] = glm::ivec2(glm::ceil(glm::vec2(sortedRadii[k])/grid.getGridRes()));
+    }
+}
+
+inline int MeasureAnnuli::findAnnulus(int i, int j, float dist) const {
+    int k = int(std::lower_bound(sortedRadii.begin(), sortedRadii.end(), dist) - sortedRadii.begin());
+    while (k < int(radiiOff.size()) && (i >= pcoords.x + radiiOff[k].x || j >= pcoords.y + radiiOff[k].y)) k++;
+    return k;
+}
+
+
+// Height min, max, mean and deviation, as computeRadialStatistics
+class RadialStatsPolicy
+{
+public:
+    RadialStatsPolicy(const std::vector<float>& radii);
+
+    // a policy kept between queries with new radii does not allocate again
+    void  setRadii(const float* r, int n);
+
+    float getRadius() const;
+    template<typename Grid>
+    void  begin(const Grid& grid, const glm::vec3& p);
+    void  add(int i, int j, float h, float dist);
+    void  end();
+
+    glm::vec3 getMin(int r) const;
+    glm::vec3 getMax(int r) const;
+    float     getMean(int r) const;
+    float     getStdev(int r) const;
+
+private:
+    struct Extreme {
+        float h;
+        long long order;    // scan order, the first cell found wins ties
+        glm::vec3 pos;
+    };
+    struct Stats {
+        Extreme hmin, hmax;
+        double hsum, ssum;
+        int N;
+    };
+
+    MeasureAnnuli      annuli;
+    std::vector<Stats> annulusStats, radiusStats;
+    glm::vec2          gridMin, gridRes;
+    int                gridSizeY;
+};
+
+inline RadialStatsPolicy::RadialStatsPolicy(const std::vector<float>& radii) : annuli(radii) {
+}
+
+inline void RadialStatsPolicy::setRadii(const float* r, int n) {
+    annuli.setRadii(r, n);
+}
+
+inline float RadialStatsPolicy::getRadius() const {
+    return annuli.getRadius();
+}
+
+template<typename Grid>
+inline void RadialStatsPolicy::begin(const Grid& grid, const glm::vec3& p) {
+    annuli.begin(grid, p);
+    gridMin = grid.getGridMin();
+    gridRes = grid.getGridRes();
+    gridSizeY = grid.getGridSize().y;
+
+    // the query point starts as min and max and wins ties
+    Stats s;
+    s.hmin.h = s.hmax.h = p.z;
+    s.hmin.order = s.hmax.order = -1;
+    s.hmin.pos = s.hmax.pos = p;
+    s.hsum = s.ssum = 0;
+    s.N = 0;
+    annulusStats.assign(annuli.getNumAnnuli(), s);
+    for (Stats& a : annulusStats) {
+        a.hmin.h = std::numeric_limits<float>::max();
+        a.hmax.h = -std::numeric_limits<float>::max();
+    }
+    radiusStats.assign(annuli.getNumAnnuli(), s);
+}
+
+inline void RadialStatsPolicy::add(int i, int j, float h, float dist) {
+    if (h < 0) return;
+    int k = annuli.findAnnulus(i, j, dist);
+    if (k >= annuli.getNumAnnuli()) return;
+
+    Stats& a = annulusStats[k];
+    long long order = (long long)(i)*gridSizeY + j;
+    if (h < a.hmin.h) {
+        a.hmin.h = h;
+        a.hmin.order = order;
+        a.hmin.pos = glm::vec3(gridMin.x + i*gridRes.x, gridMin.y + j*gridRes.y, h);
+    }
+    if (h > a.hmax.h) {
+        a.hmax.h = h;
+        a.hmax.order = order;
+        a.hmax.pos = glm::vec3(gridMin.x + i*gridRes.x, gridMin.y + j*gridRes.y, h);
+    }
+    double hd = static_cast<double>(h);
+    a.hsum += hd;
+    a.ssum += hd*hd;
+    a.N++;
+}
+
+inline void RadialStatsPolicy::end() {
+    // each radius merges all the annuli inside it
+    for (int k = 0; k < annuli.getNumAnnuli(); k++) {
+        Stats& s = radiusStats[k];
+        if (k > 0) s = radiusStats[k - 1];
+        const Stats& a = annulusStats[k];
+        if (a.N == 0) continue;
+        if (a.hmin.h < s.hmin.h || (a.hmin.h == s.hmin.h && a.hmin.order < s.hmin.order)) s.hmin = a.hmin;
+        if (a.hmax.h > s.hmax.h || (a.hmax.h == s.hmax.h && a.hmax.order < s.hmax.order)) s.hmax = a.hmax;
+        s.hsum += a.hsum;
+        s.ssum += a.ssum;
+        s.N += a.N;
+    }
+}
+
+inline glm::vec3 RadialStatsPolicy::getMin(int r) const {
+    return radiusStats[annuli.getAnnulus(r)].hmin.pos;
+}
+
+inline glm::vec3 RadialStatsPolicy::getMax(int r) const {
+    return radiusStats[annuli.getAnnulus(r)].hmax.pos;
+}
+
+inline float RadialStatsPolicy::getMean(int r) const {
+    const Stats& s = radiusStats[annuli.getAnnulus(r)];
+    return float(s.hsum/double(s.N));
+}
+
+inline float RadialStatsPolicy::getStdev(int r) const {
+    const Stats& s = radiusStats[annuli.getAnnulus(r)];
+    return float(glm::sqrt((s.ssum - s.hsum*s.hsum/double(s.N))/double(s.N - 1)));
+}
+
+
+// Overall Relative Size, as computeORS
+class ORSPolicy
+{
+public:
+    ORSPolicy(const std::vector<float>& radii);
+
+    float getRadius() const;
+    template<typename Grid>
+    void  begin(const Grid& grid, const glm::vec3& p);
+    void  add(int i, int j, float h, float dist);
+    void  end();
+
+    float getORS(int r) const;
+
+private:
+    MeasureAnnuli       annuli;
+    std::vector<double> integral;
+    double h0, dA, minDist;
+    float  noValue;
+};
+
+inline ORSPolicy::ORSPolicy(const std::vector<float>& radii) : annuli(radii) {
+}
+
+inline float ORSPolicy::getRadius() const {
+    return annuli.getRadius();
+}
+
+template<typename Grid>
+inline void ORSPolicy::begin(const Grid& grid, const glm::vec3& p) {
+    annuli.begin(grid, p);
+    integral.assign(annuli.getNumAnnuli(), 0.0);
+    h0 = p.z;
+    dA = grid.getGridRes().x*grid.getGridRes().y;
+    minDist = 0.1*grid.getGridRes().x;
+    noValue = grid.getGridNoValue();
+}
+
+inline void ORSPolicy::add(int i, int j, float h, float dist) {
+    // higher ground does not contribute
+    if (dist <= minDist || h < noValue || h > h0) return;
+    int k = annuli.findAnnulus(i, j, dist);
+    if (k >= annuli.getNumAnnuli()) return;
+    double f2 = slopeNormalization((h0 - double(h))/dist);
+    integral[k] += glm::max(f2*dA, 0.0);
+}
+
+inline void ORSPolicy::end() {
+    for (size_t k = 1; k < integral.size(); k++) {
+        integral[k] += integral[k - 1];
+    }
+}
+
+inline float ORSPolicy::getORS(int r) const {
+    return float(sqrt(integral[annuli.getAnnulus(r)]));
+}
+
+
+// Closest cell higher than the point (plus an offset) and at least minDist
+// away. It is the isolation whenever it lies inside the disk, otherwise the
+// isolation is larger than the radius.
+class NearestHigherPolicy
+{
+public:
+    NearestHigherPolicy(float radius, float minDist, float hOffset = 0);
+
+    float getRadius() const;
+    template<typename Grid>
+    void  begin(const Grid& grid, const glm::vec3& p);
+    void  add(int i, int j, float h, float dist);
+    void  end();
+
+    float     getIsolation() const;
+    glm::vec3 getIsolationPoint() const;
+
+private:
+    float      radius, minDist, hOffset;
+    float      ph, bestDist;
+    glm::vec3  bestPoint;
+    glm::vec2  gridMin, gridRes;
+    glm::ivec2 ijMax;
+};
+
+inline NearestHigherPolicy::NearestHigherPolicy(float radius, float minDist, float hOffset)
+    : radius(radius), minDist(minDist), hOffset(hOffset) {
+}
+
+inline float NearestHigherPolicy::getRadius() const {
+    return radius;
+}
+
+template<typename Grid>
+inline void NearestHigherPolicy::begin(const Grid& grid, const glm::vec3& p) {
+    gridMin = grid.getGridMin();
+    gridRes = grid.getGridRes();
+    glm::ivec2 pcoords = glm::ivec2((glm::vec2(p) - gridMin)/gridRes);
+    ijMax = pcoords + glm::ivec2(glm::ceil(glm::vec2(radius)/gridRes));
+    ph = p.z + hOffset;
+    bestDist = std::numeric_limits<float>::max();
+    bestPoint = p;
+}
+
+inline void NearestHigherPolicy::add(int i, int j, float h, float dist) {
+    if (h > ph && dist >= minDist && dist < bestDist && dist <= radius && i < ijMax.x && j < ijMax.y) {
+        bestDist = dist;
+        bestPoint = glm::vec3(gridMin.x + (i + 0.5f)*gridRes.x, gridMin.y + (j + 0.5f)*gridRes.y, h);
+    }
+}
+
+inline void NearestHigherPolicy::end() {
+}
+
+inline float NearestHigherPolicy::getIsolation() const {
+    return bestDist <= radius ? bestDist : -1;
+}
+
+inline glm::vec3 NearestHigherPolicy::getIsolationPoint() const {
+    return bestPoint;
+}
+
+#endif // MEASUREPASS_H
@@ -0,0 +1,122 @@
+#include "pagedheightsgrid.h"
+#include "measurepass.h"
+#include "isolationsearch.h"
+#include <limits>
+
+
+PagedHeightsGrid::PagedHeightsGrid(const HeightsTileset& tileset, std::size_t maxResidentBytes)
+    : tileset(tileset)
+{
+    tsetMin = tileset.getTilesetMin();
+    gridRes = tileset.getTileRes();
+    gridNoValue = tileset.getNoValue();
+    pageSize = tileset.getPointsPerTile();
+    numPages = tileset.getNumTiles();
+
+    std::size_t pageBytes = std::size_t(pageSize.x)*std::size_t(pageSize.y)*sizeof(float);
+    maxPages = int(glm::max(maxResidentBytes/pageBytes, std::size_t(1)));
+
+    tileMax.assign(numPages.x*numPages.y, std::numeric_limits<float>::max());
+    if (tileset.hasManifest()) {
+        for (int ti = 0; ti < numPages.x; ti++) {
+            for (int tj = 0; tj < numPages.y; tj++) {
+                TileSummary s = tileset.getTileSummary(ti, tj);
+                tileMax[ti*numPages.y + tj] = s.exists ? s.hmax : gridNoValue;
+            }
+        }
+    }
+
+    pageOf.assign(numPages.x*numPages.y, -1);
+    useClock = 0;
+    numLoads = 0;
+    lastTile = -1;
+    lastData = nullptr;
+
+    setWindow(tileset.getTilesetMin(), tileset.getTilesetMax());
+}
+
+void PagedHeightsGrid::setWindow(const glm::vec2& wmin, const glm::vec2& wmax)
+{
+    glm::ivec2 tsetSize = glm::ivec2(tileset.getTilesetExtension()/gridRes);
+    gridOffset = glm::clamp(glm::ivec2(glm::floor((wmin - tsetMin)/gridRes)), glm::ivec2(0), tsetSize);
+    glm::ivec2 gridEnd = glm::clamp(glm::ivec2(glm::floor((wmax - tsetMin)/gridRes)), gridOffset, tsetSize);
+    gridSize = gridEnd - gridOffset;
+    gridMin = tsetMin + glm::vec2(gridOffset)*gridRes;
+    gridMax = tsetMin + glm::vec2(gridEnd)*gridRes;
+}
+
+void PagedHeightsGrid::pageIn(int tile) const
+{
+    int slot = pageOf[tile];
+    if (slot < 0) {
+        if (int(pages.size()) < maxPages) {
+            slot = int(pages.size());
+            pages.push_back(Page());
+        }
+        else {
+            // evict the least recently used tile, its memory is reused
+            slot = 0;
+            for (int s = 1; s < int(pages.size()); s++) {
+                if (pages[s].lastUse < pages[slot].lastUse) slot = s;
+            }
+            pageOf[pages[slot].tile] = -1;
+        }
+
+        // same placement of the tile samples as HeightsTileset::loadRegion
+        QueryContext& ctx = QueryContext::threadContext();
+        int ti = tile/numPages.y;
+        int tj = tile%numPages.y;
+        tileset.readTile(ti, tj, glm::ivec2(1), ctx);
+        if (!tileset.hasManifest()) tileMax.assign(tileMax.size(), std::numeric_limits<float>::max());
+        const std::vector<std::vector<float> >& T = ctx.tileGrid();
+
+        Page& page = pages[slot];
+        page.h.assign(std::size_t(pageSize.x)*std::size_t(pageSize.y), gridNoValue);
+        for (int ii = 0; ii < int(T.size()) && ii < pageSize.x; ii++) {
+            int ly = pageSize.x - 1 - ii;
+            if (ly >= pageSize.y) continue;
+            for (int jj = 0; jj < int(T[ii].size()) && jj < pageSize.x; jj++) {
+                page.h[std::size_t(jj)*pageSize.y + ly] = T[ii][jj];
+            }
+        }
+        page.tile = tile;
+        pageOf[tile] = slot;
+        numLoads++;
+    }
+
+    pages[slot].lastUse = ++useClock;
+    lastTile = tile;
+    lastData = pages[slot].h.data();
+}
+
+float PagedHeightsGrid::getHeight(const glm::vec2 &p) const
+{
+    glm::ivec2 pcoords = glm::ivec2((p - gridMin)/gridRes);
+    return at(pcoords.x, pcoords.y);
+}
+
+void PagedHeightsGrid::computeRadialStatistics(const glm::vec2 &p, float rad, glm::vec3 &hmin, glm::vec3 &hmax, float &hmean, float &hdev) const
+{
+    computeRadialStatistics(glm::vec3(p.x, p.y, getHeight(p)), rad, hmin, hmax, hmean, hdev);
+}
+
+void PagedHeightsGrid::computeRadialStatistics(const glm::vec3 &p, float rad, glm::vec3 &hmin, glm::vec3 &hmax, float &hmean, float &hdev) const
+{
+    RadialStatsPolicy& stats = QueryContext::threadContext().radialStats(rad);
+    measurePass(*this, p, stats);
+    hmin = stats.getMin(0);
+    hmax = stats.getMax(0);
+    hmean = stats.getMean(0);
+    hdev = stats.getStdev(0);
+}
+
+float PagedHeightsGrid::computeIsolation(const glm::vec2 &p, float minDist, glm::vec3 &pIso, float minIsoArea, float hOffset, QueryContext* ctx) const
+{
+    return computeIsolation(glm::vec3(p.x, p.y, getHeight(p)), minDist, pIso, minIsoArea, hOffset, ctx);
+}
+
+float PagedHeightsGrid::computeIsolation(const glm::vec3 &p, float minDist, glm::vec3 &pIso, float minIsoArea, float hOffset, QueryContext* ctx) const
+{
+    if (!ctx) ctx = &QueryContext::threadContext();
+    return isolationSearch(*this, p, minDist, pIso, minIsoArea, hOffset, *ctx);
+}
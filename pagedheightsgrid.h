@@ -0,0 +1,116 @@
+#ifndef PAGEDHEIGHTSGRID_H
+#define PAGEDHEIGHTSGRID_H
+#include <vector>
+#include <cstddef>
+#include "glm/glm.hpp"
+#include "heightstileset.h"
+
+class QueryContext;
+
+// Window of a tileset at its full resolution whose tiles are read the first
+// time a query touches them. At most a budget of tiles stays in memory and
+// the least recently used one is evicted when it is exceeded, so searches
+// can span the whole tileset while reading only the tiles they visit.
+//
+// The tile cache is not locked: use one paged grid per thread. The tileset
+// itself can be shared.
+class PagedHeightsGrid
+{
+public:
+    PagedHeightsGrid(const HeightsTileset& tileset, std::size_t maxResidentBytes);
+
+    // query window snapped to the tileset cells, resident tiles are kept
+    void setWindow(const glm::vec2& wmin, const glm::vec2& wmax);
+
+    glm::vec2  getGridMin() const;
+    glm::vec2  getGridMax() const;
+    glm::vec2  getGridRes() const;
+    glm::ivec2 getGridSize() const;
+    float      getGridNoValue() const;
+
+    float at(int i, int j) const;
+    float atIfHigher(int i, int j, float h) const;
+    float getHeight(const glm::vec2& p) const;
+
+    void  computeRadialStatistics(const glm::vec2& p, float rad, glm::vec3& hmin, glm::vec3& hmax, float& hmean, float& hdev) const;
+    void  computeRadialStatistics(const glm::vec3& p, float rad, glm::vec3& hmin, glm::vec3& hmax, float& hmean, float& hdev) const;
+    float computeIsolation(const glm::vec2& p, float minDist, glm::vec3& pIso, float minIsoArea = 0, float hOffset = 0, QueryContext* ctx = nullptr) const;
+    float computeIsolation(const glm::vec3& p, float minDist, glm::vec3& pIso, float minIsoArea = 0, float hOffset = 0, QueryContext* ctx = nullptr) const;
+
+    int   getNumResidentTiles() const;
+    long long getNumTileLoads() const;
+
+private:
+    void  pageIn(int tile) const;
+
+    struct Page {
+        std::vector<float> h;   // h[lx*pageSize.y + ly]
+        int tile;
+        unsigned long long lastUse;
+    };
+
+    const HeightsTileset& tileset;
+    glm::vec2  tsetMin, gridMin, gridMax, gridRes;
+    glm::ivec2 gridSize, gridOffset;
+    glm::ivec2 pageSize, numPages;
+    float      gridNoValue;
+    int        maxPages;
+
+    // tile maxima from the manifest, tiles not above a height are not read.
+    // Cleared when the tileset drops its manifest
+    mutable std::vector<float> tileMax;
+
+    // page cache, pageOf[tile] is the slot of a resident tile or -1
+    mutable std::vector<Page> pages;
+    mutable std::vector<int>  pageOf;
+    mutable unsigned long long useClock;
+    mutable long long numLoads;
+    mutable int          lastTile;
+    mutable const float* lastData;
+};
+
+inline glm::vec2 PagedHeightsGrid::getGridMin() const {
+    return gridMin;
+}
+
+inline glm::vec2 PagedHeightsGrid::getGridMax() const {
+    return gridMax;
+}
+
+inline glm::vec2 PagedHeightsGrid::getGridRes() const {
+    return gridRes;
+}
+
+inline glm::ivec2 PagedHeightsGrid::getGridSize() const {
+    return gridSize;
+}
+
+inline float PagedHeightsGrid::getGridNoValue() const {
+    return gridNoValue;
+}
+
+inline int PagedHeightsGrid::getNumResidentTiles() const {
+    return int(pages.size());
+}
+
+inline long long PagedHeightsGrid::getNumTileLoads() const {
+    return numLoads;
+}
+
+inline float PagedHeightsGrid::at(int i, int j) const {
+    int gi = i + gridOffset.x;
+    int gj = j + gridOffset.y;
+    int ti = gi/pageSize.x;
+    int tj = gj/pageSize.y;
+    int tile = ti*numPages.y + tj;
+    if (tile != lastTile) pageIn(tile);
+    return lastData[(gi - ti*pageSize.x)*pageSize.y + (gj - tj*pageSize.y)];
+}
+
+inline float PagedHeightsGrid::atIfHigher(int i, int j, float h) const {
+    int tile = ((i + gridOffset.x)/pageSize.x)*numPages.y + (j + gridOffset.y)/pageSize.y;
+    if (tileMax[tile] <= h) return tileMax[tile];
+    return at(i, j);
+}
+
+#endif // PAGEDHEIGHTSGRID_H
@@ -0,0 +1,59 @@
+#include "querycontext.h"
+#include "measurepass.h"
+#include <algorithm>
+
+
+QueryContext::QueryContext()
+{
+    visitEpoch = 0;
+    visitBlocksY = 0;
+    usedBlocks = 0;
+}
+
+QueryContext::~QueryContext()
+{
+}
+
+QueryContext& QueryContext::threadContext()
+{
+    static thread_local QueryContext ctx;
+    return ctx;
+}
+
+void QueryContext::beginVisit(int sx, int sy)
+{
+    int bx = (sx + VISIT_BLOCK_MASK) >> VISIT_BLOCK_BITS;
+    int by = (sy + VISIT_BLOCK_MASK) >> VISIT_BLOCK_BITS;
+    visitBlocksY = by;
+    if (blockEpoch.size() < std::size_t(bx)*std::size_t(by)) {
+        blockEpoch.resize(std::size_t(bx)*std::size_t(by), 0);
+        blockStart.resize(blockEpoch.size(), 0);
+    }
+    usedBlocks = 0;
+
+    visitEpoch++;
+    if (visitEpoch == 0) {
+        std::fill(visitStamps.begin(), visitStamps.end(), uint8_t(0));
+        std::fill(blockEpoch.begin(), blockEpoch.end(), uint8_t(0));
+        visitEpoch = 1;
+    }
+}
+
+void QueryContext::takeVisitBlock(std::size_t b)
+{
+    // stamps left by older searches never match the current epoch
+    std::size_t start = std::size_t(usedBlocks)*VISIT_BLOCK_CELLS;
+    if (visitStamps.size() < start + VISIT_BLOCK_CELLS) {
+        visitStamps.resize(start + VISIT_BLOCK_CELLS, 0);
+    }
+    usedBlocks++;
+    blockEpoch[b] = visitEpoch;
+    blockStart[b] = int(start);
+}
+
+RadialStatsPolicy& QueryContext::radialStats(float radius)
+{
+    if (!stats) stats.reset(new RadialStatsPolicy(std::vector<float>(1, radius)));
+    else        stats->setRadii(&radius, 1);
+    return *stats;
+}
@@ -0,0 +1,103 @@
+#ifndef QUERYCONTEXT_H
+#define QUERYCONTEXT_H
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+
+class RadialStatsPolicy;
+
+// Scratch memory for the queries run by one thread. Buffers only grow, so
+// once they reach the size of the largest query no more memory is allocated.
+// A context must not be shared between threads running at the same time.
+class QueryContext
+{
+public:
+    typedef std::pair<float, std::pair<int, int> > HeapNode;
+
+    QueryContext();
+    ~QueryContext();
+
+    // context owned by the calling thread, for callers that do not keep one
+    static QueryContext& threadContext();
+
+    // visited marks for a sx*sy grid, all unvisited after beginVisit
+    void beginVisit(int sx, int sy);
+    bool isVisited(int i, int j) const;
+    void setVisited(int i, int j);
+
+    // search heap, empty on return
+    std::vector<HeapNode>& heap();
+
+    // raw samples of a tile and its downsampled version
+    std::vector<float>& tileBuffer();
+    std::vector<std::vector<float> >& tileGrid();
+    std::vector<float>& resampleBuffer();
+
+    // statistics policy of a single radius for computeRadialStatistics
+    RadialStatsPolicy& radialStats(float radius);
+
+private:
+    // a cell is visited when its stamp equals the current epoch, so starting
+    // a new search only needs a full clear when the epoch wraps around.
+    // Stamps are kept in blocks taken when a search first touches them, so a
+    // search over a huge grid only pays for the area it visits.
+    enum { VISIT_BLOCK_BITS = 6, VISIT_BLOCK_MASK = (1 << VISIT_BLOCK_BITS) - 1,
+           VISIT_BLOCK_CELLS = 1 << (2*VISIT_BLOCK_BITS) };
+    std::size_t visitBlock(int i, int j) const;
+    std::size_t visitCell(int i, int j) const;
+    void        takeVisitBlock(std::size_t b);
+
+    std::vector<uint8_t> visitStamps;
+    std::vector<uint8_t> blockEpoch;
+    std::vector<int>     blockStart;
+    uint8_t              visitEpoch;
+    int                  visitBlocksY;
+    int                  usedBlocks;
+
+    std::vector<HeapNode> heapNodes;
+    std::vector<float>    tileRaw;
+    std::vector<std::vector<float> > tileOut;
+    std::vector<float>    resampleAcc;
+    std::unique_ptr<RadialStatsPolicy> stats;
+};
+
+inline std::size_t QueryContext::visitBlock(int i, int j) const {
+    return std::size_t(i >> VISIT_BLOCK_BITS)*visitBlocksY + (j >> VISIT_BLOCK_BITS);
+}
+
+inline std::size_t QueryContext::visitCell(int i, int j) const {
+    return std::size_t(((i & VISIT_BLOCK_MASK) << VISIT_BLOCK_BITS) | (j & VISIT_BLOCK_MASK));
+}
+
+inline bool QueryContext::isVisited(int i, int j) const {
+    std::size_t b = visitBlock(i, j);
+    if (blockEpoch[b] != visitEpoch) return false;
+    return visitStamps[std::size_t(blockStart[b]) + visitCell(i, j)] == visitEpoch;
+}
+
+inline void QueryContext::setVisited(int i, int j) {
+    std::size_t b = visitBlock(i, j);
+    if (blockEpoch[b] != visitEpoch) takeVisitBlock(b);
+    visitStamps[std::size_t(blockStart[b]) + visitCell(i, j)] = visitEpoch;
+}
+
+inline std::vector<QueryContext::HeapNode>& QueryContext::heap() {
+    heapNodes.clear();
+    return heapNodes;
+}
+
+inline std::vector<float>& QueryContext::tileBuffer() {
+    return tileRaw;
+}
+
+inline std::vector<std::vector<float> >& QueryContext::tileGrid() {
+    return tileOut;
+}
+
+inline std::vector<float>& QueryContext::resampleBuffer() {
+    return resampleAcc;
+}
+
+#endif // QUERYCONTEXT_H
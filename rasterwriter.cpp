@@ -0,0 +1,78 @@
+#include "rasterwriter.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+
+
+RasterWriter::RasterWriter(const std::string& path, Format format, const glm::ivec2& size,
+                           const glm::vec2& gridMin, const glm::vec2& gridRes, float noValue)
+    : fout(path, std::fstream::out | std::fstream::trunc | std::fstream::binary),
+      size(size), gridMin(gridMin), gridRes(gridRes), noValue(noValue), sidecarOk(true)
+{
+    if (format == RAW) {
+        sidecarOk = writeSidecar(path + ".json");
+        return;
+    }
+
+    // header padded with spaces so the data starts 64 byte aligned
+    std::ostringstream dict;
+    dict << "{'descr': '<f4', 'fortran_order': False, 'shape': (" << size.y << ", " << size.x << "), }";
+    std::string header = dict.str();
+    const size_t preamble = 10;
+    size_t total = preamble + header.size() + 1;
+    header.append((64 - total%64)%64, ' ');
+    header.push_back('\n');
+
+    uint16_t headerLen = uint16_t(header.size());
+    const char magic[8] = { '\x93', 'N', 'U', 'M', 'P', 'Y', 1, 0 };
+    fout.write(magic, sizeof(magic));
+    fout.write((const char*)(&headerLen), sizeof(headerLen));
+    fout.write(header.data(), std::streamsize(header.size()));
+}
+
+bool RasterWriter::formatFromPath(const std::string& path, Format& format)
+{
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+    if (ext == "npy") format = NPY;
+    else if (ext == "raw") format = RAW;
+    else return false;
+    return true;
+}
+
+void RasterWriter::writeRows(const float* rows, int numRows)
+{
+    fout.write((const char*)(rows), std::streamsize(numRows)*size.x*sizeof(float));
+}
+
+bool RasterWriter::good() const
+{
+    return fout.good() && sidecarOk;
+}
+
+bool RasterWriter::close()
+{
+    fout.close();
+    return good();
+}
+
+bool RasterWriter::writeSidecar(const std::string& path) const
+{
+    std::ofstream fjson(path, std::fstream::out | std::fstream::trunc);
+    fjson << std::setprecision(9);
+    fjson << "{" << std::endl;
+    fjson << "  \"dtype\": \"float32\"," << std::endl;
+    fjson << "  \"byte_order\": \"little\"," << std::endl;
+    fjson << "  \"shape\": [" << size.y << ", " << size.x << "]," << std::endl;
+    fjson << "  \"row_order\": \"north_to_south\"," << std::endl;
+    fjson << "  \"grid_min\": [" << gridMin.x << ", " << gridMin.y << "]," << std::endl;
+    fjson << "  \"grid_res\": [" << gridRes.x << ", " << gridRes.y << "]," << std::endl;
+    fjson << "  \"nodata\": " << noValue << std::endl;
+    fjson << "}" << std::endl;
+    fjson.close();
+    return fjson.good();
+}
@@ -0,0 +1,41 @@
+#ifndef RASTERWRITER_H
+#define RASTERWRITER_H
+#include <string>
+#include <fstream>
+#include "glm/glm.hpp"
+
+// Float32 raster file that tools can map into memory without parsing, in
+// the layout of the .data exports: size.y rows of size.x values, from north
+// to south, so value (x, r) is the cell at gridMin + (x, size.y - 1 - r)*gridRes.
+//   NPY: numpy .npy file (format 1.0, '<f4', C order, shape (size.y, size.x))
+//   RAW: bare values plus a <path>.json sidecar with the shape, gridMin,
+//        gridRes and no value
+// Values are written little endian, as the tiles are read.
+class RasterWriter
+{
+public:
+    enum Format { NPY, RAW };
+
+    RasterWriter(const std::string& path, Format format, const glm::ivec2& size,
+                 const glm::vec2& gridMin, const glm::vec2& gridRes, float noValue);
+
+    // format from the extension of the path, false when it is neither
+    static bool formatFromPath(const std::string& path, Format& format);
+
+    // the next numRows rows, numRows*size.x values in one write
+    void writeRows(const float* rows, int numRows);
+
+    bool good() const;
+    bool close();
+
+private:
+    bool writeSidecar(const std::string& path) const;
+
+    std::ofstream fout;
+    glm::ivec2    size;
+    glm::vec2     gridMin, gridRes;
+    float         noValue;
+    bool          sidecarOk;
+};
+
+#endif // RASTERWRITER_H
@@ -0,0 +1,139 @@
+#include "resample.h"
+#include <limits>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLE_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace {
+
+inline float mapSample(float v, const SampleMapping& m) {
+    return v <= m.seaValue ? m.seaLevel : v;
+}
+
+// Adds the rows of the block column by column into acc, 4 columns at a time
+// with SSE2. Mean keeps the sums in acc[0, sy) and the counts in acc[sy, 2*sy),
+// max and min keep the running value in acc[0, sy), +-inf when not valid.
+void accumulateRows(const float* rows, int numRows, int sy, ResampleFilter filter,
+                    const SampleMapping& m, float* acc)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    float* sum = acc;
+    float* cnt = acc + sy;
+    float  init = filter == RESAMPLE_MAX ? -inf : (filter == RESAMPLE_MIN ? inf : 0.0f);
+    for (int j = 0; j < sy; j++) {
+        sum[j] = init;
+        cnt[j] = 0;
+    }
+
+    for (int k = 0; k < numRows; k++) {
+        const float* row = rows + std::size_t(k)*sy;
+        int j = 0;
+#ifdef RESAMPLE_SSE2
+        const __m128 noValue  = _mm_set1_ps(m.noValue);
+        const __m128 seaValue = _mm_set1_ps(m.seaValue);
+        const __m128 seaLevel = _mm_set1_ps(m.seaLevel);
+        const __m128 one      = _mm_set1_ps(1.0f);
+        const __m128 empty    = _mm_set1_ps(init);
+        for (; j + 4 <= sy; j += 4) {
+            __m128 v     = _mm_loadu_ps(row + j);
+            __m128 valid = _mm_cmpgt_ps(v, noValue);
+            __m128 sea   = _mm_cmple_ps(v, seaValue);
+            v = _mm_or_ps(_mm_and_ps(sea, seaLevel), _mm_andnot_ps(sea, v));
+            if (filter == RESAMPLE_MEAN) {
+                _mm_storeu_ps(sum + j, _mm_add_ps(_mm_loadu_ps(sum + j), _mm_and_ps(valid, v)));
+                _mm_storeu_ps(cnt + j, _mm_add_ps(_mm_loadu_ps(cnt + j), _mm_and_ps(valid, one)));
+            }
+            else {
+                v = _mm_or_ps(_mm_and_ps(valid, v), _mm_andnot_ps(valid, empty));
+                __m128 a = _mm_loadu_ps(sum + j);
+                _mm_storeu_ps(sum + j, filter == RESAMPLE_MAX ? _mm_max_ps(a, v) : _mm_min_ps(a, v));
+            }
+        }
+#endif
+        for (; j < sy; j++) {
+            float v = row[j];
+            if (v <= m.noValue) continue;
+            v = mapSample(v, m);
+            if (filter == RESAMPLE_MEAN) {
+                sum[j] += v;
+                cnt[j] += 1.0f;
+            }
+            else if (filter == RESAMPLE_MAX) {
+                sum[j] = glm::max(sum[j], v);
+            }
+            else {
+                sum[j] = glm::min(sum[j], v);
+            }
+        }
+    }
+}
+
+}
+
+
+void resampleRow(const float* rows, int numRows, int sy, int factorY, ResampleFilter filter,
+                 const SampleMapping& mapping, float* dst, float* acc)
+{
+    int osy = sy/factorY;
+
+    // point sample at the lower left corner of the block, where loadRegion
+    // places the output height
+    if (filter == RESAMPLE_BILINEAR) {
+        const float* row = rows + std::size_t(numRows - 1)*sy;
+        for (int j = 0; j < osy; j++) {
+            float v = row[j*factorY];
+            dst[j] = v > mapping.noValue ? mapSample(v, mapping) : mapping.seaLevel;
+        }
+        return;
+    }
+
+    // columns first, vectorized, then the blocks of factorY columns
+    accumulateRows(rows, numRows, sy, filter, mapping, acc);
+    const float* sum = acc;
+    const float* cnt = acc + sy;
+    for (int j = 0; j < osy; j++) {
+        const float* s = sum + j*factorY;
+        float h = s[0];
+        if (filter == RESAMPLE_MEAN) {
+            const float* c = cnt + j*factorY;
+            float n = c[0];
+            for (int jj = 1; jj < factorY; jj++) {
+                h += s[jj];
+                n += c[jj];
+            }
+            dst[j] = n > 0 ? h/n : mapping.seaLevel;
+        }
+        else {
+            for (int jj = 1; jj < factorY; jj++) {
+                h = filter == RESAMPLE_MAX ? glm::max(h, s[jj]) : glm::min(h, s[jj]);
+            }
+            dst[j] = std::isinf(h) ? mapping.seaLevel : h;
+        }
+    }
+}
+
+float resampleBilinear(const float* samples, int sx, int sy, float r, float c, const SampleMapping& mapping)
+{
+    r = glm::clamp(r, 0.0f, float(sx - 1));
+    c = glm::clamp(c, 0.0f, float(sy - 1));
+    int   i0 = glm::min(int(r), sx - 1), j0 = glm::min(int(c), sy - 1);
+    int   i1 = glm::min(i0 + 1, sx - 1), j1 = glm::min(j0 + 1, sy - 1);
+    float fr = r - float(i0), fc = c - float(j0);
+
+    const int   is[4] = { i0, i0, i1, i1 };
+    const int   js[4] = { j0, j1, j0, j1 };
+    const float ws[4] = { (1 - fr)*(1 - fc), (1 - fr)*fc, fr*(1 - fc), fr*fc };
+    float sumH = 0, sumW = 0;
+    for (int k = 0; k < 4; k++) {
+        float v = samples[std::size_t(is[k])*sy + js[k]];
+        if (v > mapping.noValue && ws[k] > 0) {
+            sumH += ws[k]*mapSample(v, mapping);
+            sumW += ws[k];
+        }
+    }
+    return sumW > 0 ? sumH/sumW : mapping.seaLevel;
+}
@@ -0,0 +1,35 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+#include <vector>
+#include "glm/glm.hpp"
+
+// How the samples of a factor.x*factor.y block become one output height.
+// Max never lowers summits, so coarse max grids give conservative peak
+// heights and isolations. Bilinear interpolates at the output points, and
+// is what non-integer reduction ratios use.
+enum ResampleFilter {
+    RESAMPLE_MEAN,
+    RESAMPLE_MAX,
+    RESAMPLE_MIN,
+    RESAMPLE_BILINEAR
+};
+
+// Value mapping of the tile samples: those not above noValue are left out,
+// those not above seaValue become seaLevel. Outputs without any valid
+// sample are seaLevel.
+struct SampleMapping {
+    float noValue, seaValue, seaLevel;
+};
+
+// One output row of a block filter. rows holds numRows consecutive rows of
+// sy samples, reduced in blocks of factorY into sy/factorY heights.
+// acc is scratch for 2*sy floats.
+void resampleRow(const float* rows, int numRows, int sy, int factorY, ResampleFilter filter,
+                 const SampleMapping& mapping, float* dst, float* acc);
+
+// Bilinear interpolation of the sx*sy samples at the fractional row r and
+// column c, clamped to the samples. Samples without value are left out and
+// the weights of the others renormalized.
+float resampleBilinear(const float* samples, int sx, int sy, float r, float c, const SampleMapping& mapping);
+
+#endif // RESAMPLE_H
@@ -0,0 +1,190 @@
+#include "terrainderivatives.h"
+#include "utils.h"
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DERIVATIVES_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace {
+
+const double RAD_TO_DEG = 180.0/M_PI;
+
+// stencil weights for the cell spacing
+struct StencilScale {
+    float gx, gy;       // 1/(8 dx), 1/(8 dy)
+    float xx, yy, xy;   // 1/dx^2, 1/dy^2, 1/(4 dx dy)
+};
+
+// Stencils of a column of cells, from the west, center and east columns.
+// Row t of the output has its south neighbours at t, itself at t + 1 and its
+// north neighbours at t + 2. Writes the curvatures and ruggedness, and the
+// gradient (gx, gy) for the slope and aspect.
+void stencilColumn(const float* w, const float* c, const float* e, int n, float noValue,
+                   const StencilScale& s, float* gx, float* gy, float* plan, float* profile, float* tri)
+{
+    int t = 0;
+#ifdef DERIVATIVES_SSE2
+    const __m128 noValue4 = _mm_set1_ps(noValue);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 sgx = _mm_set1_ps(s.gx), sgy = _mm_set1_ps(s.gy);
+    const __m128 sxx = _mm_set1_ps(s.xx), syy = _mm_set1_ps(s.yy), sxy = _mm_set1_ps(s.xy);
+    for (; t + 4 <= n; t += 4) {
+        __m128 nw = _mm_loadu_ps(w + t + 2), nn = _mm_loadu_ps(c + t + 2), ne = _mm_loadu_ps(e + t + 2);
+        __m128 ww = _mm_loadu_ps(w + t + 1), z  = _mm_loadu_ps(c + t + 1), ee = _mm_loadu_ps(e + t + 1);
+        __m128 sw = _mm_loadu_ps(w + t),     ss = _mm_loadu_ps(c + t),     se = _mm_loadu_ps(e + t);
+
+        __m128 missing = _mm_or_ps(_mm_or_ps(_mm_cmple_ps(nw, noValue4), _mm_cmple_ps(nn, noValue4)),
+                                   _mm_cmple_ps(ne, noValue4));
+        missing = _mm_or_ps(missing, _mm_or_ps(_mm_or_ps(_mm_cmple_ps(ww, noValue4), _mm_cmple_ps(z, noValue4)),
+                                               _mm_cmple_ps(ee, noValue4)));
+        missing = _mm_or_ps(missing, _mm_or_ps(_mm_or_ps(_mm_cmple_ps(sw, noValue4), _mm_cmple_ps(ss, noValue4)),
+                                               _mm_cmple_ps(se, noValue4)));
+
+        // differences to the center, exact for close heights
+        nw = _mm_sub_ps(nw, z); nn = _mm_sub_ps(nn, z); ne = _mm_sub_ps(ne, z);
+        ww = _mm_sub_ps(ww, z);                         ee = _mm_sub_ps(ee, z);
+        sw = _mm_sub_ps(sw, z); ss = _mm_sub_ps(ss, z); se = _mm_sub_ps(se, z);
+
+        // Horn gradient
+        __m128 p = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_add_ps(ne, se), _mm_mul_ps(two, ee)),
+                                         _mm_add_ps(_mm_add_ps(nw, sw), _mm_mul_ps(two, ww))), sgx);
+        __m128 q = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_add_ps(nw, ne), _mm_mul_ps(two, nn)),
+                                         _mm_add_ps(_mm_add_ps(sw, se), _mm_mul_ps(two, ss))), sgy);
+
+        // Zevenbergen-Thorne second derivatives
+        __m128 zxx = _mm_mul_ps(_mm_add_ps(ww, ee), sxx);
+        __m128 zyy = _mm_mul_ps(_mm_add_ps(nn, ss), syy);
+        __m128 zxy = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(ne, sw), _mm_add_ps(nw, se)), sxy);
+
+        __m128 p2 = _mm_mul_ps(p, p), q2 = _mm_mul_ps(q, q), pq2 = _mm_mul_ps(two, _mm_mul_ps(p, q));
+        __m128 g2 = _mm_add_ps(p2, q2);
+        __m128 sloped = _mm_cmpgt_ps(g2, zero);
+        __m128 g2one = _mm_add_ps(one, g2);
+        __m128 profNum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(zxx, p2), _mm_mul_ps(zxy, pq2)), _mm_mul_ps(zyy, q2));
+        __m128 planNum = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(zxx, q2), _mm_mul_ps(zxy, pq2)), _mm_mul_ps(zyy, p2));
+        __m128 profDen = _mm_mul_ps(_mm_mul_ps(g2, g2one), _mm_sqrt_ps(g2one));
+        __m128 planDen = _mm_mul_ps(g2, _mm_sqrt_ps(g2));
+        __m128 prof = _mm_and_ps(sloped, _mm_sub_ps(zero, _mm_div_ps(profNum, profDen)));
+        __m128 pln  = _mm_and_ps(sloped, _mm_sub_ps(zero, _mm_div_ps(planNum, planDen)));
+
+        // Riley ruggedness
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nw, nw), _mm_mul_ps(nn, nn)),
+                              _mm_add_ps(_mm_mul_ps(ne, ne), _mm_mul_ps(ww, ww)));
+        r = _mm_add_ps(r, _mm_add_ps(_mm_add_ps(_mm_mul_ps(ee, ee), _mm_mul_ps(sw, sw)),
+                                     _mm_add_ps(_mm_mul_ps(ss, ss), _mm_mul_ps(se, se))));
+        r = _mm_sqrt_ps(r);
+
+        __m128 nv = _mm_and_ps(missing, noValue4);
+        _mm_storeu_ps(gx + t, _mm_or_ps(nv, _mm_andnot_ps(missing, p)));
+        _mm_storeu_ps(gy + t, _mm_or_ps(nv, _mm_andnot_ps(missing, q)));
+        _mm_storeu_ps(profile + t, _mm_or_ps(nv, _mm_andnot_ps(missing, prof)));
+        _mm_storeu_ps(plan + t, _mm_or_ps(nv, _mm_andnot_ps(missing, pln)));
+        _mm_storeu_ps(tri + t, _mm_or_ps(nv, _mm_andnot_ps(missing, r)));
+    }
+#endif
+    for (; t < n; t++) {
+        float v[9] = { w[t + 2], c[t + 2], e[t + 2], w[t + 1], c[t + 1], e[t + 1], w[t], c[t], e[t] };
+        const float &nw = v[0], &nn = v[1], &ne = v[2], &ww = v[3], &ee = v[5], &sw = v[6], &ss = v[7], &se = v[8];
+        float z = v[4];
+        if (std::any_of(v, v + 9, [&](float h) { return h <= noValue; })) {
+            gx[t] = gy[t] = plan[t] = profile[t] = tri[t] = noValue;
+            continue;
+        }
+        float r = 0;
+        for (int k = 0; k < 9; k++) {
+            v[k] -= z;
+            r += v[k]*v[k];
+        }
+        float p = ((ne + 2*ee + se) - (nw + 2*ww + sw))*s.gx;
+        float q = ((nw + 2*nn + ne) - (sw + 2*ss + se))*s.gy;
+        float zxx = (ww + ee)*s.xx;
+        float zyy = (nn + ss)*s.yy;
+        float zxy = ((ne + sw) - (nw + se))*s.xy;
+        float g2 = p*p + q*q;
+        gx[t] = p;
+        gy[t] = q;
+        profile[t] = g2 > 0 ? -(zxx*p*p + 2*zxy*p*q + zyy*q*q)/(g2*(1 + g2)*std::sqrt(1 + g2)) : 0.0f;
+        plan[t] = g2 > 0 ? -(zxx*q*q - 2*zxy*p*q + zyy*p*p)/(g2*std::sqrt(g2)) : 0.0f;
+        tri[t] = std::sqrt(r);
+    }
+}
+
+}
+
+
+TerrainDerivatives::TerrainDerivatives(const HeightsGrid& grid, const glm::ivec2& cellMin, const glm::ivec2& cellMax)
+{
+    size = glm::max(cellMax - cellMin, glm::ivec2(0));
+    noValue = grid.getGridNoValue();
+    for (int m = 0; m < NUM_MAPS; m++) {
+        maps[m].assign(std::size_t(size.x)*std::size_t(size.y), noValue);
+    }
+    if (size.x == 0 || size.y == 0) return;
+
+    grid.visit([&](const auto& view) { computeBlocks(view, cellMin); });
+}
+
+template<typename View>
+void TerrainDerivatives::computeBlocks(const View& view, const glm::ivec2& cellMin)
+{
+    glm::vec2  res = view.getGridRes();
+    glm::ivec2 gridSize = view.getGridSize();
+    StencilScale scale;
+    scale.gx = 1.0f/(8*res.x);
+    scale.gy = 1.0f/(8*res.y);
+    scale.xx = 1.0f/(res.x*res.x);
+    scale.yy = 1.0f/(res.y*res.y);
+    scale.xy = 1.0f/(4*res.x*res.y);
+
+    // blocks of columns, each task slides three decoded columns along one
+    int numBlocks = (size.x + BLOCK_COLUMNS - 1)/BLOCK_COLUMNS;
+    runTasks(numBlocks, [&](int b) {
+        int n = size.y;
+        std::vector<float> columns[3];
+        for (std::vector<float>& col : columns) col.resize(n + 2);
+        std::vector<float> gx(n), gy(n);
+        auto decode = [&](int gi, std::vector<float>& col) {
+            for (int k = 0; k < n + 2; k++) {
+                int gj = cellMin.y - 1 + k;
+                bool inside = gi >= 0 && gi < gridSize.x && gj >= 0 && gj < gridSize.y;
+                col[k] = inside ? view.at(gi, gj) : noValue;
+            }
+        };
+
+        int ciBegin = b*BLOCK_COLUMNS;
+        int ciEnd = std::min(ciBegin + int(BLOCK_COLUMNS), size.x);
+        decode(cellMin.x + ciBegin - 1, columns[0]);
+        decode(cellMin.x + ciBegin, columns[1]);
+        for (int ci = ciBegin; ci < ciEnd; ci++) {
+            const float* w = columns[(ci - ciBegin) % 3].data();
+            const float* c = columns[(ci - ciBegin + 1) % 3].data();
+            std::vector<float>& e = columns[(ci - ciBegin + 2) % 3];
+            decode(cellMin.x + ci + 1, e);
+
+            std::size_t base = std::size_t(ci)*size.y;
+            stencilColumn(w, c, e.data(), n, noValue, scale, gx.data(), gy.data(),
+                          &maps[PLAN_CURVATURE][base], &maps[PROFILE_CURVATURE][base], &maps[RUGGEDNESS][base]);
+
+            // downhill direction is -gradient, atan2 of its east and north parts
+            for (int t = 0; t < n; t++) {
+                if (maps[RUGGEDNESS][base + t] == noValue) continue;
+                double p = gx[t], q = gy[t];
+                double g = std::sqrt(p*p + q*q);
+                maps[SLOPE][base + t] = float(std::atan(g)*RAD_TO_DEG);
+                if (g > 0) {
+                    double a = std::atan2(-p, -q)*RAD_TO_DEG;
+                    maps[ASPECT][base + t] = float(a < 0 ? a + 360 : a);
+                }
+                else {
+                    maps[ASPECT][base + t] = -1.0f;
+                }
+            }
+        }
+    });
+}
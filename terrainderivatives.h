@@ -0,0 +1,62 @@
+#ifndef TERRAINDERIVATIVES_H
+#define TERRAINDERIVATIVES_H
+#include <vector>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+// Slope, aspect, curvatures and ruggedness of every cell of a region, from
+// the 3x3 neighbourhood of the cell: Horn gradient for slope and aspect,
+// Zevenbergen-Thorne second derivatives for the curvatures and Riley's
+// terrain ruggedness index. Cells with a neighbour without value, or out of
+// the grid, get no value.
+//   SLOPE              degrees from horizontal
+//   ASPECT             degrees clockwise from north of the downhill
+//                      direction, -1 on flat cells
+//   PLAN_CURVATURE     of the contour line, 1/m, positive on convex ground
+//   PROFILE_CURVATURE  along the steepest slope, 1/m, positive on convex ground
+//   RUGGEDNESS         root of the summed squared differences to the 8
+//                      neighbours, m
+class TerrainDerivatives
+{
+public:
+    enum Map { SLOPE, ASPECT, PLAN_CURVATURE, PROFILE_CURVATURE, RUGGEDNESS, NUM_MAPS };
+
+    // maps of the cells [cellMin, cellMax) of the grid, which should keep one
+    // cell around them for the stencils
+    TerrainDerivatives(const HeightsGrid& grid, const glm::ivec2& cellMin, const glm::ivec2& cellMax);
+
+    glm::ivec2 getSize() const;
+    float      getNoValue() const;
+
+    // map cell (i, j) at i*size.y + j
+    const std::vector<float>& getMap(Map m) const;
+    float at(Map m, int i, int j) const;
+
+private:
+    enum { BLOCK_COLUMNS = 64 };
+
+    template<typename View>
+    void computeBlocks(const View& view, const glm::ivec2& cellMin);
+
+    glm::ivec2         size;
+    float              noValue;
+    std::vector<float> maps[NUM_MAPS];
+};
+
+inline glm::ivec2 TerrainDerivatives::getSize() const {
+    return size;
+}
+
+inline float TerrainDerivatives::getNoValue() const {
+    return noValue;
+}
+
+inline const std::vector<float>& TerrainDerivatives::getMap(Map m) const {
+    return maps[m];
+}
+
+inline float TerrainDerivatives::at(Map m, int i, int j) const {
+    return maps[m][std::size_t(i)*size.y + j];
+}
+
+#endif // TERRAINDERIVATIVES_H
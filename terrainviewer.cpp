@@ -35,40 +35,45 @@ void TerrainViewer::loadTerrain(const std::string &path)
     if (bufPos)     glDeleteBuffers(1, &bufPos);
     if (bufIndex)   glDeleteBuffers(1, &bufIndex);
 
-    std::vector<glm::vec3> verts;
-    std::vector<glm::ivec3> tris;
-    LoaderPLY::loadPLY(path, verts, tris);
-    boxMin = verts[0];
-    boxMax = verts[0];
-    for (unsigned int i = 1; i < verts.size(); i++) {
-        boxMin.x = glm::min(boxMin.x, verts[i].x);
-        boxMin.y = glm::min(boxMin.y, verts[i].y);
-        boxMin.z = glm::min(boxMin.z, verts[i].z);
-        boxMax.x = glm::max(boxMax.x, verts[i].x);
-        boxMax.y = glm::max(boxMax.y, verts[i].y);
-        boxMax.z = glm::max(boxMax.z, verts[i].z);
+    // positions go to the buffer straight from the file mapping
+    PLYMesh mesh;
+    if (!LoaderPLY::loadPLY(path, mesh) || mesh.getNumVertices() == 0) {
+        bufPos = bufIndex = 0;
+        numPoints = numTriangles = 0;
+        return;
+    }
+    boxMin = mesh.getVertex(0);
+    boxMax = mesh.getVertex(0);
+    for (unsigned int i = 1; i < mesh.getNumVertices(); i++) {
+        glm::vec3 v = mesh.getVertex(i);
+        boxMin.x = glm::min(boxMin.x, v.x);
+        boxMin.y = glm::min(boxMin.y, v.y);
+        boxMin.z = glm::min(boxMin.z, v.z);
+        boxMax.x = glm::max(boxMax.x, v.x);
+        boxMax.y = glm::max(boxMax.y, v.y);
+        boxMax.z = glm::max(boxMax.z, v.z);
     }
     camCtr = 0.5f*(boxMin + boxMax);
     camRadius = glm::round(glm::max(boxMax.x - camCtr.x, boxMax.y - camCtr.y)/1000.0f)*1000.0f;
     camDist = 2*boxMax.z;
 
-    numPoints = static_cast<unsigned int>(verts.size());
-    numTriangles = static_cast<unsigned int>(tris.size());
+    numPoints = mesh.getNumVertices();
+    numTriangles = mesh.getNumFaces();
 
     program->bind();
     dtmVAO->bind();
 
     glGenBuffers(1, &bufPos);
     glBindBuffer(GL_ARRAY_BUFFER, bufPos);
-    glBufferData(GL_ARRAY_BUFFER, verts.size()*sizeof(glm::vec3),
-                 reinterpret_cast<void*>(&verts[0].x), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.getNumVertices()*sizeof(glm::vec3),
+                 mesh.getVertexData(), GL_STATIC_DRAW);
     glVertexAttribPointer(program->attributeLocation("vertex"), 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(program->attributeLocation("vertex"));
 
     glGenBuffers(1, &bufIndex);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufIndex);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, tris.size()*sizeof(glm::ivec3),
-                 reinterpret_cast<void*>(&tris[0][0]), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.getNumFaces()*sizeof(glm::ivec3),
+                 reinterpret_cast<const void*>(mesh.getFaceData()), GL_STATIC_DRAW);
 
     dtmVAO->release();
     program->release();
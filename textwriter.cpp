@@ -0,0 +1,140 @@
+#include "textwriter.h"
+#include <charconv>
+#include <sstream>
+#include <locale>
+
+
+namespace {
+
+// %g or %f of printf in the "C" locale, as std::ostream writes them
+template<typename T>
+void appendNumber(std::string& text, T v, bool fixed, int prec)
+{
+#ifdef __cpp_lib_to_chars
+    char buf[512];
+    std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), v,
+                                             fixed ? std::chars_format::fixed : std::chars_format::general, prec);
+    if (res.ec == std::errc()) {
+        text.append(buf, res.ptr);
+        return;
+    }
+#endif
+    std::ostringstream oss;
+    oss.imbue(std::locale::classic());
+    if (fixed) oss.setf(std::ios_base::fixed, std::ios_base::floatfield);
+    oss.precision(prec);
+    oss << v;
+    text += oss.str();
+}
+
+template<typename T>
+void appendInteger(std::string& text, T v)
+{
+    char buf[32];
+    std::to_chars_result res = std::to_chars(buf, buf + sizeof(buf), v);
+    text.append(buf, res.ptr);
+}
+
+}
+
+
+TextBuffer::TextBuffer()
+{
+    fixed = false;
+    prec = 6;
+}
+
+void TextBuffer::setFixed(bool fixed)
+{
+    this->fixed = fixed;
+}
+
+void TextBuffer::precision(int prec)
+{
+    this->prec = prec;
+}
+
+TextBuffer& TextBuffer::operator<<(const char* s)
+{
+    text.append(s);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+TextBuffer& TextBuffer::operator<<(const std::string& s)
+{
+    text.append(s);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+TextBuffer& TextBuffer::operator<<(char c)
+{
+    text.push_back(c);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+TextBuffer& TextBuffer::operator<<(int v)
+{
+    appendInteger(text, v);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+TextBuffer& TextBuffer::operator<<(unsigned int v)
+{
+    appendInteger(text, v);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+TextBuffer& TextBuffer::operator<<(long long v)
+{
+    appendInteger(text, v);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+TextBuffer& TextBuffer::operator<<(float v)
+{
+    appendNumber(text, v, fixed, prec);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+TextBuffer& TextBuffer::operator<<(double v)
+{
+    appendNumber(text, v, fixed, prec);
+    if (text.size() >= FLUSH_SIZE) flush();
+    return *this;
+}
+
+
+TextWriter::TextWriter(const std::string& path)
+    : fout(path, std::fstream::out | std::fstream::trunc)
+{
+}
+
+TextWriter::~TextWriter()
+{
+    close();
+}
+
+bool TextWriter::good() const
+{
+    return fout.good();
+}
+
+void TextWriter::close()
+{
+    if (!fout.is_open()) return;
+    flush();
+    fout.close();
+}
+
+void TextWriter::flush()
+{
+    fout.write(text.data(), std::streamsize(text.size()));
+    text.clear();
+}
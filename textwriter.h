@@ -0,0 +1,132 @@
+#ifndef TEXTWRITER_H
+#define TEXTWRITER_H
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Text with the layout std::ostream gives in the "C" locale: numbers in
+// default (%g) or fixed notation at the current precision, 6 to start with.
+// Numbers are formatted with std::to_chars when the library has it.
+class TextBuffer
+{
+public:
+    TextBuffer();
+
+    void setFixed(bool fixed);
+    void precision(int prec);
+
+    TextBuffer& operator<<(const char* s);
+    TextBuffer& operator<<(const std::string& s);
+    TextBuffer& operator<<(char c);
+    TextBuffer& operator<<(int v);
+    TextBuffer& operator<<(unsigned int v);
+    TextBuffer& operator<<(long long v);
+    TextBuffer& operator<<(float v);
+    TextBuffer& operator<<(double v);
+
+    const std::string& str() const;
+    void clear();
+
+protected:
+    // called when the text grows past the flush size
+    virtual void flush() {}
+
+    enum { FLUSH_SIZE = 1 << 20 };
+    std::string text;
+    bool fixed;
+    int  prec;
+};
+
+// Buffered text file, written in blocks of about FLUSH_SIZE bytes
+class TextWriter : public TextBuffer
+{
+public:
+    TextWriter(const std::string& path);
+    ~TextWriter();
+
+    bool good() const;
+    void close();
+
+    // Formats the rows [0, numRows) with formatRow(row, buffer) in chunks
+    // spread over the cores, and writes them in order
+    template<typename FormatRow>
+    void writeRows(int numRows, FormatRow formatRow);
+
+protected:
+    void flush();
+
+private:
+    std::ofstream fout;
+};
+
+
+inline const std::string& TextBuffer::str() const {
+    return text;
+}
+
+inline void TextBuffer::clear() {
+    text.clear();
+}
+
+template<typename FormatRow>
+void TextWriter::writeRows(int numRows, FormatRow formatRow)
+{
+    const int ROWS_PER_CHUNK = 16;
+    int numChunks = (numRows + ROWS_PER_CHUNK - 1)/ROWS_PER_CHUNK;
+    int numThreads = int(std::max(1u, std::thread::hardware_concurrency()));
+    numThreads = std::min(numThreads, numChunks);
+    if (numThreads <= 1) {
+        for (int r = 0; r < numRows; r++) formatRow(r, *this);
+        return;
+    }
+
+    // chunk c is formatted by thread c % numThreads into slot c % numSlots,
+    // which is free once chunk c - numSlots has been written
+    int numSlots = 2*numThreads;
+    std::vector<TextBuffer> chunks(numSlots);
+    std::vector<bool> ready(numSlots, false);
+    int written = 0;
+    std::mutex mtx;
+    std::condition_variable cond;
+
+    flush();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; t++) {
+        workers.push_back(std::thread([&, t]() {
+            for (int c = t; c < numChunks; c += numThreads) {
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    cond.wait(lock, [&]() { return c < written + numSlots; });
+                }
+                TextBuffer& buf = chunks[c % numSlots];
+                buf.clear();
+                buf.setFixed(fixed);
+                buf.precision(prec);
+                int rowEnd = std::min(numRows, (c + 1)*ROWS_PER_CHUNK);
+                for (int r = c*ROWS_PER_CHUNK; r < rowEnd; r++) formatRow(r, buf);
+                std::lock_guard<std::mutex> lock(mtx);
+                ready[c % numSlots] = true;
+                cond.notify_all();
+            }
+        }));
+    }
+    for (int c = 0; c < numChunks; c++) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cond.wait(lock, [&]() { return bool(ready[c % numSlots]); });
+        }
+        const std::string& chunk = chunks[c % numSlots].str();
+        fout.write(chunk.data(), std::streamsize(chunk.size()));
+        std::lock_guard<std::mutex> lock(mtx);
+        ready[c % numSlots] = false;
+        written = c + 1;
+        cond.notify_all();
+    }
+    for (std::thread& w : workers) w.join();
+}
+
+#endif // TEXTWRITER_H
@@ -0,0 +1,122 @@
+#include "tilepack.h"
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+TilePack::TilePack()
+{
+    std::memset(&header, 0, sizeof(header));
+    handle = nullptr;
+    fd = -1;
+}
+
+TilePack::~TilePack()
+{
+    close();
+}
+
+bool TilePack::open(const std::string& path)
+{
+    close();
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    handle = h;
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+#endif
+
+    TilePackHeader h;
+    if (!readAt(0, &h, sizeof(h)) || std::memcmp(h.magic, TILEPACK_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != TILEPACK_VERSION || h.numLevels == 0) {
+        close();
+        return false;
+    }
+
+    std::vector<TilePackEntry> index(std::size_t(h.numLevels)*h.numTilesX*h.numTilesY);
+    if (index.empty() || !readAt(sizeof(h), index.data(), index.size()*sizeof(TilePackEntry))) {
+        close();
+        return false;
+    }
+
+    header = h;
+    entries.swap(index);
+    return true;
+}
+
+void TilePack::close()
+{
+#ifdef _WIN32
+    if (handle) CloseHandle(HANDLE(handle));
+#else
+    if (fd >= 0) ::close(fd);
+#endif
+    handle = nullptr;
+    fd = -1;
+    entries.clear();
+}
+
+int TilePack::getLevel(int factor) const
+{
+    for (int l = 0; l < getNumLevels(); l++) {
+        if ((1 << l) == factor) return l;
+    }
+    return -1;
+}
+
+const TilePackEntry* TilePack::findEntry(int level, int ti, int tj) const
+{
+    if (level < 0 || level >= getNumLevels() || ti < 0 || tj < 0 ||
+        ti >= int(header.numTilesX) || tj >= int(header.numTilesY)) {
+        return nullptr;
+    }
+    const TilePackEntry& e = entries[(std::size_t(level)*header.numTilesX + ti)*header.numTilesY + tj];
+    return e.offset > 0 ? &e : nullptr;
+}
+
+bool TilePack::getTileSize(int level, int ti, int tj, unsigned int& sx, unsigned int& sy) const
+{
+    const TilePackEntry* e = findEntry(level, ti, tj);
+    if (!e) return false;
+    sx = e->sx;
+    sy = e->sy;
+    return true;
+}
+
+bool TilePack::readTile(int level, int ti, int tj, float* samples) const
+{
+    const TilePackEntry* e = findEntry(level, ti, tj);
+    if (!e) return false;
+    return readAt(e->offset, samples, std::size_t(e->sx)*std::size_t(e->sy)*sizeof(float));
+}
+
+bool TilePack::readAt(uint64_t offset, void* dst, std::size_t bytes) const
+{
+    // positional reads do not move a shared file pointer
+    char* out = static_cast<char*>(dst);
+    while (bytes > 0) {
+#ifdef _WIN32
+        OVERLAPPED ov;
+        std::memset(&ov, 0, sizeof(ov));
+        ov.Offset = DWORD(offset & 0xFFFFFFFFu);
+        ov.OffsetHigh = DWORD(offset >> 32);
+        DWORD chunk = DWORD(bytes < (std::size_t(1) << 30) ? bytes : (std::size_t(1) << 30));
+        DWORD nread = 0;
+        if (!ReadFile(HANDLE(handle), out, chunk, &nread, &ov) || nread == 0) return false;
+#else
+        ssize_t nread = ::pread(fd, out, bytes, off_t(offset));
+        if (nread <= 0) return false;
+#endif
+        out += nread;
+        offset += uint64_t(nread);
+        bytes -= std::size_t(nread);
+    }
+    return true;
+}
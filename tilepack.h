@@ -0,0 +1,76 @@
+#ifndef TILEPACK_H
+#define TILEPACK_H
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Single file holding all the tiles of a tileset. Layout, little endian:
+//
+//   TilePackHeader
+//   TilePackEntry x numLevels*numTilesX*numTilesY, level major and then
+//                 ti*numTilesY + tj, offset 0 marks a missing tile
+//   tile samples, float32, sx*sy per tile in the order of the .bin files
+//
+// Level 0 holds the samples of the tile files as they are. Level l > 0 holds
+// what readTile returns with a reduction factor of 2^l and the mean filter,
+// already resampled.
+struct TilePackHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t numTilesX, numTilesY;
+    uint32_t numLevels;
+};
+
+struct TilePackEntry
+{
+    uint64_t offset;
+    uint32_t sx, sy;
+};
+
+static const char     TILEPACK_MAGIC[8] = { 'C', 'A', 'T', 'T', 'P', 'A', 'C', 'K' };
+static const uint32_t TILEPACK_VERSION = 1;
+
+
+// Read access to a pack through one file handle with positional reads, so
+// several threads can read tiles at the same time.
+class TilePack
+{
+public:
+    TilePack();
+    ~TilePack();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+
+    int  getNumLevels() const;
+    int  getLevel(int factor) const;    // level for a reduction factor, -1 if none
+
+    // size of a stored tile, false if missing
+    bool getTileSize(int level, int ti, int tj, unsigned int& sx, unsigned int& sy) const;
+    bool readTile(int level, int ti, int tj, float* samples) const;
+
+private:
+    TilePack(const TilePack&);
+    TilePack& operator=(const TilePack&);
+
+    const TilePackEntry* findEntry(int level, int ti, int tj) const;
+    bool readAt(uint64_t offset, void* dst, std::size_t bytes) const;
+
+    TilePackHeader             header;
+    std::vector<TilePackEntry> entries;
+    void*                      handle;      // HANDLE on Windows
+    int                        fd;
+};
+
+inline bool TilePack::isOpen() const {
+    return !entries.empty();
+}
+
+inline int TilePack::getNumLevels() const {
+    return isOpen() ? int(header.numLevels) : 0;
+}
+
+#endif // TILEPACK_H
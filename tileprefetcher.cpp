@@ -0,0 +1,140 @@
+#include "tileprefetcher.h"
+#include "heightstileset.h"
+#include <algorithm>
+
+
+TilePrefetcher::TilePrefetcher(const HeightsTileset& tileset, std::size_t maxBytes)
+    : tileset(tileset), maxBytes(maxBytes)
+{
+    readyBytes = 0;
+    useClock = 0;
+    stats.requested = stats.hits = stats.late = stats.misses = stats.wasted = 0;
+    stopping = false;
+    worker = std::thread(&TilePrefetcher::run, this);
+}
+
+TilePrefetcher::~TilePrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workCond.notify_all();
+    worker.join();
+}
+
+void TilePrefetcher::request(int ti, int tj)
+{
+    std::pair<int, int> key(ti, tj);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::pair<int, int>, Tile>::iterator it = tiles.find(key);
+        if (it != tiles.end()) {
+            it->second.lastUse = ++useClock;
+            return;
+        }
+        Tile& t = tiles[key];
+        t.state = QUEUED;
+        t.ok = t.used = false;
+        t.sx = t.sy = 0;
+        t.lastUse = ++useClock;
+        queue.push_back(key);
+        stats.requested++;
+    }
+    workCond.notify_one();
+}
+
+bool TilePrefetcher::fetch(int ti, int tj, unsigned int& sx, unsigned int& sy, std::vector<float>& samples)
+{
+    std::pair<int, int> key(ti, tj);
+    std::unique_lock<std::mutex> lock(mutex);
+    std::map<std::pair<int, int>, Tile>::iterator it = tiles.find(key);
+    if (it == tiles.end()) {
+        stats.misses++;
+        return false;
+    }
+
+    if (it->second.state == QUEUED) {
+        // not started, faster to read it here than to wait behind the queue
+        queue.erase(std::find(queue.begin(), queue.end(), key));
+        tiles.erase(it);
+        stats.late++;
+        return false;
+    }
+    if (it->second.state == READING) {
+        stats.late++;
+        readyCond.wait(lock, [this, &key]() {
+            std::map<std::pair<int, int>, Tile>::iterator r = tiles.find(key);
+            return r == tiles.end() || r->second.state == READY;
+        });
+        it = tiles.find(key);
+        if (it == tiles.end()) return false;
+    }
+    else {
+        stats.hits++;
+    }
+
+    Tile& t = it->second;
+    t.used = true;
+    t.lastUse = ++useClock;
+    if (!t.ok) return false;
+    sx = t.sx;
+    sy = t.sy;
+    if (samples.size() < t.samples.size()) {
+        samples.resize(t.samples.size());
+    }
+    std::copy(t.samples.begin(), t.samples.end(), samples.begin());
+    return true;
+}
+
+PrefetchStats TilePrefetcher::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void TilePrefetcher::run()
+{
+    std::vector<float> samples;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        workCond.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (stopping) break;
+
+        std::pair<int, int> key = queue.front();
+        queue.pop_front();
+        tiles[key].state = READING;
+
+        // read without holding the lock
+        lock.unlock();
+        unsigned int sx = 0, sy = 0;
+        bool ok = tileset.readStoredSamples(key.first, key.second, sx, sy, samples);
+        lock.lock();
+
+        Tile& t = tiles[key];
+        t.state = READY;
+        t.ok = ok;
+        t.sx = sx;
+        t.sy = sy;
+        t.samples.assign(samples.begin(), samples.begin() + (ok ? std::size_t(sx)*std::size_t(sy) : 0));
+        readyBytes += t.samples.size()*sizeof(float);
+        evict(key);
+        readyCond.notify_all();
+    }
+}
+
+void TilePrefetcher::evict(const std::pair<int, int>& keep)
+{
+    // least recently used ready tiles go first, the one just read stays
+    while (readyBytes > maxBytes) {
+        std::map<std::pair<int, int>, Tile>::iterator victim = tiles.end();
+        for (std::map<std::pair<int, int>, Tile>::iterator it = tiles.begin(); it != tiles.end(); ++it) {
+            if (it->second.state != READY || it->first == keep) continue;
+            if (victim == tiles.end() || it->second.lastUse < victim->second.lastUse) victim = it;
+        }
+        if (victim == tiles.end()) break;
+        if (!victim->second.used) stats.wasted++;
+        readyBytes -= victim->second.samples.size()*sizeof(float);
+        tiles.erase(victim);
+    }
+}
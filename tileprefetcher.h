@@ -0,0 +1,71 @@
+#ifndef TILEPREFETCHER_H
+#define TILEPREFETCHER_H
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstddef>
+#include <utility>
+
+class HeightsTileset;
+
+struct PrefetchStats
+{
+    long long requested;    // tiles queued for reading
+    long long hits;         // read before they were needed
+    long long late;         // needed while still queued or being read
+    long long misses;       // needed without having been requested
+    long long wasted;       // evicted before being used
+};
+
+
+// Background reader of the tiles that upcoming queries will need. Readers
+// of the tileset take the samples from here when the tile has been
+// requested, waiting for it if it is being read. Read tiles are kept up to
+// a budget and the least recently used are evicted.
+class TilePrefetcher
+{
+public:
+    TilePrefetcher(const HeightsTileset& tileset, std::size_t maxBytes);
+    ~TilePrefetcher();
+
+    void request(int ti, int tj);
+
+    // samples of a requested tile, false when the caller has to read it
+    bool fetch(int ti, int tj, unsigned int& sx, unsigned int& sy, std::vector<float>& samples);
+
+    PrefetchStats getStats() const;
+
+private:
+    TilePrefetcher(const TilePrefetcher&);
+    TilePrefetcher& operator=(const TilePrefetcher&);
+
+    void run();
+    void evict(const std::pair<int, int>& keep);
+
+    enum TileState { QUEUED, READING, READY };
+    struct Tile {
+        TileState state;
+        bool ok, used;
+        unsigned int sx, sy;
+        std::vector<float> samples;
+        unsigned long long lastUse;
+    };
+
+    const HeightsTileset& tileset;
+    std::size_t maxBytes, readyBytes;
+
+    std::map<std::pair<int, int>, Tile> tiles;
+    std::deque<std::pair<int, int> >    queue;
+    unsigned long long                  useClock;
+    PrefetchStats                       stats;
+
+    mutable std::mutex      mutex;
+    std::condition_variable workCond, readyCond;
+    bool                    stopping;
+    std::thread             worker;
+};
+
+#endif // TILEPREFETCHER_H
@@ -0,0 +1,21 @@
+#include <iostream>
+#include <string>
+#include "heightstileset.h"
+
+// Writes the manifest of a tileset next to its descriptor:
+//   makemanifest catalunya.tiles
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <tileset descriptor>" << std::endl;
+        return 1;
+    }
+
+    std::string descriptor = argv[1];
+    HeightsTileset tileset(descriptor);
+    if (!tileset.writeManifest(descriptor + ".manifest")) {
+        std::cerr << "Could not write " << descriptor << ".manifest" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include "heightstileset.h"
+#include "tilepack.h"
+
+// Packs the tile files of a tileset into a single file, with optional
+// pyramid levels, and writes a descriptor that reads from it:
+//   packtiles catalunya.tiles catalunya.pack [levels]
+// writes catalunya.pack and catalunya.pack.tiles
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <tileset descriptor> <output.pack> [levels]" << std::endl;
+        return 1;
+    }
+
+    std::string descriptor = argv[1];
+    std::string packPath = argv[2];
+    int numLevels = argc > 3 ? std::max(1, std::atoi(argv[3])) : 1;
+
+    HeightsTileset tileset(descriptor);
+    glm::ivec2 numTiles = tileset.getNumTiles();
+    if (numTiles.x <= 0 || numTiles.y <= 0) {
+        std::cerr << "Could not read " << descriptor << std::endl;
+        return 1;
+    }
+
+    std::fstream fout(packPath, std::fstream::out | std::fstream::binary);
+    if (!fout.good()) {
+        std::cerr << "Could not write " << packPath << std::endl;
+        return 1;
+    }
+
+    TilePackHeader header;
+    std::memcpy(header.magic, TILEPACK_MAGIC, sizeof(header.magic));
+    header.version = TILEPACK_VERSION;
+    header.numTilesX = numTiles.x;
+    header.numTilesY = numTiles.y;
+    header.numLevels = numLevels;
+
+    // index is written again once the offsets are known
+    std::vector<TilePackEntry> entries(size_t(numLevels)*numTiles.x*numTiles.y);
+    std::memset(entries.data(), 0, entries.size()*sizeof(TilePackEntry));
+    fout.write((const char*)(&header), sizeof(header));
+    fout.write((const char*)(entries.data()), entries.size()*sizeof(TilePackEntry));
+    uint64_t offset = sizeof(header) + entries.size()*sizeof(TilePackEntry);
+
+    QueryContext ctx;
+    std::vector<float> samples;
+    for (int ti = 0; ti < numTiles.x; ti++) {
+        for (int tj = 0; tj < numTiles.y; tj++) {
+            unsigned int sx, sy;
+            if (!tileset.readTileSamples(ti, tj, sx, sy, samples)) {
+                std::cerr << "Missing tile " << ti << " " << tj << std::endl;
+                continue;
+            }
+
+            for (int l = 0; l < numLevels; l++) {
+                TilePackEntry& e = entries[(size_t(l)*numTiles.x + ti)*numTiles.y + tj];
+                if (l > 0) {
+                    // resampled exactly as readTile would do it
+                    tileset.readTile(ti, tj, glm::ivec2(1 << l), ctx);
+                    const std::vector<std::vector<float> >& T = ctx.tileGrid();
+                    sx = (unsigned int)(T.size());
+                    sy = sx > 0 ? (unsigned int)(T[0].size()) : 0;
+                    samples.resize(size_t(sx)*size_t(sy));
+                    for (unsigned int i = 0; i < sx; i++) {
+                        std::copy(T[i].begin(), T[i].end(), samples.begin() + size_t(i)*sy);
+                    }
+                }
+                e.offset = offset;
+                e.sx = sx;
+                e.sy = sy;
+                fout.write((const char*)(samples.data()), size_t(sx)*size_t(sy)*sizeof(float));
+                offset += uint64_t(sx)*uint64_t(sy)*sizeof(float);
+            }
+        }
+    }
+
+    fout.seekp(sizeof(header));
+    fout.write((const char*)(entries.data()), entries.size()*sizeof(TilePackEntry));
+    fout.close();
+    if (!fout.good()) {
+        std::cerr << "Could not write " << packPath << std::endl;
+        return 1;
+    }
+
+    // same descriptor, reading from the pack
+    std::ifstream fdesc(descriptor);
+    std::ofstream fpack(packPath + ".tiles");
+    std::string line;
+    std::getline(fdesc, line);
+    fpack << packPath << std::endl;
+    while (std::getline(fdesc, line)) {
+        fpack << line << std::endl;
+    }
+
+    return 0;
+}
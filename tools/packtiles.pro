@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# Packs the tiles of a heights tileset in one file
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = packtiles
+TEMPLATE = app
+CONFIG += console thread c++14
+CONFIG -= app_bundle
+QMAKE_LFLAGS_RELEASE += -static-libgcc -static-libstdc++
+
+INCLUDEPATH += ../ ../glm/
+
+DEFINES += _USE_MATH_DEFINES
+
+SOURCES += packtiles.cpp \
+    ../heightstileset.cpp \
+    ../heightsgrid.cpp \
+    ../querycontext.cpp \
+    ../tilepack.cpp \
+    ../tileprefetcher.cpp \
+    ../resample.cpp
+
+HEADERS  += ../heightstileset.h \
+    ../heightsgrid.h \
+    ../querycontext.h \
+    ../tilepack.h \
+    ../tileprefetcher.h \
+    ../resample.h
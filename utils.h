@@ -2,6 +2,10 @@
 #define UTILS_H
 
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
 inline void write_int(std::ofstream& fout, int v) {
     fout.write((char*)(&v), sizeof(int));
@@ -19,5 +23,20 @@ inline void write_char(std::ofstream& fout, char v) {
     fout.write((char*)(&v), sizeof(char));
 }
 
+// runs task(0..numTasks-1) on the hardware threads
+template<typename Task>
+void runTasks(int numTasks, const Task& task)
+{
+    int numThreads = std::min(numTasks, int(std::max(1u, std::thread::hardware_concurrency())));
+    std::atomic<int> nextTask(0);
+    auto worker = [&]() {
+        for (int t = nextTask++; t < numTasks; t = nextTask++) task(t);
+    };
+    std::vector<std::thread> workers;
+    for (int w = 1; w < numThreads; w++) workers.push_back(std::thread(worker));
+    worker();
+    for (std::thread& w : workers) w.join();
+}
+
 
 #endif // UTILS_H
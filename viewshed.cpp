@@ -0,0 +1,105 @@
+#include "viewshed.h"
+#include "utils.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+const float Viewshed::DEFAULT_REFRACTION = 0.13f;
+
+
+Viewshed::Viewshed(const HeightsGrid& grid, const glm::vec3& p, float radius,
+                   float observerHeight, float targetHeight, float refraction)
+{
+    size = grid.getGridSize();
+    mapMin = grid.getGridMin();
+    mapRes = grid.getGridRes();
+    noValue = grid.getGridNoValue();
+    map.assign(std::size_t(size.x)*std::size_t(size.y), noValue);
+    numCells = numVisible = 0;
+    maxVisibleDist = 0;
+
+    glm::ivec2 oc = glm::ivec2(glm::floor((glm::vec2(p) - mapMin)/mapRes));
+    if (oc.x < 0 || oc.y < 0 || oc.x >= size.x || oc.y >= size.y) return;
+
+    map[std::size_t(oc.x)*size.y + oc.y] = 1;
+    numCells = numVisible = 1;
+    grid.visit([&](const auto& view) {
+        sweepOctants(view, oc, p.z + observerHeight, radius, targetHeight, refraction);
+    });
+}
+
+template<typename View>
+void Viewshed::sweepOctants(const View& view, const glm::ivec2& oc, float observerZ,
+                            float radius, float targetHeight, float refraction)
+{
+    const double drop = (1.0 - refraction)/(2.0*EARTH_RADIUS);
+    const int rings = int(std::ceil(radius/glm::min(mapRes.x, mapRes.y)));
+
+    struct Counts { int cells, visible; float maxDist; };
+    Counts counts[8];
+
+    // octant o has major axis y when swapped, and the signs of x and y
+    auto sweep = [&](int o) {
+        bool swap = (o & 4) != 0;
+        int  sx = (o & 1) ? -1 : 1;
+        int  sy = (o & 2) ? -1 : 1;
+        Counts& c = counts[o];
+        c.cells = c.visible = 0;
+        c.maxDist = 0;
+
+        // cells on the axes and diagonals belong to a single octant
+        int firstMinor = (swap ? sx : sy) > 0 ? 0 : 1;
+        int majorCells = swap ? (sy > 0 ? size.y - 1 - oc.y : oc.y) : (sx > 0 ? size.x - 1 - oc.x : oc.x);
+        int numRings = std::min(rings, majorCells);
+
+        // horizon slopes of the previous and current rings
+        std::vector<float> prev(numRings + 2), cur(numRings + 2);
+        for (int a = 1; a <= numRings; a++) {
+            for (int b = 0; b <= a; b++) {
+                float H = -std::numeric_limits<float>::max();
+                if (a > 1) {
+                    // line of sight at ring a - 1, between two of its cells
+                    float pos = float(b)*float(a - 1)/float(a);
+                    int   b0 = int(pos);
+                    int   b1 = std::min(b0 + 1, a - 1);
+                    float w = pos - float(b0);
+                    H = (1 - w)*prev[b0] + w*prev[b1];
+                }
+                cur[b] = H;
+
+                int dx = swap ? b*sx : a*sx;
+                int dy = swap ? a*sy : b*sy;
+                int gi = oc.x + dx, gj = oc.y + dy;
+                if (gi < 0 || gj < 0 || gi >= size.x || gj >= size.y) continue;
+                float h = view.at(gi, gj);
+                if (h <= noValue) continue;
+
+                double dist = std::sqrt(double(dx*mapRes.x)*(dx*mapRes.x) + double(dy*mapRes.y)*(dy*mapRes.y));
+                double hEff = h - drop*dist*dist;
+                float slope = float((hEff - observerZ)/dist);
+                float targetSlope = float((hEff + targetHeight - observerZ)/dist);
+                cur[b] = std::max(H, slope);
+
+                bool owned = b >= firstMinor && (!swap || b < a);
+                if (owned && dist <= radius) {
+                    bool visible = targetSlope >= H;
+                    map[std::size_t(gi)*size.y + gj] = visible ? 1.0f : 0.0f;
+                    c.cells++;
+                    if (visible) {
+                        c.visible++;
+                        c.maxDist = std::max(c.maxDist, float(dist));
+                    }
+                }
+            }
+            std::swap(prev, cur);
+        }
+    };
+
+    runTasks(8, sweep);
+
+    for (const Counts& c : counts) {
+        numCells += c.cells;
+        numVisible += c.visible;
+        maxVisibleDist = std::max(maxVisibleDist, c.maxDist);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef VIEWSHED_H
+#define VIEWSHED_H
+#include <vector>
+#include "glm/glm.hpp"
+#include "heightsgrid.h"
+
+// Cells of a HeightsGrid visible from an observer, swept with XDraw: each
+// octant around the observer cell is visited ring by ring outwards, and the
+// horizon of a cell is interpolated from the two cells of the previous ring
+// closest to its line of sight, so the whole disk costs O(N). The eight
+// octants run in parallel. Heights are lowered by the Earth curvature,
+// corrected by the refraction coefficient, and the observer sits at the
+// center of its cell.
+class Viewshed
+{
+public:
+    enum { EARTH_RADIUS = 6371000 };
+    static const float DEFAULT_REFRACTION;
+
+    // p.z is the ground height at the observer. Targets are seen when their
+    // top, targetHeight above the ground, is above the horizon.
+    Viewshed(const HeightsGrid& grid, const glm::vec3& p, float radius,
+             float observerHeight, float targetHeight, float refraction = DEFAULT_REFRACTION);
+
+    // map over the grid cells, cell (i, j) at i*size.y + j: 1 visible,
+    // 0 hidden, no value beyond the radius or without height
+    glm::ivec2 getSize() const;
+    glm::vec2  getMapMin() const;
+    glm::vec2  getMapRes() const;
+    float      getNoValue() const;
+    const std::vector<float>& getMap() const;
+    float      at(int i, int j) const;
+
+    // over the cells within the radius with height
+    int   getNumCells() const;
+    int   getNumVisible() const;
+    float getVisibleArea() const;        // m2
+    float getVisibleFraction() const;
+    float getMaxVisibleDistance() const; // m
+
+private:
+    template<typename View>
+    void sweepOctants(const View& view, const glm::ivec2& observerCell, float observerZ,
+                      float radius, float targetHeight, float refraction);
+
+    glm::ivec2         size;
+    glm::vec2          mapMin, mapRes;
+    float              noValue;
+    std::vector<float> map;
+    int                numCells, numVisible;
+    float              maxVisibleDist;
+};
+
+inline glm::ivec2 Viewshed::getSize() const {
+    return size;
+}
+
+inline glm::vec2 Viewshed::getMapMin() const {
+    return mapMin;
+}
+
+inline glm::vec2 Viewshed::getMapRes() const {
+    return mapRes;
+}
+
+inline float Viewshed::getNoValue() const {
+    return noValue;
+}
+
+inline const std::vector<float>& Viewshed::getMap() const {
+    return map;
+}
+
+inline float Viewshed::at(int i, int j) const {
+    return map[std::size_t(i)*size.y + j];
+}
+
+inline int Viewshed::getNumCells() const {
+    return numCells;
+}
+
+inline int Viewshed::getNumVisible() const {
+    return numVisible;
+}
+
+inline float Viewshed::getVisibleArea() const {
+    return float(numVisible)*mapRes.x*mapRes.y;
+}
+
+inline float Viewshed::getVisibleFraction() const {
+    return numCells > 0 ? float(numVisible)/float(numCells) : 0.0f;
+}
+
+inline float Viewshed::getMaxVisibleDistance() const {
+    return maxVisibleDist;
+}
+
+#endif // VIEWSHED_H